@@ -199,5 +199,6 @@ int aoenet_init(void);
 void aoenet_exit(void);
 void aoenet_xmit(struct sk_buff_head *);
 int is_aoe_netif(struct net_device *ifp);
+int aoe_ss_nidrange(int n, u32 *first, u32 *last);
 int set_aoe_iflist(const char __user *str, size_t size);
 
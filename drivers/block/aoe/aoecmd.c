@@ -24,6 +24,11 @@ module_param(aoe_maxout, int, 0644);
 MODULE_PARM_DESC(aoe_maxout,
 	"Only aoe_maxout outstanding packets for every MAC on eX.Y.");
 
+static int aoe_ss_cfg_burst = 256;
+module_param(aoe_ss_cfg_burst, int, 0644);
+MODULE_PARM_DESC(aoe_ss_cfg_burst,
+	"Most NIDs sent config queries per discovery on a SeaStar interface.");
+
 static struct sk_buff *
 new_skb(ulong len)
 {
@@ -285,15 +290,82 @@ aoecmd_ata_rw(struct aoedev *d)
 	return 1;
 }
 
+static int
+cfg_pkt(struct net_device *ifp, unsigned char *dst,
+	ushort aoemajor, unsigned char aoeminor, struct sk_buff_head *queue)
+{
+	struct aoe_hdr *h;
+	struct aoe_cfghdr *ch;
+	struct sk_buff *skb;
+
+	skb = new_skb(sizeof *h + sizeof *ch);
+	if (skb == NULL) {
+		printk(KERN_INFO "aoe: skb alloc failure\n");
+		return -ENOMEM;
+	}
+	skb_put(skb, sizeof *h + sizeof *ch);
+	skb->dev = ifp;
+	__skb_queue_tail(queue, skb);
+	h = (struct aoe_hdr *) skb_mac_header(skb);
+	memset(h, 0, sizeof *h + sizeof *ch);
+
+	memcpy(h->dst, dst, sizeof h->dst);
+	memcpy(h->src, ifp->dev_addr, sizeof h->src);
+	h->type = __constant_cpu_to_be16(ETH_P_AOE);
+	h->verfl = AOE_HVER;
+	h->major = cpu_to_be16(aoemajor);
+	h->minor = aoeminor;
+	h->cmd = AOECMD_CFG;
+	return 0;
+}
+
+/* SeaStar has no broadcast: query the configured NIDs at our lo_mac,
+ * at most aoe_ss_cfg_burst of them starting pos NIDs into the list.
+ * Returns where the next discovery should start, 0 once the list is done.
+ */
+static u32
+cfg_pkts_ss(struct net_device *ifp, u32 pos,
+	ushort aoemajor, unsigned char aoeminor, struct sk_buff_head *queue)
+{
+	unsigned char dst[ETH_ALEN];
+	u32 nid, first, last, skip = pos;
+	int i, n = max(aoe_ss_cfg_burst, 1);
+
+	memcpy(dst, ifp->dev_addr, sizeof dst);
+	for (i = 0; aoe_ss_nidrange(i, &first, &last) == 0; i++) {
+		if (last < first)
+			continue;
+		if (skip > last - first) {
+			skip -= last - first + 1;
+			continue;
+		}
+		for (nid = first + skip, skip = 0; ; nid++) {
+			if (n-- == 0)
+				return pos;
+			put_unaligned_be32(nid, dst);
+			if (memcmp(dst, ifp->dev_addr, sizeof dst)
+			&& cfg_pkt(ifp, dst, aoemajor, aoeminor, queue))
+				return pos;
+			pos++;
+			if (nid == last)
+				break;
+		}
+	}
+	return 0;
+}
+
 /* some callers cannot sleep, and they can call this function,
  * transmitting the packets later, when interrupts are on
  */
 static void
 aoecmd_cfg_pkts(ushort aoemajor, unsigned char aoeminor, struct sk_buff_head *queue)
 {
-	struct aoe_hdr *h;
-	struct aoe_cfghdr *ch;
-	struct sk_buff *skb;
+	static unsigned char bcast[ETH_ALEN] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+	};
+	/* a racing caller at worst repeats or skips one burst */
+	static u32 ss_pos;
+	u32 pos = ss_pos, next = pos;
 	struct net_device *ifp;
 
 	read_lock(&dev_base_lock);
@@ -302,29 +374,16 @@ aoecmd_cfg_pkts(ushort aoemajor, unsigned char aoeminor, struct sk_buff_head *qu
 		if (!is_aoe_netif(ifp))
 			goto cont;
 
-		skb = new_skb(sizeof *h + sizeof *ch);
-		if (skb == NULL) {
-			printk(KERN_INFO "aoe: skb alloc failure\n");
-			goto cont;
-		}
-		skb_put(skb, sizeof *h + sizeof *ch);
-		skb->dev = ifp;
-		__skb_queue_tail(queue, skb);
-		h = (struct aoe_hdr *) skb_mac_header(skb);
-		memset(h, 0, sizeof *h + sizeof *ch);
-
-		memset(h->dst, 0xff, sizeof h->dst);
-		memcpy(h->src, ifp->dev_addr, sizeof h->src);
-		h->type = __constant_cpu_to_be16(ETH_P_AOE);
-		h->verfl = AOE_HVER;
-		h->major = cpu_to_be16(aoemajor);
-		h->minor = aoeminor;
-		h->cmd = AOECMD_CFG;
+		if (ifp->priv_flags & IFF_SEASTAR)
+			next = cfg_pkts_ss(ifp, pos, aoemajor, aoeminor, queue);
+		else
+			cfg_pkt(ifp, bcast, aoemajor, aoeminor, queue);
 
 cont:
 		dev_put(ifp);
 	}
 	read_unlock(&dev_base_lock);
+	ss_pos = next;
 }
 
 static void
@@ -43,6 +43,15 @@ static int __init aoe_iflist_setup(char *str)
 __setup("aoe_iflist=", aoe_iflist_setup);
 #endif
 
+/*
+ * SeaStar interfaces have no broadcast, so config queries on them go to
+ * each NID in aoe_ss_nids, a whitespace-separated list of NIDs and
+ * first-last ranges of NIDs, aoe_ss_cfg_burst NIDs per discovery.
+ */
+static char aoe_ss_nids[IFLISTSZ];
+module_param_string(aoe_ss_nids, aoe_ss_nids, IFLISTSZ, 0600);
+MODULE_PARM_DESC(aoe_ss_nids, "aoe_ss_nids=\"nid1 [nid2-nid3 ...]\"");
+
 int
 is_aoe_netif(struct net_device *ifp)
 {
@@ -83,6 +92,42 @@ set_aoe_iflist(const char __user *user_str, size_t size)
 	return 0;
 }
 
+/* Returns the n'th entry of aoe_ss_nids as a range, or -1 past the end. */
+int
+aoe_ss_nidrange(int n, u32 *first, u32 *last)
+{
+	char *p, *q;
+
+	p = aoe_ss_nids + strspn(aoe_ss_nids, WHITESPACE);
+	for (; *p; p = q + strspn(q, WHITESPACE)) {
+		*first = simple_strtoul(p, &q, 0);
+		if (q == p)
+			break;	/* garbage */
+		*last = *first;
+		if (*q == '-')
+			*last = simple_strtoul(q + 1, &q, 0);
+		if (n-- == 0)
+			return 0;
+	}
+	return -1;
+}
+
+/*
+ * The SeaStar driver replaces the Ethernet header of a frame with its
+ * own, which has no room for the source NID that targets reply to.  So
+ * on SeaStar interfaces each AoE frame, Ethernet header and all, is sent
+ * behind another copy of that header for the driver to consume.
+ */
+static int
+aoenet_ss_encap(struct sk_buff *skb)
+{
+	if (skb_cow_head(skb, ETH_HLEN))
+		return -ENOMEM;
+	memcpy(skb_push(skb, ETH_HLEN), skb->data + ETH_HLEN, ETH_HLEN);
+	skb_reset_mac_header(skb);
+	return 0;
+}
+
 void
 aoenet_xmit(struct sk_buff_head *queue)
 {
@@ -90,12 +135,17 @@ aoenet_xmit(struct sk_buff_head *queue)
 
 	skb_queue_walk_safe(queue, skb, tmp) {
 		__skb_unlink(skb, queue);
+		if ((skb->dev->priv_flags & IFF_SEASTAR) && aoenet_ss_encap(skb)) {
+			dev_kfree_skb(skb);
+			continue;
+		}
 		dev_queue_xmit(skb);
 	}
 }
 
 /* 
  * (1) len doesn't include the header by default.  I want this. 
+ * (2) on SeaStar the AoE header follows the one the driver rebuilt.
  */
 static int
 aoenet_rcv(struct sk_buff *skb, struct net_device *ifp, struct packet_type *pt, struct net_device *orig_dev)
@@ -113,7 +163,10 @@ aoenet_rcv(struct sk_buff *skb, struct net_device *ifp, struct packet_type *pt,
 		goto exit;
 	if (!is_aoe_netif(ifp))
 		goto exit;
-	skb_push(skb, ETH_HLEN);	/* (1) */
+	if (ifp->priv_flags & IFF_SEASTAR)
+		skb_reset_mac_header(skb);	/* (2) */
+	else
+		skb_push(skb, ETH_HLEN);	/* (1) */
 
 	h = (struct aoe_hdr *) skb_mac_header(skb);
 	n = get_unaligned_be32(&h->tag);
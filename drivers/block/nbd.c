@@ -83,6 +83,8 @@ static const char *ioctl_cmd_to_ascii(int cmd)
 	case NBD_PRINT_DEBUG: return "print-debug";
 	case NBD_SET_SIZE_BLOCKS: return "set-size-blocks";
 	case NBD_DISCONNECT: return "disconnect";
+	case NBD_SET_TIMEOUT: return "set-timeout";
+	case NBD_SET_CONNS: return "set-conns";
 	case BLKROSET: return "set-read-only";
 	case BLKFLSBUF: return "flush-buffer-cache";
 	}
@@ -114,24 +116,54 @@ static void nbd_end_request(struct request *req)
 	spin_unlock_irqrestore(q->queue_lock, flags);
 }
 
-static void sock_shutdown(struct nbd_device *lo, int lock)
+static int nbd_connected(struct nbd_device *lo)
 {
-	/* Forcibly shutdown the socket causing all listeners
-	 * to error
+	int i;
+
+	for (i = 0; i < lo->nsocks; i++) {
+		if (lo->socks[i].sock)
+			return 1;
+	}
+	return 0;
+}
+
+static void sock_shutdown(struct nbd_device *lo)
+{
+	struct socket *sock;
+	int i;
+
+	/* Forcibly shutdown the sockets causing all listeners
+	 * to error.  Losing one connection takes down the others,
+	 * so that nbd-client sees the failure and can reconnect.
+	 *
+	 * The sockets stay alive until their files are put, so
+	 * a sender still using one is safe without its tx_lock.
 	 *
 	 * FIXME: This code is duplicated from sys_shutdown, but
 	 * there should be a more generic interface rather than
 	 * calling socket ops directly here */
-	if (lock)
-		mutex_lock(&lo->tx_lock);
-	if (lo->sock) {
-		printk(KERN_WARNING "%s: shutting down socket\n",
-			lo->disk->disk_name);
-		kernel_sock_shutdown(lo->sock, SHUT_RDWR);
-		lo->sock = NULL;
+	for (i = 0; i < lo->nsocks; i++) {
+		sock = xchg(&lo->socks[i].sock, NULL);
+		if (sock) {
+			printk(KERN_WARNING "%s: shutting down socket %d\n",
+				lo->disk->disk_name, i);
+			kernel_sock_shutdown(sock, SHUT_RDWR);
+		}
 	}
-	if (lock)
-		mutex_unlock(&lo->tx_lock);
+}
+
+static void nbd_put_files(struct nbd_device *lo)
+{
+	struct file *file;
+	int i;
+
+	for (i = 0; i < lo->nsocks; i++) {
+		file = lo->socks[i].file;
+		lo->socks[i].file = NULL;
+		if (file)
+			fput(file);
+	}
+	lo->nsocks = 0;
 }
 
 static void nbd_xmit_timeout(unsigned long arg)
@@ -146,10 +178,11 @@ static void nbd_xmit_timeout(unsigned long arg)
 /*
  *  Send or receive packet.
  */
-static int sock_xmit(struct nbd_device *lo, int send, void *buf, int size,
+static int sock_xmit(struct nbd_sock *ns, int send, void *buf, int size,
 		int msg_flags)
 {
-	struct socket *sock = lo->sock;
+	struct nbd_device *lo = ns->lo;
+	struct socket *sock = ns->sock;
 	int result;
 	struct msghdr msg;
 	struct kvec iov;
@@ -198,7 +231,7 @@ static int sock_xmit(struct nbd_device *lo, int send, void *buf, int size,
 				task_pid_nr(current), current->comm,
 				dequeue_signal_lock(current, &current->blocked, &info));
 			result = -EINTR;
-			sock_shutdown(lo, !send);
+			sock_shutdown(lo);
 			break;
 		}
 
@@ -216,19 +249,20 @@ static int sock_xmit(struct nbd_device *lo, int send, void *buf, int size,
 	return result;
 }
 
-static inline int sock_send_bvec(struct nbd_device *lo, struct bio_vec *bvec,
+static inline int sock_send_bvec(struct nbd_sock *ns, struct bio_vec *bvec,
 		int flags)
 {
 	int result;
 	void *kaddr = kmap(bvec->bv_page);
-	result = sock_xmit(lo, 1, kaddr + bvec->bv_offset, bvec->bv_len, flags);
+	result = sock_xmit(ns, 1, kaddr + bvec->bv_offset, bvec->bv_len, flags);
 	kunmap(bvec->bv_page);
 	return result;
 }
 
-/* always call with the tx_lock held */
-static int nbd_send_req(struct nbd_device *lo, struct request *req)
+/* always call with the socket's tx_lock held */
+static int nbd_send_req(struct nbd_sock *ns, struct request *req)
 {
+	struct nbd_device *lo = ns->lo;
 	int result, flags;
 	struct nbd_request request;
 	unsigned long size = blk_rq_bytes(req);
@@ -244,7 +278,7 @@ static int nbd_send_req(struct nbd_device *lo, struct request *req)
 			nbdcmd_to_ascii(nbd_cmd(req)),
 			(unsigned long long)blk_rq_pos(req) << 9,
 			blk_rq_bytes(req));
-	result = sock_xmit(lo, 1, &request, sizeof(request),
+	result = sock_xmit(ns, 1, &request, sizeof(request),
 			(nbd_cmd(req) == NBD_CMD_WRITE) ? MSG_MORE : 0);
 	if (result <= 0) {
 		printk(KERN_ERR "%s: Send control failed (result %d)\n",
@@ -265,7 +299,7 @@ static int nbd_send_req(struct nbd_device *lo, struct request *req)
 				flags = MSG_MORE;
 			dprintk(DBG_TX, "%s: request %p: sending %d bytes data\n",
 					lo->disk->disk_name, req, bvec->bv_len);
-			result = sock_send_bvec(lo, bvec, flags);
+			result = sock_send_bvec(ns, bvec, flags);
 			if (result <= 0) {
 				printk(KERN_ERR "%s: Send data failed (result %d)\n",
 						lo->disk->disk_name, result);
@@ -279,13 +313,14 @@ error_out:
 	return -EIO;
 }
 
-static struct request *nbd_find_request(struct nbd_device *lo,
+static struct request *nbd_find_request(struct nbd_sock *ns,
 					struct request *xreq)
 {
+	struct nbd_device *lo = ns->lo;
 	struct request *req, *tmp;
 	int err;
 
-	err = wait_event_interruptible(lo->active_wq, lo->active_req != xreq);
+	err = wait_event_interruptible(lo->active_wq, ns->active_req != xreq);
 	if (unlikely(err))
 		goto out;
 
@@ -305,25 +340,26 @@ out:
 	return ERR_PTR(err);
 }
 
-static inline int sock_recv_bvec(struct nbd_device *lo, struct bio_vec *bvec)
+static inline int sock_recv_bvec(struct nbd_sock *ns, struct bio_vec *bvec)
 {
 	int result;
 	void *kaddr = kmap(bvec->bv_page);
-	result = sock_xmit(lo, 0, kaddr + bvec->bv_offset, bvec->bv_len,
+	result = sock_xmit(ns, 0, kaddr + bvec->bv_offset, bvec->bv_len,
 			MSG_WAITALL);
 	kunmap(bvec->bv_page);
 	return result;
 }
 
 /* NULL returned = something went wrong, inform userspace */
-static struct request *nbd_read_stat(struct nbd_device *lo)
+static struct request *nbd_read_stat(struct nbd_sock *ns)
 {
+	struct nbd_device *lo = ns->lo;
 	int result;
 	struct nbd_reply reply;
 	struct request *req;
 
 	reply.magic = 0;
-	result = sock_xmit(lo, 0, &reply, sizeof(reply), MSG_WAITALL);
+	result = sock_xmit(ns, 0, &reply, sizeof(reply), MSG_WAITALL);
 	if (result <= 0) {
 		printk(KERN_ERR "%s: Receive control failed (result %d)\n",
 				lo->disk->disk_name, result);
@@ -338,7 +374,7 @@ static struct request *nbd_read_stat(struct nbd_device *lo)
 		goto harderror;
 	}
 
-	req = nbd_find_request(lo, *(struct request **)reply.handle);
+	req = nbd_find_request(ns, *(struct request **)reply.handle);
 	if (IS_ERR(req)) {
 		result = PTR_ERR(req);
 		if (result != -ENOENT)
@@ -364,7 +400,7 @@ static struct request *nbd_read_stat(struct nbd_device *lo)
 		struct bio_vec *bvec;
 
 		rq_for_each_segment(bvec, req, iter) {
-			result = sock_recv_bvec(lo, bvec);
+			result = sock_recv_bvec(ns, bvec);
 			if (result <= 0) {
 				printk(KERN_ERR "%s: Receive data failed (result %d)\n",
 						lo->disk->disk_name, result);
@@ -395,10 +431,37 @@ static struct device_attribute pid_attr = {
 	.show = pid_show,
 };
 
-static int nbd_do_it(struct nbd_device *lo)
+static void nbd_recv(struct nbd_sock *ns)
 {
 	struct request *req;
+
+	while ((req = nbd_read_stat(ns)) != NULL)
+		nbd_end_request(req);
+
+	sock_shutdown(ns->lo);
+}
+
+/* Receives on the second and later connections, until nbd_do_it is done */
+static int nbd_recv_thread(void *data)
+{
+	struct nbd_sock *ns = data;
+
+	nbd_recv(ns);
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static int nbd_do_it(struct nbd_device *lo)
+{
+	struct nbd_sock *ns;
 	int ret;
+	int i;
 
 	BUG_ON(lo->magic != LO_MAGIC);
 
@@ -410,8 +473,28 @@ static int nbd_do_it(struct nbd_device *lo)
 		return ret;
 	}
 
-	while ((req = nbd_read_stat(lo)) != NULL)
-		nbd_end_request(req);
+	/* the caller receives on the first connection */
+	for (i = 1; i < lo->nsocks; i++) {
+		ns = &lo->socks[i];
+		ns->recv_thread = kthread_run(nbd_recv_thread, ns, "%s-recv%d",
+					      lo->disk->disk_name, i);
+		if (IS_ERR(ns->recv_thread)) {
+			printk(KERN_ERR "%s: cannot start receiver %d\n",
+					lo->disk->disk_name, i);
+			ns->recv_thread = NULL;
+			sock_shutdown(lo);
+			break;
+		}
+	}
+
+	nbd_recv(&lo->socks[0]);
+
+	for (i = 1; i < lo->nsocks; i++) {
+		ns = &lo->socks[i];
+		if (ns->recv_thread)
+			kthread_stop(ns->recv_thread);
+		ns->recv_thread = NULL;
+	}
 
 	sysfs_remove_file(&disk_to_dev(lo->disk)->kobj, &pid_attr.attr);
 	lo->pid = 0;
@@ -421,19 +504,22 @@ static int nbd_do_it(struct nbd_device *lo)
 static void nbd_clear_que(struct nbd_device *lo)
 {
 	struct request *req;
+	int i;
 
 	BUG_ON(lo->magic != LO_MAGIC);
 
 	/*
-	 * Because we have set lo->sock to NULL under the tx_lock, all
-	 * modifications to the list must have completed by now.  For
-	 * the same reason, the active_req must be NULL.
+	 * Because we have set every socket to NULL and stopped the
+	 * threads sending on them, all modifications to the list must
+	 * have completed by now.  For the same reason, no active_req
+	 * may be left.
 	 *
 	 * As a consequence, we don't need to take the spin lock while
 	 * purging the list here.
 	 */
-	BUG_ON(lo->sock);
-	BUG_ON(lo->active_req);
+	BUG_ON(nbd_connected(lo));
+	for (i = 0; i < lo->nsocks; i++)
+		BUG_ON(lo->socks[i].active_req);
 
 	while (!list_empty(&lo->queue_head)) {
 		req = list_entry(lo->queue_head.next, struct request,
@@ -445,8 +531,10 @@ static void nbd_clear_que(struct nbd_device *lo)
 }
 
 
-static void nbd_handle_req(struct nbd_device *lo, struct request *req)
+static void nbd_handle_req(struct nbd_sock *ns, struct request *req)
 {
+	struct nbd_device *lo = ns->lo;
+
 	if (!blk_fs_request(req))
 		goto error_out;
 
@@ -462,17 +550,17 @@ static void nbd_handle_req(struct nbd_device *lo, struct request *req)
 
 	req->errors = 0;
 
-	mutex_lock(&lo->tx_lock);
-	if (unlikely(!lo->sock)) {
-		mutex_unlock(&lo->tx_lock);
+	mutex_lock(&ns->tx_lock);
+	if (unlikely(!ns->sock)) {
+		mutex_unlock(&ns->tx_lock);
 		printk(KERN_ERR "%s: Attempted send on closed socket\n",
 		       lo->disk->disk_name);
 		goto error_out;
 	}
 
-	lo->active_req = req;
+	ns->active_req = req;
 
-	if (nbd_send_req(lo, req) != 0) {
+	if (nbd_send_req(ns, req) != 0) {
 		printk(KERN_ERR "%s: Request send failed\n",
 				lo->disk->disk_name);
 		req->errors++;
@@ -483,8 +571,8 @@ static void nbd_handle_req(struct nbd_device *lo, struct request *req)
 		spin_unlock(&lo->queue_lock);
 	}
 
-	lo->active_req = NULL;
-	mutex_unlock(&lo->tx_lock);
+	ns->active_req = NULL;
+	mutex_unlock(&ns->tx_lock);
 	wake_up_all(&lo->active_wq);
 
 	return;
@@ -494,9 +582,15 @@ error_out:
 	nbd_end_request(req);
 }
 
+/*
+ * One of these runs for each connection, all taking requests from the
+ * same waiting_queue, so requests go out on whichever connection is
+ * free and several can be in flight at once.
+ */
 static int nbd_thread(void *data)
 {
-	struct nbd_device *lo = data;
+	struct nbd_sock *ns = data;
+	struct nbd_device *lo = ns->lo;
 	struct request *req;
 
 	set_user_nice(current, -20);
@@ -506,18 +600,19 @@ static int nbd_thread(void *data)
 					 kthread_should_stop() ||
 					 !list_empty(&lo->waiting_queue));
 
-		/* extract request */
-		if (list_empty(&lo->waiting_queue))
-			continue;
-
+		/* extract request, unless another connection got it */
 		spin_lock_irq(&lo->queue_lock);
+		if (list_empty(&lo->waiting_queue)) {
+			spin_unlock_irq(&lo->queue_lock);
+			continue;
+		}
 		req = list_entry(lo->waiting_queue.next, struct request,
 				 queuelist);
 		list_del_init(&req->queuelist);
 		spin_unlock_irq(&lo->queue_lock);
 
 		/* handle request */
-		nbd_handle_req(lo, req);
+		nbd_handle_req(ns, req);
 	}
 	return 0;
 }
@@ -545,7 +640,7 @@ static void do_nbd_request(struct request_queue *q)
 
 		BUG_ON(lo->magic != LO_MAGIC);
 
-		if (unlikely(!lo->sock)) {
+		if (unlikely(!nbd_connected(lo))) {
 			printk(KERN_ERR "%s: Attempted send on closed socket\n",
 				lo->disk->disk_name);
 			req->errors++;
@@ -572,41 +667,50 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *lo,
 	switch (cmd) {
 	case NBD_DISCONNECT: {
 		struct request sreq;
+		struct nbd_sock *ns;
+		int i;
 
 	        printk(KERN_INFO "%s: NBD_DISCONNECT\n", lo->disk->disk_name);
 
 		blk_rq_init(NULL, &sreq);
 		sreq.cmd_type = REQ_TYPE_SPECIAL;
 		nbd_cmd(&sreq) = NBD_CMD_DISC;
-		if (!lo->sock)
+		if (!nbd_connected(lo))
 			return -EINVAL;
-		nbd_send_req(lo, &sreq);
+		/* the server sees each connection as a client of its own */
+		for (i = 0; i < lo->nsocks; i++) {
+			ns = &lo->socks[i];
+			mutex_lock(&ns->tx_lock);
+			if (ns->sock)
+				nbd_send_req(ns, &sreq);
+			mutex_unlock(&ns->tx_lock);
+		}
                 return 0;
 	}
  
 	case NBD_CLEAR_SOCK: {
-		struct file *file;
+		int i;
 
-		lo->sock = NULL;
-		file = lo->file;
-		lo->file = NULL;
+		for (i = 0; i < lo->nsocks; i++)
+			lo->socks[i].sock = NULL;
 		nbd_clear_que(lo);
 		BUG_ON(!list_empty(&lo->queue_head));
-		if (file)
-			fput(file);
+		nbd_put_files(lo);
 		return 0;
 	}
 
 	case NBD_SET_SOCK: {
 		struct file *file;
-		if (lo->file)
+		if (lo->nsocks >= lo->nconns)
 			return -EBUSY;
 		file = fget(arg);
 		if (file) {
 			struct inode *inode = file->f_path.dentry->d_inode;
 			if (S_ISSOCK(inode->i_mode)) {
-				lo->file = file;
-				lo->sock = SOCKET_I(inode);
+				struct nbd_sock *ns = &lo->socks[lo->nsocks];
+				ns->file = file;
+				ns->sock = SOCKET_I(inode);
+				lo->nsocks++;
 				if (max_part > 0)
 					bdev->bd_invalidated = 1;
 				return 0;
@@ -617,6 +721,14 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *lo,
 		return -EINVAL;
 	}
 
+	case NBD_SET_CONNS:
+		if (lo->nsocks)
+			return -EBUSY;
+		if (arg < 1 || arg > NBD_MAX_CONNS)
+			return -EINVAL;
+		lo->nconns = arg;
+		return 0;
+
 	case NBD_SET_BLKSIZE:
 		lo->blksize = arg;
 		lo->bytesize &= ~(lo->blksize-1);
@@ -645,35 +757,43 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *lo,
 
 	case NBD_DO_IT: {
 		struct task_struct *thread;
-		struct file *file;
 		int error;
+		int i;
 
 		if (lo->pid)
 			return -EBUSY;
-		if (!lo->file)
+		if (!lo->nsocks)
 			return -EINVAL;
 
 		mutex_unlock(&lo->tx_lock);
 
-		thread = kthread_create(nbd_thread, lo, lo->disk->disk_name);
-		if (IS_ERR(thread)) {
-			mutex_lock(&lo->tx_lock);
-			return PTR_ERR(thread);
+		for (i = 0; i < lo->nsocks; i++) {
+			thread = kthread_create(nbd_thread, &lo->socks[i],
+						lo->disk->disk_name);
+			if (IS_ERR(thread)) {
+				while (i--) {
+					kthread_stop(lo->socks[i].send_thread);
+					lo->socks[i].send_thread = NULL;
+				}
+				mutex_lock(&lo->tx_lock);
+				return PTR_ERR(thread);
+			}
+			lo->socks[i].send_thread = thread;
+			wake_up_process(thread);
 		}
-		wake_up_process(thread);
 		error = nbd_do_it(lo);
-		kthread_stop(thread);
+		for (i = 0; i < lo->nsocks; i++) {
+			kthread_stop(lo->socks[i].send_thread);
+			lo->socks[i].send_thread = NULL;
+		}
 
 		mutex_lock(&lo->tx_lock);
 		if (error)
 			return error;
-		sock_shutdown(lo, 0);
-		file = lo->file;
-		lo->file = NULL;
+		sock_shutdown(lo);
 		nbd_clear_que(lo);
 		printk(KERN_WARNING "%s: queue cleared\n", lo->disk->disk_name);
-		if (file)
-			fput(file);
+		nbd_put_files(lo);
 		lo->bytesize = 0;
 		bdev->bd_inode->i_size = 0;
 		set_capacity(lo->disk, 0);
@@ -687,7 +807,7 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *lo,
 		 * This is for compatibility only.  The queue is always cleared
 		 * by NBD_DO_IT or NBD_CLEAR_SOCK.
 		 */
-		BUG_ON(!lo->sock && !list_empty(&lo->queue_head));
+		BUG_ON(!nbd_connected(lo) && !list_empty(&lo->queue_head));
 		return 0;
 
 	case NBD_PRINT_DEBUG:
@@ -785,7 +905,14 @@ static int __init nbd_init(void)
 
 	for (i = 0; i < nbds_max; i++) {
 		struct gendisk *disk = nbd_dev[i].disk;
-		nbd_dev[i].file = NULL;
+		int j;
+
+		for (j = 0; j < NBD_MAX_CONNS; j++) {
+			nbd_dev[i].socks[j].lo = &nbd_dev[i];
+			mutex_init(&nbd_dev[i].socks[j].tx_lock);
+		}
+		nbd_dev[i].nconns = 1;
+		nbd_dev[i].nsocks = 0;
 		nbd_dev[i].magic = LO_MAGIC;
 		nbd_dev[i].flags = 0;
 		INIT_LIST_HEAD(&nbd_dev[i].waiting_queue);
@@ -0,0 +1,107 @@
+/*******************************************************************************
+    SeaStar NIC Linux Driver
+    Copyright (C) 2009 Cray Inc. and Sandia National Laboratories
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Contact Information:
+    Kevin Pedretti <ktpedre@sandia.gov>
+    Scalable System Software Dept.
+    Sandia National Laboratories
+    P.O. Box 5800 MS 1319
+    Albuquerque, NM 87185
+
+*******************************************************************************/
+
+
+#include <linux/netdevice.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/pci.h>
+#include "firmware.h"
+#include "seastar.h"
+
+
+/**
+ * Reserves a physically contiguous arena of at least size bytes on the
+ * given NUMA node.  If huge is set the arena is rounded up to a whole,
+ * naturally aligned huge page so the kernel's direct mapping covers it
+ * with a single large TLB entry.  If no huge page is free the arena
+ * falls back to the size asked for.
+ */
+int ss_arena_init(struct ss_arena *arena, unsigned long size, int node,
+		  int huge)
+{
+	struct page *page = NULL;
+	unsigned int order;
+
+	order = get_order(size);
+	if (order >= MAX_ORDER)
+		return -EINVAL;
+
+#ifdef HUGETLB_PAGE_ORDER
+	if (huge && order < HUGETLB_PAGE_ORDER &&
+	    HUGETLB_PAGE_ORDER < MAX_ORDER) {
+		page = alloc_pages_node(node, GFP_KERNEL | __GFP_ZERO |
+					__GFP_NOWARN | __GFP_NORETRY,
+					HUGETLB_PAGE_ORDER);
+		if (page)
+			order = HUGETLB_PAGE_ORDER;
+	}
+#endif
+	if (!page)
+		page = alloc_pages_node(node, GFP_KERNEL | __GFP_ZERO, order);
+	if (!page)
+		return -ENOMEM;
+
+	arena->base  = page_address(page);
+	arena->size  = PAGE_SIZE << order;
+	arena->used  = 0;
+	arena->order = order;
+	arena->node  = page_to_nid(page);
+
+	return 0;
+}
+
+
+/**
+ * Carves size bytes, aligned to align bytes (a power of two), out of the
+ * arena.  Arena memory is never handed back individually.
+ */
+void *ss_arena_alloc(struct ss_arena *arena, unsigned long size,
+		     unsigned long align)
+{
+	unsigned long start = ALIGN(arena->used, align);
+
+	if (start + size > arena->size)
+		return NULL;
+
+	arena->used = start + size;
+	return arena->base + start;
+}
+
+
+/**
+ * Releases the whole arena.
+ */
+void ss_arena_free(struct ss_arena *arena)
+{
+	if (!arena->base)
+		return;
+
+	free_pages((unsigned long)arena->base, arena->order);
+	arena->base = NULL;
+}
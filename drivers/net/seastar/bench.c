@@ -0,0 +1,474 @@
+/*******************************************************************************
+    SeaStar NIC Linux Driver
+    Copyright (C) 2009 Cray Inc. and Sandia National Laboratories
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Contact Information:
+    Kevin Pedretti <ktpedre@sandia.gov>
+    Scalable System Software Dept.
+    Sandia National Laboratories
+    P.O. Box 5800 MS 1319
+    Albuquerque, NM 87185
+
+*******************************************************************************/
+
+
+/*
+ * Microbenchmarks for the per-packet work done by the driver.
+ *
+ * The benchmarks run against a private, never-registered SeaStar netdev
+ * whose mailbox and skb table live in host memory.  It is only created,
+ * along with its host arena, the first time the benchmarks are run.  The
+ * benchmark itself plays the firmware: it consumes each command as soon
+ * as it is posted and, for the full transmit path, posts the matching
+ * EVENT_TX_END and calls the interrupt handler.  Writing a number of
+ * iterations (or just "run") to <debugfs>/seastar/bench sweeps all
+ * operations over a range of packet sizes and buffer alignments; reading
+ * it returns the cycle counts of the last run.
+ */
+
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/kernel.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/platform_device.h>
+#include <linux/mutex.h>
+#include <linux/timex.h>
+#include <linux/uaccess.h>
+#include "firmware.h"
+#include "seastar.h"
+
+
+enum bench_op {
+	BENCH_ETH2SS,
+	BENCH_SS2ETH,
+	BENCH_HEADER_CREATE,
+	BENCH_PENDING,
+	BENCH_CMD,
+	BENCH_TX,
+	NUM_BENCH_OPS
+};
+
+
+static const char * const bench_op_names[NUM_BENCH_OPS] = {
+	[BENCH_ETH2SS]		= "eth2ss",
+	[BENCH_SS2ETH]		= "ss2eth",
+	[BENCH_HEADER_CREATE]	= "header_create",
+	[BENCH_PENDING]		= "pending_alloc_free",
+	[BENCH_CMD]		= "ip_tx_cmd",
+	[BENCH_TX]		= "tx_to_tx_end",
+};
+
+
+static const unsigned int bench_sizes[] = { 64, 128, 512, 1500, 4096, 8192 };
+
+
+/**
+ * Byte offsets of the frame from a quadbyte boundary.  Any offset other
+ * than 2 leaves the SeaStar header misaligned and forces ss_tx() onto the
+ * bounce buffer path.
+ */
+#define NUM_BENCH_ALIGNS	4
+
+
+#define BENCH_DEFAULT_ITERS	10000
+#define BENCH_NID		1
+
+
+struct bench_result {
+	uint64_t		min;
+	uint64_t		total;
+	unsigned int		iters;
+};
+
+
+static struct bench_result
+bench_results[NUM_BENCH_OPS][ARRAY_SIZE(bench_sizes)][NUM_BENCH_ALIGNS];
+static uint64_t bench_overhead;
+
+static DEFINE_MUTEX(bench_mutex);
+static struct dentry *bench_dir, *bench_file;
+static struct platform_device *bench_pdev;
+static struct net_device *bench_netdev;
+
+static struct mailbox *bench_mailbox;
+static uint64_t bench_skb_table[NUM_SKBS];
+static struct niccb bench_niccb;
+static uint32_t bench_htb_map[16];
+static uint16_t bench_nid = BENCH_NID;
+
+
+static void bench_record(struct bench_result *r, uint64_t cycles)
+{
+	cycles = (cycles > bench_overhead) ? cycles - bench_overhead : 0;
+
+	if (!r->iters || cycles < r->min)
+		r->min = cycles;
+	r->total += cycles;
+	r->iters++;
+}
+
+
+/**
+ * Resets skb to hold an Ethernet-framed IPv4 packet of len bytes whose
+ * first byte sits align bytes past a quadbyte boundary.
+ */
+static void bench_reset_skb(struct sk_buff *skb, unsigned int len,
+			    unsigned int align)
+{
+	struct ethhdr *eh;
+
+	skb->data = PTR_ALIGN(skb->head + NET_SKB_PAD, 4) + align;
+	skb->len  = 0;
+	skb_reset_tail_pointer(skb);
+	skb_put(skb, len);
+
+	eh = (struct ethhdr *)skb->data;
+	memcpy(eh->h_source, bench_netdev->dev_addr, ETH_ALEN);
+	memcpy(eh->h_dest, bench_netdev->dev_addr, ETH_ALEN);
+	eh->h_proto = htons(ETH_P_IP);
+
+	skb->protocol = htons(ETH_P_IP);
+	skb_set_queue_mapping(skb, TX_LANE_BULK);
+}
+
+
+/**
+ * Consumes every command posted to the bench mailbox, as the firmware
+ * would.  Posts EVENT_TX_END for each IP_TX when complete is set.
+ */
+static void bench_consume_commands(struct ss_priv *ssp, int complete)
+{
+	struct mailbox *mbox = bench_mailbox;
+	const volatile struct command_ip_tx *tx;
+	unsigned int read = mbox->commandq_read;
+	unsigned int eq_write;
+
+	eq_write = ssp->eq_read;
+	while (read != mbox->commandq_write) {
+		tx = (const volatile struct command_ip_tx *)
+			&mbox->commandq[read];
+		if (complete && tx->op == COMMAND_IP_TX) {
+			ssp->eq[eq_write] = (EVENT_TX_END << 16) |
+					    tx->pending_index;
+			eq_write = (eq_write + 1) % NUM_EQ_ENTRIES;
+		}
+		read = (read + 1 == COMMAND_Q_LENGTH) ? 0 : read + 1;
+	}
+	mbox->commandq_read = read;
+}
+
+
+static void bench_run_one(enum bench_op op, unsigned int si, unsigned int ai,
+			  struct sk_buff *skb, unsigned int iters)
+{
+	struct net_device *netdev = bench_netdev;
+	struct ss_priv *ssp = netdev_priv(netdev);
+	struct bench_result *r = &bench_results[op][si][ai];
+	unsigned int len = bench_sizes[si];
+	struct pending *pending;
+	struct sk_buff *tx_skb;
+	unsigned long flags;
+	cycles_t t0, t1;
+	unsigned int i;
+
+	memset(r, 0, sizeof(*r));
+
+	for (i = 0; i < iters; i++) {
+		bench_reset_skb(skb, len, ai);
+
+		switch (op) {
+
+		case BENCH_ETH2SS:
+			t0 = get_cycles();
+			eth2ss(ssp, skb);
+			t1 = get_cycles();
+			break;
+
+		case BENCH_SS2ETH:
+			eth2ss(ssp, skb);
+			t0 = get_cycles();
+			ss2eth(skb);
+			t1 = get_cycles();
+			break;
+
+		case BENCH_HEADER_CREATE:
+			skb_pull(skb, ETH_HLEN);
+			t0 = get_cycles();
+			ss_header_create(skb, netdev, ETH_P_IP,
+					 netdev->dev_addr, NULL, skb->len);
+			t1 = get_cycles();
+			break;
+
+		case BENCH_PENDING:
+			spin_lock_irqsave(&ssp->lock, flags);
+			t0 = get_cycles();
+			pending = alloc_tx_pending(ssp);
+			free_tx_pending(ssp, pending);
+			t1 = get_cycles();
+			spin_unlock_irqrestore(&ssp->lock, flags);
+			break;
+
+		case BENCH_CMD:
+			spin_lock_irqsave(&ssp->lock, flags);
+			t0 = get_cycles();
+			seastar_ip_tx_cmd(ssp, BENCH_NID, len >> 2,
+					  virt_to_phys(skb->data) >> 2, 0);
+			t1 = get_cycles();
+			spin_unlock_irqrestore(&ssp->lock, flags);
+			bench_consume_commands(ssp, 0);
+			break;
+
+		case BENCH_TX:
+			/* An unshared skb, as the stack would hand over, which
+			 * ss_tx_end() frees */
+			tx_skb = alloc_skb(NET_SKB_PAD + 8 + len, GFP_KERNEL);
+			if (!tx_skb)
+				return;
+			tx_skb->dev = netdev;
+			bench_reset_skb(tx_skb, len, ai);
+			local_bh_disable();
+			t0 = get_cycles();
+			ss_tx(tx_skb, netdev);
+			bench_consume_commands(ssp, 1);
+			ss_interrupt(0, netdev);
+			t1 = get_cycles();
+			local_bh_enable();
+			break;
+
+		default:
+			return;
+		}
+
+		bench_record(r, t1 - t0);
+	}
+}
+
+
+static int bench_run(unsigned int iters)
+{
+	struct sk_buff *skb;
+	unsigned int op, si, ai, i, max_len;
+	cycles_t t0, t1;
+
+	max_len = bench_sizes[ARRAY_SIZE(bench_sizes) - 1];
+	skb = alloc_skb(NET_SKB_PAD + 8 + max_len, GFP_KERNEL);
+	if (!skb)
+		return -ENOMEM;
+	skb->dev = bench_netdev;
+
+	/* Calibrate the cost of reading the cycle counter */
+	bench_overhead = ~0ULL;
+	for (i = 0; i < 1000; i++) {
+		t0 = get_cycles();
+		t1 = get_cycles();
+		bench_overhead = min_t(uint64_t, bench_overhead, t1 - t0);
+	}
+
+	for (op = 0; op < NUM_BENCH_OPS; op++) {
+		for (si = 0; si < ARRAY_SIZE(bench_sizes); si++) {
+			for (ai = 0; ai < NUM_BENCH_ALIGNS; ai++) {
+				bench_run_one(op, si, ai, skb, iters);
+				cond_resched();
+			}
+		}
+	}
+
+	kfree_skb(skb);
+	return 0;
+}
+
+
+static int bench_show(struct seq_file *m, void *v)
+{
+	struct bench_result *r;
+	unsigned int op, si, ai;
+
+	seq_printf(m, "# cycle counter overhead %llu (subtracted)\n",
+		   (unsigned long long)bench_overhead);
+	seq_printf(m, "# %-18s %6s %5s %8s %10s %10s\n",
+		   "op", "size", "align", "iters", "min", "avg");
+
+	mutex_lock(&bench_mutex);
+	for (op = 0; op < NUM_BENCH_OPS; op++) {
+		for (si = 0; si < ARRAY_SIZE(bench_sizes); si++) {
+			for (ai = 0; ai < NUM_BENCH_ALIGNS; ai++) {
+				r = &bench_results[op][si][ai];
+				if (!r->iters)
+					continue;
+				seq_printf(m,
+					   "  %-18s %6u %5u %8u %10llu %10llu\n",
+					   bench_op_names[op], bench_sizes[si],
+					   ai, r->iters,
+					   (unsigned long long)r->min,
+					   (unsigned long long)
+					   div_u64(r->total, r->iters));
+			}
+		}
+	}
+	mutex_unlock(&bench_mutex);
+
+	return 0;
+}
+
+
+static int bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, bench_show, NULL);
+}
+
+
+/**
+ * Frees whatever bench_setup_netdev() managed to set up.
+ */
+static void bench_teardown_netdev(void)
+{
+	if (bench_netdev) {
+		ss_tx_purge(netdev_priv(bench_netdev));
+		ss_free_netdev(bench_netdev);
+		bench_netdev = NULL;
+	}
+
+	if (bench_pdev)
+		platform_device_unregister(bench_pdev);
+	bench_pdev = NULL;
+
+	free_page((unsigned long)bench_mailbox);
+	bench_mailbox = NULL;
+}
+
+
+/**
+ * Builds the memory-backed bench netdev.  The netdev is never registered
+ * and the firmware is never initialized; the benchmark consumes commands
+ * itself.
+ */
+static int bench_setup_netdev(void)
+{
+	struct ss_priv *ssp;
+	struct ss_hw hw;
+	int err;
+
+	bench_mailbox = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!bench_mailbox)
+		return -ENOMEM;
+
+	bench_pdev = platform_device_register_simple("seastar-bench", -1,
+						     NULL, 0);
+	if (IS_ERR(bench_pdev)) {
+		err = PTR_ERR(bench_pdev);
+		bench_pdev = NULL;
+		goto err_out;
+	}
+
+	memset(&hw, 0, sizeof(hw));
+	hw.mailbox	= bench_mailbox;
+	hw.skb_table	= bench_skb_table;
+	hw.niccb	= &bench_niccb;
+	hw.htb_map	= bench_htb_map;
+	hw.tx_source	= &bench_nid;
+
+	bench_netdev = ss_alloc_netdev(&bench_pdev->dev, &hw);
+	if (!bench_netdev) {
+		err = -ENOMEM;
+		goto err_out;
+	}
+
+	*(__be32 *)bench_netdev->dev_addr = htonl(BENCH_NID);
+
+	ssp = netdev_priv(bench_netdev);
+	ssp->mailbox = bench_mailbox;
+
+	netif_tx_start_all_queues(bench_netdev);
+	return 0;
+
+err_out:
+	bench_teardown_netdev();
+	return err;
+}
+
+
+static ssize_t bench_write(struct file *file, const char __user *ubuf,
+			   size_t count, loff_t *ppos)
+{
+	char buf[16];
+	unsigned long iters;
+	int err;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	iters = simple_strtoul(buf, NULL, 0);
+	if (!iters)
+		iters = BENCH_DEFAULT_ITERS;
+
+	mutex_lock(&bench_mutex);
+	err = bench_netdev ? 0 : bench_setup_netdev();
+	if (!err)
+		err = bench_run(iters);
+	mutex_unlock(&bench_mutex);
+
+	return err ? err : count;
+}
+
+
+static const struct file_operations bench_fops = {
+	.owner		= THIS_MODULE,
+	.open		= bench_open,
+	.read		= seq_read,
+	.write		= bench_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+
+int seastar_bench_init(void)
+{
+	int err;
+
+	bench_dir = debugfs_create_dir("seastar", NULL);
+	if (!bench_dir) {
+		err = -ENOMEM;
+		goto err_out;
+	}
+
+	bench_file = debugfs_create_file("bench", S_IRUGO | S_IWUSR,
+					 bench_dir, NULL, &bench_fops);
+	if (!bench_file) {
+		err = -ENOMEM;
+		goto err_out;
+	}
+
+	return 0;
+
+err_out:
+	seastar_bench_exit();
+	return err;
+}
+
+
+void seastar_bench_exit(void)
+{
+	debugfs_remove(bench_file);
+	debugfs_remove(bench_dir);
+	bench_file = bench_dir = NULL;
+
+	bench_teardown_netdev();
+}
@@ -0,0 +1,722 @@
+/*******************************************************************************
+    SeaStar NIC Linux Driver
+    Copyright (C) 2009 Cray Inc. and Sandia National Laboratories
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Contact Information:
+    Kevin Pedretti <ktpedre@sandia.gov>
+    Scalable System Software Dept.
+    Sandia National Laboratories
+    P.O. Box 5800 MS 1319
+    Albuquerque, NM 87185
+
+*******************************************************************************/
+
+
+/*
+ * Kernel bypass datagram channel, see <linux/if_seastar.h>.
+ *
+ * Each SeaStar netdev gets a misc device that one process at a time can
+ * open and mmap().  The mapping holds the shared rings and the process's
+ * buffers, all in pinned kernel memory.  Sends are taken off the TX ring
+ * by the driver, which checks them against what the channel was bound to,
+ * builds the SeaStar header itself and issues them on a slice of TX
+ * pendings kept out of the netdev's free list.  Their completions and any
+ * datagrams for the channel are demultiplexed out of the one event queue
+ * and written to the mapping, so the process polls memory, not the kernel.
+ */
+
+#include <linux/netdevice.h>
+#include <linux/kernel.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+#include <linux/if_seastar.h>
+#include "firmware.h"
+#include "seastar.h"
+
+
+/**
+ * Layout of the mapping: the rings, then the TX buffer area, then the
+ * RX slots.
+ */
+#define BYPASS_RING_SIZE	PAGE_ALIGN(sizeof(struct ss_bypass_ring))
+#define BYPASS_TX_BUF_SIZE	(1 << 20)
+#define BYPASS_RX_SLOT_SIZE	16384
+#define BYPASS_TX_BUF_OFFSET	BYPASS_RING_SIZE
+#define BYPASS_RX_BUF_OFFSET	(BYPASS_TX_BUF_OFFSET + BYPASS_TX_BUF_SIZE)
+#define BYPASS_MAP_SIZE		(BYPASS_RX_BUF_OFFSET + \
+				 SS_BYPASS_RX_ENTRIES * BYPASS_RX_SLOT_SIZE)
+
+
+/**
+ * Header carried after the SeaStar header by every bypass datagram, so
+ * the receiver gets the exact payload length back.
+ */
+struct bypass_hdr {
+	__be32			len;
+};
+
+#define BYPASS_HLEN		(sizeof(struct sshdr) + sizeof(struct bypass_hdr))
+
+
+/**
+ * Most descriptors taken off the TX ring per run of the TX tasklet.
+ */
+#define BYPASS_POLL_BUDGET	16
+
+
+/**
+ * How often, in microseconds, the TX ring is polled while a channel is
+ * bound.  Zero leaves sends to SSBYPASS_KICK and completion time.
+ */
+static unsigned int bypass_poll_us = 50;
+module_param(bypass_poll_us, uint, 0644);
+MODULE_PARM_DESC(bypass_poll_us, "Bypass channel TX ring poll period (us)");
+
+
+/**
+ * An open channel.
+ */
+struct ss_bypass {
+	struct ss_bypass_port	*port;
+	void			*mem;
+	struct ss_bypass_ring	*ring;
+	void			*tx_buf;
+	void			*rx_buf;
+
+	int			bound;
+	uint8_t			lo_mac;
+	uint32_t		nid_min;
+	uint32_t		nid_max;
+
+	/*
+	 * Private copies of the indices the driver owns.  tx_tail is only
+	 * touched by the TX tasklet, the rest under ssp->lock.
+	 */
+	uint32_t		tx_tail;
+	uint32_t		cq_head;
+	uint32_t		rx_head;
+	unsigned int		inflight;
+
+	wait_queue_head_t	wait;
+	struct hrtimer		poll_timer;
+	struct tasklet_struct	tx_tasklet;
+};
+
+
+/**
+ * Per-netdev bypass state, which outlives any one channel.  Everything
+ * but the list linkage is protected by ssp->lock.
+ */
+struct ss_bypass_port {
+	struct ss_priv		*ssp;
+	struct list_head	list;
+	struct miscdevice	misc;
+	char			name[IFNAMSIZ + 8];
+
+	struct ss_bypass	*chan;
+
+	uint16_t		free[SS_BYPASS_PENDINGS];
+	unsigned int		nfree;
+	uint32_t		cookie[SS_BYPASS_PENDINGS];
+	struct ss_bypass	*owner[SS_BYPASS_PENDINGS];
+};
+
+
+static LIST_HEAD(bypass_ports);
+static DEFINE_MUTEX(bypass_mutex);
+
+
+static unsigned int bypass_max_len(struct ss_priv *ssp)
+{
+	return min_t(unsigned int, ssp->netdev->mtu,
+		     TX_BOUNCE_SIZE - BYPASS_HLEN);
+}
+
+
+static void bypass_complete(struct ss_bypass *chan, uint32_t cookie,
+			    int status)
+{
+	struct ss_bypass_cqe *cqe;
+
+	cqe = &chan->ring->cq[chan->cq_head % SS_BYPASS_CQ_ENTRIES];
+	cqe->cookie = cookie;
+	cqe->status = status;
+
+	smp_wmb();
+	chan->ring->cq_head = ++chan->cq_head;
+	wake_up_interruptible(&chan->wait);
+}
+
+
+/**
+ * Returns zero if a descriptor may be sent, else the error to complete it
+ * with.  The descriptor is a private copy, user space cannot change it
+ * under us.
+ */
+static int bypass_check(struct ss_bypass *chan,
+			const struct ss_bypass_tx_desc *d)
+{
+	if (d->len == 0 || d->len > bypass_max_len(chan->port->ssp) ||
+	    d->offset > BYPASS_TX_BUF_SIZE ||
+	    d->len > BYPASS_TX_BUF_SIZE - d->offset)
+		return -EINVAL;
+
+	if (d->lo_mac > 0xE)
+		return -EINVAL;
+
+	if (d->nid < chan->nid_min || d->nid > chan->nid_max)
+		return -EPERM;
+
+	return 0;
+}
+
+
+/**
+ * Returns true if the command queue has room for a send, going out to
+ * the mailbox only when the cached index says it is full.  Called with
+ * ssp->lock held.
+ */
+static int bypass_cmdq_room(struct ss_priv *ssp)
+{
+	return seastar_cmdq_free_cached(ssp) || seastar_cmdq_free(ssp);
+}
+
+
+/**
+ * Takes descriptors off the TX ring and sends them, until the ring is
+ * empty, the budget or the pending slice runs out, or the completion
+ * ring could overflow.  Only ever run from the channel's TX tasklet, so
+ * there is one dispatcher per channel.  ssp->lock is only held to claim
+ * and post a pending, not over the copy into its bounce slot.  Returns
+ * true if the budget ran out with descriptors left on the ring.
+ */
+static int bypass_dispatch(struct ss_bypass *chan, unsigned int budget)
+{
+	struct ss_bypass_port *port = ACCESS_ONCE(chan->port);
+	struct ss_bypass_ring *ring = chan->ring;
+	struct ss_bypass_tx_desc d;
+	struct ss_priv *ssp;
+	struct sshdr *sshdr;
+	struct bypass_hdr *bh;
+	unsigned long flags;
+	uint32_t head, len;
+	unsigned int index, slot;
+	int status, more = 0;
+
+	/* Detached; bypass_detach() waits for us before the port goes */
+	if (!port)
+		return 0;
+	ssp = port->ssp;
+
+	head = ACCESS_ONCE(ring->tx_head);
+	smp_rmb();
+
+	while (chan->tx_tail != head) {
+		if (!budget--) {
+			more = 1;
+			break;
+		}
+
+		d = ring->tx[chan->tx_tail % SS_BYPASS_TX_ENTRIES];
+
+		spin_lock_irqsave(&ssp->lock, flags);
+
+		if (chan->port != port || !chan->bound ||
+		    chan->cq_head - ACCESS_ONCE(ring->cq_tail) +
+		    chan->inflight >= SS_BYPASS_CQ_ENTRIES) {
+			spin_unlock_irqrestore(&ssp->lock, flags);
+			break;
+		}
+
+		status = bypass_check(chan, &d);
+		if (status) {
+			bypass_complete(chan, d.cookie, status);
+			spin_unlock_irqrestore(&ssp->lock, flags);
+			chan->tx_tail++;
+			continue;
+		}
+
+		if (!port->nfree || !bypass_cmdq_room(ssp)) {
+			spin_unlock_irqrestore(&ssp->lock, flags);
+			break;
+		}
+
+		/* Claim the pending, its completion counts against the CQ */
+		index = port->free[--port->nfree];
+		slot  = index - SS_BYPASS_FIRST;
+		chan->inflight++;
+
+		spin_unlock_irqrestore(&ssp->lock, flags);
+
+		/* Build the datagram in the pending's bounce slot */
+		sshdr = ssp->bounce_slots + index * TX_BOUNCE_SIZE;
+		bh    = (struct bypass_hdr *)(sshdr + 1);
+		len   = BYPASS_HLEN + d.len;
+
+		sshdr->length   = (ROUNDUP4(len) >> 2) - 1;
+		sshdr->lo_macs  = (chan->lo_mac << 4) | d.lo_mac;
+		sshdr->hdr_type = SS_HDR_TYPE(SS_TYPE_BYPASS);
+		bh->len         = htonl(d.len);
+		memcpy(bh + 1, chan->tx_buf + d.offset, d.len);
+
+		spin_lock_irqsave(&ssp->lock, flags);
+
+		/* Detached, or the netdev took the queue, while we copied */
+		if (chan->port != port || !bypass_cmdq_room(ssp)) {
+			port->free[port->nfree++] = index;
+			chan->inflight--;
+			spin_unlock_irqrestore(&ssp->lock, flags);
+			break;
+		}
+
+		port->cookie[slot] = d.cookie;
+		port->owner[slot]  = chan;
+
+		seastar_ip_tx_cmd(
+			ssp,
+			d.nid,
+			sshdr->length,
+			virt_to_phys(sshdr) >> 2,
+			index
+		);
+
+		spin_unlock_irqrestore(&ssp->lock, flags);
+
+		chan->tx_tail++;
+	}
+
+	/* Descriptors up to here have been copied and may be reused */
+	smp_mb();
+	ring->tx_tail = chan->tx_tail;
+
+	return more;
+}
+
+
+static void bypass_tx_tasklet(unsigned long data)
+{
+	struct ss_bypass *chan = (struct ss_bypass *)data;
+
+	if (bypass_dispatch(chan, BYPASS_POLL_BUDGET))
+		tasklet_schedule(&chan->tx_tasklet);
+}
+
+
+static enum hrtimer_restart bypass_poll(struct hrtimer *timer)
+{
+	struct ss_bypass *chan =
+		container_of(timer, struct ss_bypass, poll_timer);
+
+	tasklet_schedule(&chan->tx_tasklet);
+
+	if (!bypass_poll_us)
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(timer, ns_to_ktime(bypass_poll_us * NSEC_PER_USEC));
+	return HRTIMER_RESTART;
+}
+
+
+/**
+ * Completion of a send on the bypass slice.  Called from the event queue
+ * drain.
+ */
+void ss_bypass_tx_end(struct ss_priv *ssp, unsigned int index)
+{
+	struct ss_bypass_port *port;
+	struct ss_bypass *chan;
+	unsigned long flags;
+	unsigned int slot = index - SS_BYPASS_FIRST;
+
+	if (slot >= SS_BYPASS_PENDINGS)
+		return;
+
+	spin_lock_irqsave(&ssp->lock, flags);
+
+	/* The port is only freed after it is unhooked under the lock */
+	port = ssp->bypass_port;
+	if (!port)
+		goto out;
+
+	chan = port->owner[slot];
+	port->owner[slot] = NULL;
+	port->free[port->nfree++] = index;
+
+	/* The channel may have gone away while the send was in flight */
+	if (chan) {
+		chan->inflight--;
+		bypass_complete(chan, port->cookie[slot], 0);
+		tasklet_schedule(&chan->tx_tasklet);
+	}
+
+out:
+	spin_unlock_irqrestore(&ssp->lock, flags);
+}
+
+
+/**
+ * Delivers a datagram of type SS_TYPE_BYPASS, still in its receive
+ * buffer, to the channel bound to its destination lo_mac.
+ */
+void ss_bypass_rx(struct ss_priv *ssp, const void *data, unsigned int len)
+{
+	struct ss_bypass_port *port;
+	const struct sshdr *sshdr = data;
+	const struct bypass_hdr *bh = (const struct bypass_hdr *)(sshdr + 1);
+	struct ss_bypass_rx_desc *rxd;
+	struct ss_bypass *chan;
+	unsigned long flags;
+	unsigned int slot, plen;
+
+	if (len < BYPASS_HLEN)
+		return;
+
+	plen = min_t(unsigned int, ntohl(bh->len), len - BYPASS_HLEN);
+	plen = min_t(unsigned int, plen, BYPASS_RX_SLOT_SIZE);
+
+	spin_lock_irqsave(&ssp->lock, flags);
+
+	port = ssp->bypass_port;
+	if (!port)
+		goto out;
+
+	chan = port->chan;
+	if (!chan || !chan->bound || (sshdr->lo_macs & 0xF) != chan->lo_mac)
+		goto out;
+
+	if (chan->rx_head - ACCESS_ONCE(chan->ring->rx_tail) >=
+	    SS_BYPASS_RX_ENTRIES) {
+		chan->ring->rx_dropped++;
+		goto out;
+	}
+
+	slot = chan->rx_head % SS_BYPASS_RX_ENTRIES;
+	memcpy(chan->rx_buf + slot * BYPASS_RX_SLOT_SIZE, bh + 1, plen);
+
+	rxd = &chan->ring->rx[slot];
+	rxd->offset = BYPASS_RX_BUF_OFFSET + slot * BYPASS_RX_SLOT_SIZE;
+	rxd->len    = plen;
+	rxd->lo_mac = sshdr->lo_macs >> 4;
+
+	smp_wmb();
+	chan->ring->rx_head = ++chan->rx_head;
+	wake_up_interruptible(&chan->wait);
+
+out:
+	spin_unlock_irqrestore(&ssp->lock, flags);
+}
+
+
+static int bypass_open(struct inode *inode, struct file *file)
+{
+	struct ss_bypass_port *port;
+	struct ss_bypass *chan;
+	unsigned long flags;
+	int err = -ENODEV;
+
+	chan = kzalloc(sizeof(*chan), GFP_KERNEL);
+	if (!chan)
+		return -ENOMEM;
+
+	chan->mem = vmalloc_user(BYPASS_MAP_SIZE);
+	if (!chan->mem) {
+		kfree(chan);
+		return -ENOMEM;
+	}
+
+	chan->ring   = chan->mem;
+	chan->tx_buf = chan->mem + BYPASS_TX_BUF_OFFSET;
+	chan->rx_buf = chan->mem + BYPASS_RX_BUF_OFFSET;
+	init_waitqueue_head(&chan->wait);
+	hrtimer_init(&chan->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	chan->poll_timer.function = bypass_poll;
+	tasklet_init(&chan->tx_tasklet, bypass_tx_tasklet, (unsigned long)chan);
+
+	mutex_lock(&bypass_mutex);
+	list_for_each_entry(port, &bypass_ports, list) {
+		if (port->misc.minor != iminor(inode))
+			continue;
+
+		spin_lock_irqsave(&port->ssp->lock, flags);
+		if (port->chan) {
+			err = -EBUSY;
+		} else {
+			chan->port = port;
+			port->chan = chan;
+			err = 0;
+		}
+		spin_unlock_irqrestore(&port->ssp->lock, flags);
+		break;
+	}
+	mutex_unlock(&bypass_mutex);
+
+	if (err) {
+		vfree(chan->mem);
+		kfree(chan);
+		return err;
+	}
+
+	file->private_data = chan;
+	return 0;
+}
+
+
+/**
+ * Detaches a channel from its port.  Sends still in flight complete into
+ * the slice without a channel.  Once the owners are cleared nothing can
+ * schedule the TX tasklet again, so after tasklet_kill() neither the
+ * channel nor the port is used by it.  Called with bypass_mutex held.
+ */
+static void bypass_detach(struct ss_bypass *chan)
+{
+	struct ss_bypass_port *port = chan->port;
+	unsigned long flags;
+	unsigned int i;
+
+	hrtimer_cancel(&chan->poll_timer);
+
+	spin_lock_irqsave(&port->ssp->lock, flags);
+	for (i = 0; i < SS_BYPASS_PENDINGS; i++) {
+		if (port->owner[i] == chan)
+			port->owner[i] = NULL;
+	}
+	port->chan = NULL;
+	chan->port = NULL;
+	spin_unlock_irqrestore(&port->ssp->lock, flags);
+
+	tasklet_kill(&chan->tx_tasklet);
+}
+
+
+static int bypass_release(struct inode *inode, struct file *file)
+{
+	struct ss_bypass *chan = file->private_data;
+
+	mutex_lock(&bypass_mutex);
+	if (chan->port)
+		bypass_detach(chan);
+	mutex_unlock(&bypass_mutex);
+
+	vfree(chan->mem);
+	kfree(chan);
+	return 0;
+}
+
+
+static int bypass_bind(struct ss_bypass *chan, void __user *arg)
+{
+	struct ss_priv *ssp = chan->port->ssp;
+	struct ss_bypass_bind bind;
+	unsigned long flags;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (copy_from_user(&bind, arg, sizeof(bind)))
+		return -EFAULT;
+
+	if (bind.lo_mac == 0 || bind.lo_mac > 0xE ||
+	    bind.nid_min > bind.nid_max || bind.nid_max > 0xFFFF)
+		return -EINVAL;
+
+	/* The netdev's own virtual host stays with the IP stack */
+	if (bind.lo_mac == (ssp->netdev->dev_addr[5] & 0xF))
+		return -EADDRINUSE;
+
+	spin_lock_irqsave(&ssp->lock, flags);
+	chan->lo_mac  = bind.lo_mac;
+	chan->nid_min = bind.nid_min;
+	chan->nid_max = bind.nid_max;
+	chan->bound   = 1;
+	spin_unlock_irqrestore(&ssp->lock, flags);
+
+	if (bypass_poll_us && !hrtimer_active(&chan->poll_timer))
+		hrtimer_start(&chan->poll_timer,
+			      ns_to_ktime(bypass_poll_us * NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+
+static int bypass_info(struct ss_bypass *chan, void __user *arg)
+{
+	struct ss_priv *ssp = chan->port->ssp;
+	struct ss_bypass_info info;
+
+	memset(&info, 0, sizeof(info));
+	info.map_size      = BYPASS_MAP_SIZE;
+	info.tx_buf_offset = BYPASS_TX_BUF_OFFSET;
+	info.tx_buf_size   = BYPASS_TX_BUF_SIZE;
+	info.rx_buf_offset = BYPASS_RX_BUF_OFFSET;
+	info.rx_slot_size  = BYPASS_RX_SLOT_SIZE;
+	info.max_len       = bypass_max_len(ssp);
+	info.nid           = ntohl(*(__be32 *)ssp->netdev->dev_addr);
+
+	return copy_to_user(arg, &info, sizeof(info)) ? -EFAULT : 0;
+}
+
+
+static long bypass_ioctl(struct file *file, unsigned int cmd,
+			 unsigned long arg)
+{
+	struct ss_bypass *chan = file->private_data;
+	long err = 0;
+
+	mutex_lock(&bypass_mutex);
+
+	if (!chan->port) {
+		err = -ENODEV;
+		goto out;
+	}
+
+	switch (cmd) {
+
+	case SSBYPASS_BIND:
+		err = bypass_bind(chan, (void __user *)arg);
+		break;
+
+	case SSBYPASS_INFO:
+		err = bypass_info(chan, (void __user *)arg);
+		break;
+
+	case SSBYPASS_KICK:
+		tasklet_schedule(&chan->tx_tasklet);
+		break;
+
+	default:
+		err = -ENOTTY;
+	}
+
+out:
+	mutex_unlock(&bypass_mutex);
+	return err;
+}
+
+
+static int bypass_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct ss_bypass *chan = file->private_data;
+
+	if (vma->vm_pgoff ||
+	    vma->vm_end - vma->vm_start != PAGE_ALIGN(BYPASS_MAP_SIZE))
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, chan->mem, 0);
+}
+
+
+static unsigned int bypass_poll_wait(struct file *file, poll_table *wait)
+{
+	struct ss_bypass *chan = file->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &chan->wait, wait);
+
+	if (chan->cq_head != ACCESS_ONCE(chan->ring->cq_tail) ||
+	    chan->rx_head != ACCESS_ONCE(chan->ring->rx_tail))
+		mask |= POLLIN | POLLRDNORM;
+
+	if (!chan->port)
+		mask |= POLLERR;
+
+	return mask;
+}
+
+
+static const struct file_operations bypass_fops = {
+	.owner		= THIS_MODULE,
+	.open		= bypass_open,
+	.release	= bypass_release,
+	.unlocked_ioctl	= bypass_ioctl,
+	.mmap		= bypass_mmap,
+	.poll		= bypass_poll_wait,
+};
+
+
+/**
+ * Creates the bypass device for a registered netdev.
+ */
+int ss_bypass_register(struct ss_priv *ssp)
+{
+	struct ss_bypass_port *port;
+	unsigned int i;
+	int err;
+
+	port = kzalloc(sizeof(*port), GFP_KERNEL);
+	if (!port)
+		return -ENOMEM;
+
+	port->ssp = ssp;
+	for (i = 0; i < SS_BYPASS_PENDINGS; i++)
+		port->free[port->nfree++] = SS_BYPASS_FIRST + i;
+
+	snprintf(port->name, sizeof(port->name), "%s-bypass",
+		 ssp->netdev->name);
+	port->misc.minor = MISC_DYNAMIC_MINOR;
+	port->misc.name  = port->name;
+	port->misc.fops  = &bypass_fops;
+
+	err = misc_register(&port->misc);
+	if (err) {
+		kfree(port);
+		return err;
+	}
+
+	mutex_lock(&bypass_mutex);
+	list_add(&port->list, &bypass_ports);
+	ssp->bypass_port = port;
+	mutex_unlock(&bypass_mutex);
+
+	return 0;
+}
+
+
+/**
+ * Removes the bypass device.  A channel still open is cut off; its file
+ * stays valid but every operation on it fails.
+ */
+void ss_bypass_unregister(struct ss_priv *ssp)
+{
+	struct ss_bypass_port *port = ssp->bypass_port;
+	unsigned long flags;
+
+	if (!port)
+		return;
+
+	misc_deregister(&port->misc);
+
+	mutex_lock(&bypass_mutex);
+	list_del(&port->list);
+	if (port->chan) {
+		wake_up_interruptible(&port->chan->wait);
+		bypass_detach(port->chan);
+	}
+	spin_lock_irqsave(&ssp->lock, flags);
+	ssp->bypass_port = NULL;
+	spin_unlock_irqrestore(&ssp->lock, flags);
+	mutex_unlock(&bypass_mutex);
+
+	kfree(port);
+}
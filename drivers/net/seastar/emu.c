@@ -0,0 +1,561 @@
+/*******************************************************************************
+    SeaStar NIC Linux Driver
+    Copyright (C) 2009 Cray Inc. and Sandia National Laboratories
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Contact Information:
+    Kevin Pedretti <ktpedre@sandia.gov>
+    Scalable System Software Dept.
+    Sandia National Laboratories
+    P.O. Box 5800 MS 1319
+    Albuquerque, NM 87185
+
+*******************************************************************************/
+
+
+/*
+ * Software model of the SeaStar firmware.
+ *
+ * Each emulated NIC gets a mailbox, an incoming datagram buffer table, a
+ * NIC control block and an HTB map in host memory, and is driven by the
+ * unmodified driver through struct ss_hw.  One kernel thread plays the
+ * part of the firmware for all of them: it consumes the command queues,
+ * answers control commands through the result queues, carries IP_TX
+ * datagrams to the destination NID with a configurable latency and link
+ * bandwidth, and posts events and "interrupts" back to the driver.
+ */
+
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/platform_device.h>
+#include <linux/interrupt.h>
+#include <linux/list.h>
+#include <linux/io.h>
+#include <linux/rtnetlink.h>
+#include "firmware.h"
+#include "seastar.h"
+
+
+static unsigned int emu_nodes;
+module_param(emu_nodes, uint, 0444);
+MODULE_PARM_DESC(emu_nodes, "Number of emulated SeaStar NICs to create");
+
+static unsigned int emu_base_nid = 1;
+module_param(emu_base_nid, uint, 0444);
+MODULE_PARM_DESC(emu_base_nid, "NID of the first emulated SeaStar");
+
+static unsigned int emu_latency_ns = 2000;
+module_param(emu_latency_ns, uint, 0644);
+MODULE_PARM_DESC(emu_latency_ns, "Emulated per-hop latency in nanoseconds");
+
+static unsigned int emu_bandwidth_mbps = 16000;
+module_param(emu_bandwidth_mbps, uint, 0644);
+MODULE_PARM_DESC(emu_bandwidth_mbps,
+		 "Emulated link bandwidth in Mbit/s, 0 for unlimited");
+
+
+/**
+ * Number of entries in the emulated HyperTransport map.
+ */
+#define EMU_HTB_ENTRIES		16
+
+
+/**
+ * A datagram travelling between two emulated NICs.
+ */
+struct emu_frame {
+	struct list_head	list;
+	s64			due;
+	struct emu_node		*src;
+	uint16_t		pending_index;
+	unsigned int		len;
+	uint8_t			data[0];
+};
+
+
+/**
+ * State of one emulated NIC.
+ */
+struct emu_node {
+	struct mailbox		*mailbox;
+	uint64_t		skb_table[NUM_SKBS];
+	struct niccb		niccb;
+	uint32_t		htb_map[EMU_HTB_ENTRIES];
+	uint16_t		nid;
+
+	uint32_t		*eq;
+	unsigned int		eq_count;
+	unsigned int		eq_write;
+	unsigned int		rx_next;
+	int			irq_pending;
+
+	s64			link_free;
+	struct list_head	inbound;
+
+	struct platform_device	*pdev;
+	struct net_device	*netdev;
+};
+
+
+static struct emu_node *emu_node_table;
+static struct task_struct *emu_thread;
+
+
+static struct emu_node *emu_lookup(uint16_t nid)
+{
+	if (nid < emu_base_nid || nid >= emu_base_nid + emu_nodes)
+		return NULL;
+
+	return &emu_node_table[nid - emu_base_nid];
+}
+
+
+/**
+ * Converts a SeaStar address to a kernel virtual address by walking the
+ * HTB map the driver programmed, as the real HyperTransport bridge does.
+ */
+static void *emu_fw_to_virt(struct emu_node *node, uint32_t addr)
+{
+	uint32_t map = node->htb_map[addr >> 28];
+
+	if (!(map & 0x8000))
+		return NULL;
+
+	return phys_to_virt(((unsigned long)(map & 0x7FFF) << 28) |
+			    (addr & ((1 << 28) - 1)));
+}
+
+
+static void emu_post_event(struct emu_node *node, unsigned int type,
+			   unsigned int index)
+{
+	if (!node->eq)
+		return;
+
+	if (node->eq[node->eq_write]) {
+		if (net_ratelimit())
+			printk(KERN_ERR "seastar-emu: nid %u event queue "
+			       "overflow.\n", node->nid);
+		return;
+	}
+
+	node->eq[node->eq_write] = (type << 16) | (index & 0xFFFF);
+	node->eq_write = (node->eq_write + 1) % node->eq_count;
+	node->irq_pending = 1;
+}
+
+
+/**
+ * Delivers the emulated interrupt.  Only the emulation thread calls
+ * this, so the handler never runs concurrently with itself.  Until the
+ * node's netdev is registered the interrupt stays pending, as a level
+ * triggered line would; command results are polled meanwhile.
+ */
+static void emu_raise_irq(struct emu_node *node)
+{
+	if (!node->netdev)
+		return;
+
+	node->irq_pending = 0;
+	local_bh_disable();
+	ss_interrupt(0, node->netdev);
+	local_bh_enable();
+}
+
+
+static int emu_result_space(struct emu_node *node)
+{
+	struct mailbox *mbox = node->mailbox;
+	unsigned int next = (mbox->resultq_write + 1) % RESULT_Q_LENGTH;
+
+	return next != mbox->resultq_read;
+}
+
+
+static void emu_post_result(struct emu_node *node, uint32_t result)
+{
+	struct mailbox *mbox = node->mailbox;
+
+	mbox->resultq[mbox->resultq_write] = result;
+	wmb();
+	mbox->resultq_write = (mbox->resultq_write + 1) % RESULT_Q_LENGTH;
+	node->irq_pending = 1;
+}
+
+
+static void emu_ip_tx(struct emu_node *src, const struct command_ip_tx *tx)
+{
+	struct emu_node *dst = emu_lookup(tx->nid);
+	struct emu_frame *frame, *pos;
+	unsigned int len = (tx->length + 1) << 2;
+	s64 now, start;
+	u64 ser_ns = 0;
+
+	if (!dst || !dst->eq || len > TX_BOUNCE_SIZE)
+		goto drop;
+
+	frame = kmalloc(sizeof(*frame) + len, GFP_KERNEL);
+	if (!frame)
+		goto drop;
+
+	memcpy(frame->data, phys_to_virt(tx->address << 2), len);
+	frame->len           = len;
+	frame->src           = src;
+	frame->pending_index = tx->pending_index;
+
+	/* Serialize onto the source's link, then add the hop latency */
+	if (emu_bandwidth_mbps)
+		ser_ns = div_u64((u64)len * 8000, emu_bandwidth_mbps);
+	now   = ktime_to_ns(ktime_get());
+	start = max(src->link_free, now);
+	src->link_free = start + ser_ns;
+	frame->due     = src->link_free + emu_latency_ns;
+
+	/* Keep the destination's inbound list sorted by arrival time */
+	list_for_each_entry_reverse(pos, &dst->inbound, list) {
+		if (pos->due <= frame->due)
+			break;
+	}
+	list_add(&frame->list, &pos->list);
+
+	src->niccb.ip_tx++;
+	return;
+
+drop:
+	src->niccb.ip_tx_drop++;
+	emu_post_event(src, EVENT_TX_END, tx->pending_index);
+}
+
+
+static void emu_deliver(struct emu_node *dst, struct emu_frame *frame)
+{
+	unsigned int i, index;
+
+	for (i = 0; i < NUM_SKBS; i++) {
+		index = (dst->rx_next + i) % NUM_SKBS;
+		if (dst->skb_table[index])
+			break;
+	}
+
+	if (i == NUM_SKBS) {
+		dst->niccb.ip_rx_drop++;
+		emu_post_event(dst, EVENT_RX_EMPTY, 0);
+	} else {
+		memcpy(phys_to_virt(dst->skb_table[index] << 2),
+		       frame->data, frame->len);
+		dst->skb_table[index] = 0;
+		dst->rx_next = index + 1;
+		dst->niccb.ip_rx++;
+		emu_post_event(dst, EVENT_RX, index);
+	}
+
+	emu_post_event(frame->src, EVENT_TX_END, frame->pending_index);
+}
+
+
+/**
+ * Executes one command.  Returns -EAGAIN if it must be retried later
+ * because the result queue is full.
+ */
+static int emu_do_command(struct emu_node *node, const struct command *cmd)
+{
+	const struct command_init_eqcb *eqcb;
+
+	switch (cmd->op) {
+
+	case COMMAND_IP_TX:
+		emu_ip_tx(node, (const struct command_ip_tx *)cmd);
+		return 0;
+
+	case COMMAND_INIT:
+	case COMMAND_MARK_ALIVE:
+		if (!emu_result_space(node))
+			return -EAGAIN;
+		emu_post_result(node, 0);
+		return 0;
+
+	case COMMAND_INIT_EQCB:
+		if (!emu_result_space(node))
+			return -EAGAIN;
+		eqcb = (const struct command_init_eqcb *)cmd;
+		node->eq       = emu_fw_to_virt(node, eqcb->base);
+		node->eq_count = eqcb->count;
+		node->eq_write = 0;
+		emu_post_result(node, node->eq ? 1 : 0);
+		return 0;
+
+	default:
+		printk(KERN_ERR "seastar-emu: nid %u unknown command %u.\n",
+		       node->nid, cmd->op);
+		return 0;
+	}
+}
+
+
+/**
+ * Consumes the node's command queue.  Returns non-zero if any command
+ * was executed.
+ */
+static int emu_run_commands(struct emu_node *node)
+{
+	struct mailbox *mbox = node->mailbox;
+	unsigned int read = mbox->commandq_read;
+	struct command cmd;
+	int ran = 0;
+
+	while (read != mbox->commandq_write) {
+		rmb();
+		memcpy(&cmd, (void *)&mbox->commandq[read], sizeof(cmd));
+		if (emu_do_command(node, &cmd))
+			break;
+
+		read = (read + 1 == COMMAND_Q_LENGTH) ? 0 : read + 1;
+		mbox->commandq_read = read;
+		ran = 1;
+	}
+
+	return ran;
+}
+
+
+static int emu_commands_pending(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < emu_nodes; i++) {
+		struct mailbox *mbox = emu_node_table[i].mailbox;
+		if (mbox->commandq_read != mbox->commandq_write)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+static int emu_thread_fn(void *unused)
+{
+	struct emu_node *node;
+	struct emu_frame *frame, *tmp;
+	s64 now, next;
+	ktime_t expires;
+	unsigned int i;
+	int ran;
+
+	while (!kthread_should_stop()) {
+		ran  = 0;
+		next = KTIME_MAX;
+
+		for (i = 0; i < emu_nodes; i++)
+			ran |= emu_run_commands(&emu_node_table[i]);
+
+		now = ktime_to_ns(ktime_get());
+		for (i = 0; i < emu_nodes; i++) {
+			node = &emu_node_table[i];
+			list_for_each_entry_safe(frame, tmp, &node->inbound,
+						 list) {
+				if (frame->due > now) {
+					next = min(next, frame->due);
+					break;
+				}
+				list_del(&frame->list);
+				emu_deliver(node, frame);
+				kfree(frame);
+				ran = 1;
+			}
+		}
+
+		for (i = 0; i < emu_nodes; i++) {
+			if (emu_node_table[i].irq_pending)
+				emu_raise_irq(&emu_node_table[i]);
+		}
+
+		if (ran) {
+			cond_resched();
+			continue;
+		}
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (emu_commands_pending() || kthread_should_stop()) {
+			__set_current_state(TASK_RUNNING);
+			continue;
+		}
+		if (next == KTIME_MAX) {
+			schedule();
+		} else {
+			expires = ns_to_ktime(next);
+			schedule_hrtimeout(&expires, HRTIMER_MODE_ABS);
+		}
+	}
+
+	return 0;
+}
+
+
+static void emu_kick(struct ss_priv *ssp)
+{
+	wake_up_process(emu_thread);
+}
+
+
+static void emu_free_node(struct emu_node *node)
+{
+	struct emu_frame *frame, *tmp;
+
+	list_for_each_entry_safe(frame, tmp, &node->inbound, list) {
+		list_del(&frame->list);
+		kfree(frame);
+	}
+
+	if (node->pdev)
+		platform_device_unregister(node->pdev);
+	free_page((unsigned long)node->mailbox);
+}
+
+
+/**
+ * Creates the emulated NICs requested with emu_nodes=.
+ */
+int seastar_emu_init(void)
+{
+	struct net_device *netdev;
+	struct emu_node *node;
+	struct ss_hw hw;
+	unsigned int i;
+	int err;
+
+	BUILD_BUG_ON(sizeof(struct mailbox) > PAGE_SIZE);
+
+	if (!emu_nodes)
+		return 0;
+
+	emu_node_table = kcalloc(emu_nodes, sizeof(*node), GFP_KERNEL);
+	if (!emu_node_table)
+		return -ENOMEM;
+
+	for (i = 0; i < emu_nodes; i++) {
+		node = &emu_node_table[i];
+		INIT_LIST_HEAD(&node->inbound);
+		node->nid           = emu_base_nid + i;
+		node->niccb.version = 0x454d55;
+		node->link_free     = ktime_to_ns(ktime_get());
+		node->mailbox = (void *)get_zeroed_page(GFP_KERNEL);
+		if (!node->mailbox) {
+			err = -ENOMEM;
+			goto err_out;
+		}
+	}
+
+	emu_thread = kthread_run(emu_thread_fn, NULL, "seastar-emu");
+	if (IS_ERR(emu_thread)) {
+		err = PTR_ERR(emu_thread);
+		emu_thread = NULL;
+		goto err_out;
+	}
+
+	for (i = 0; i < emu_nodes; i++) {
+		node = &emu_node_table[i];
+
+		node->pdev = platform_device_register_simple("seastar-emu", i,
+							     NULL, 0);
+		if (IS_ERR(node->pdev)) {
+			err = PTR_ERR(node->pdev);
+			node->pdev = NULL;
+			goto err_out;
+		}
+
+		memset(&hw, 0, sizeof(hw));
+		hw.mailbox	= node->mailbox;
+		hw.skb_table	= node->skb_table;
+		hw.niccb	= &node->niccb;
+		hw.htb_map	= node->htb_map;
+		hw.tx_source	= &node->nid;
+		hw.kick		= emu_kick;
+		hw.priv		= node;
+
+		netdev = ss_alloc_netdev(&node->pdev->dev, &hw);
+		if (!netdev) {
+			err = -ENOMEM;
+			goto err_out;
+		}
+
+		/* NID in the high bytes, lo_mac 0, as ss_tx() expects */
+		*(__be32 *)netdev->dev_addr = htonl(node->nid);
+
+		err = ss_register(netdev);
+		if (err) {
+			ss_free_netdev(netdev);
+			goto err_out;
+		}
+
+		/* Only now may the thread interrupt it; deliver what is due */
+		node->netdev = netdev;
+		wake_up_process(emu_thread);
+
+		printk(KERN_INFO "seastar-emu: %s is emulated nid %u\n",
+		       node->netdev->name, node->nid);
+	}
+
+	return 0;
+
+err_out:
+	seastar_emu_exit();
+	return err;
+}
+
+
+/**
+ * Tears down all emulated NICs.
+ */
+void seastar_emu_exit(void)
+{
+	struct emu_node *node;
+	unsigned int i;
+
+	if (!emu_node_table)
+		return;
+
+	/* Quiesce transmit so nothing kicks the thread once it is gone */
+	for (i = 0; i < emu_nodes; i++) {
+		node = &emu_node_table[i];
+		if (node->netdev) {
+			rtnl_lock();
+			dev_close(node->netdev);
+			rtnl_unlock();
+		}
+	}
+
+	/* Stop the firmware before the memory it writes is released */
+	if (emu_thread)
+		kthread_stop(emu_thread);
+	emu_thread = NULL;
+
+	for (i = 0; i < emu_nodes; i++) {
+		node = &emu_node_table[i];
+		if (node->netdev) {
+			ss_unregister(node->netdev);
+			ss_free_netdev(node->netdev);
+			node->netdev = NULL;
+		}
+		emu_free_node(node);
+	}
+
+	kfree(emu_node_table);
+	emu_node_table = NULL;
+}
@@ -29,6 +29,9 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/pci.h>
+#include <linux/sched.h>
+#include <linux/timer.h>
+#include <linux/completion.h>
 #include "firmware.h"
 #include "seastar.h"
 
@@ -42,8 +45,8 @@ static void seastar_map_host_region(struct ss_priv *ssp, const void *addr)
 	unsigned long raw_paddr = __pa(addr);
 	unsigned long paddr = raw_paddr & ~((1 << 28) - 1);
 
-	htb_map[8] = 0x8000 | ((paddr >> 28) + 0);
-	htb_map[9] = 0x8000 | ((paddr >> 28) + 1);
+	ssp->hw.htb_map[8] = 0x8000 | ((paddr >> 28) + 0);
+	ssp->hw.htb_map[9] = 0x8000 | ((paddr >> 28) + 1);
 
 	ssp->host_region_phys = paddr;
 }
@@ -57,6 +60,8 @@ static uint32_t virt_to_fw(struct ss_priv *ssp, void *addr)
 	unsigned long saddr;
 
 	saddr = __pa(addr) - ssp->host_region_phys;
+	WARN_ONCE(__pa(addr) < ssp->host_region_phys || saddr >= (2 << 28),
+		  "seastar: %p is outside the host window\n", addr);
 	saddr &= (2 << 28) - 1;
 	saddr += (8 << 28);
 
@@ -65,50 +70,254 @@ static uint32_t virt_to_fw(struct ss_priv *ssp, void *addr)
 
 
 /**
- * Send a command to the Seastar.
+ * Copies a command into the Host -> SeaStar command queue.
+ * If the queue is full, returns -EBUSY without publishing anything.
+ * Never waits for the firmware: the emulated firmware may itself be
+ * waiting for ssp->lock.  Caller must hold ssp->lock.
  */
-static uint32_t seastar_cmd(struct ss_priv *ssp, const struct command *cmd,
-			    int wait_for_result)
+static int seastar_cmd_post(struct ss_priv *ssp, const struct command *cmd)
 {
 	struct mailbox *mbox = ssp->mailbox;
 	unsigned int next_write;
-	uint32_t tail, result;
 
-	/* Copy the command into the mailbox */
-	mbox->commandq[ssp->mailbox_cached_write] = *cmd;
 	next_write = ssp->mailbox_cached_write + 1;
 	if (next_write == COMMAND_Q_LENGTH)
 		next_write = 0;
 
-	/* Wait until it is safe to advance the write pointer */
-	while (next_write == ssp->mailbox_cached_read)
+	if (next_write == ssp->mailbox_cached_read) {
 		ssp->mailbox_cached_read = mbox->commandq_read;
+		if (next_write == ssp->mailbox_cached_read)
+			return -EBUSY;
+	}
+
+	/* Copy the command into the mailbox */
+	mbox->commandq[ssp->mailbox_cached_write] = *cmd;
 
 	/* Advance the write pointer */
 	mbox->commandq_write       = next_write;
 	ssp->mailbox_cached_write = next_write;
 
-	if (!wait_for_result)
-		return 0;
+	if (ssp->hw.kick)
+		ssp->hw.kick(ssp);
+
+	return 0;
+}
+
+
+/**
+ * Returns the number of free entries in the Host -> SeaStar command queue
+ * as of the last read of the firmware's read index, without reading it
+ * again.  There may be more.  Caller must hold ssp->lock.
+ */
+unsigned int seastar_cmdq_free_cached(struct ss_priv *ssp)
+{
+	unsigned int used;
+
+	used = ssp->mailbox_cached_write + COMMAND_Q_LENGTH
+		- ssp->mailbox_cached_read;
+	if (used >= COMMAND_Q_LENGTH)
+		used -= COMMAND_Q_LENGTH;
+
+	/* One entry always stays empty to tell full from empty */
+	return COMMAND_Q_LENGTH - 1 - used;
+}
+
+
+/**
+ * Returns the number of free entries in the Host -> SeaStar command queue.
+ * Caller must hold ssp->lock.
+ */
+unsigned int seastar_cmdq_free(struct ss_priv *ssp)
+{
+	ssp->mailbox_cached_read = ssp->mailbox->commandq_read;
+
+	return seastar_cmdq_free_cached(ssp);
+}
+
+
+/**
+ * Drains the SeaStar -> Host result queue.
+ *
+ * The firmware returns one result per control command, in the order the
+ * commands were issued, so each result is matched to the oldest
+ * outstanding tag.  Called from the interrupt handler and from the
+ * command poll timer.
+ */
+void seastar_cmd_poll(struct ss_priv *ssp)
+{
+	struct mailbox *mbox = ssp->mailbox;
+	struct seastar_cmd_slot *slot;
+	unsigned long flags;
+	uint32_t tail;
+	int done = 0;
+
+	/* Cheap unlocked check, nothing is outstanding most of the time */
+	if (ssp->cmd_done_tag == ssp->cmd_next_tag)
+		return;
+
+	spin_lock_irqsave(&ssp->lock, flags);
+
+	while (ssp->cmd_done_tag != ssp->cmd_next_tag) {
+		tail = mbox->resultq_read;
+		if (tail == mbox->resultq_write)
+			break;
+		done = 1;
+
+		slot = &ssp->cmd_slots[ssp->cmd_done_tag % SEASTAR_CMD_SLOTS];
+		slot->result = mbox->resultq[tail];
+		mbox->resultq_read = (tail >= RESULT_Q_LENGTH - 1) ? 0 : tail + 1;
+		ssp->cmd_done_tag++;
+
+		if (slot->abandoned) {
+			/* Waiter timed out, nobody is left to collect it */
+			dev_err(ssp->dev,
+				"late command result discarded, result=%u.\n",
+				slot->result);
+			slot->abandoned = 0;
+			slot->busy      = 0;
+		} else {
+			complete(&slot->done);
+		}
+	}
+
+	if (ssp->cmd_done_tag != ssp->cmd_next_tag)
+		mod_timer(&ssp->cmd_timer, jiffies + SEASTAR_CMD_POLL_INTERVAL);
+
+	/*
+	 * The firmware has consumed the commands it answered.  Traffic held
+	 * back for want of command queue entries may have nothing in flight
+	 * whose completion would restart it.
+	 */
+	if (done)
+		ss_tx_restart(ssp);
+
+	spin_unlock_irqrestore(&ssp->lock, flags);
+}
+
+
+/**
+ * Command poll timer.  Picks up results that arrive without an
+ * accompanying event queue interrupt.
+ */
+static void seastar_cmd_timer(unsigned long data)
+{
+	seastar_cmd_poll((struct ss_priv *)data);
+}
+
+
+/**
+ * Issues a control command to the SeaStar without waiting for its result.
+ * On success the command's tag is stored in *tag, to be passed to
+ * seastar_cmd_wait().  Returns -EBUSY if all command slots are in use or
+ * the command queue is full; the caller may retry later.
+ */
+int seastar_cmd_async(struct ss_priv *ssp, const struct command *cmd,
+		      unsigned int *tag)
+{
+	struct seastar_cmd_slot *slot;
+	unsigned long flags;
+	int err;
+
+	spin_lock_irqsave(&ssp->lock, flags);
+
+	slot = &ssp->cmd_slots[ssp->cmd_next_tag % SEASTAR_CMD_SLOTS];
+	if (slot->busy) {
+		err = -EBUSY;
+		goto out;
+	}
+
+	err = seastar_cmd_post(ssp, cmd);
+	if (err)
+		goto out;
+
+	slot->busy      = 1;
+	slot->abandoned = 0;
+	slot->result    = 0;
+	INIT_COMPLETION(slot->done);
+
+	*tag = ssp->cmd_next_tag++;
+	mod_timer(&ssp->cmd_timer, jiffies + SEASTAR_CMD_POLL_INTERVAL);
+
+out:
+	spin_unlock_irqrestore(&ssp->lock, flags);
+	return err;
+}
+
+
+/**
+ * Sleeps until the result of the command identified by tag arrives, or
+ * until timeout jiffies have passed.  Returns 0 and stores the firmware's
+ * result in *result on success, -ETIMEDOUT otherwise.
+ */
+int seastar_cmd_wait(struct ss_priv *ssp, unsigned int tag, uint32_t *result,
+		     unsigned long timeout)
+{
+	struct seastar_cmd_slot *slot;
+	unsigned long flags;
+	int err = 0;
+
+	slot = &ssp->cmd_slots[tag % SEASTAR_CMD_SLOTS];
+
+	wait_for_completion_timeout(&slot->done, timeout);
+
+	/*
+	 * Whether the result arrived is decided under ssp->lock, not by the
+	 * completion: seastar_cmd_poll() retires tags in order under the
+	 * lock, so one that is behind cmd_done_tag has its result in the
+	 * slot, even if it came in just after the wait timed out.  Any count
+	 * left in the completion is reset when the slot is reused.
+	 */
+	spin_lock_irqsave(&ssp->lock, flags);
+	if ((int)(ssp->cmd_done_tag - tag) > 0) {
+		*result    = slot->result;
+		slot->busy = 0;
+	} else {
+		/* Leave the slot busy, seastar_cmd_poll() releases it */
+		slot->abandoned = 1;
+		err = -ETIMEDOUT;
+	}
+	spin_unlock_irqrestore(&ssp->lock, flags);
+
+	return err;
+}
 
-	/* Wait for the result to arrive */
-	tail = mbox->resultq_read;
-	while (tail == mbox->resultq_write)
-		;
 
-	/* Read the result */
-	result = mbox->resultq[tail];
-	mbox->resultq_read = (tail >= RESULT_Q_LENGTH - 1) ? 0 : tail + 1;
+/**
+ * Issues a control command and sleeps until its result arrives.
+ * Never spins; a full command queue is retried once per jiffy.
+ */
+static int seastar_cmd_sync(struct ss_priv *ssp, const struct command *cmd,
+			    uint32_t *result)
+{
+	unsigned long deadline = jiffies + SEASTAR_CMD_TIMEOUT;
+	unsigned int tag;
+	int err;
+
+	while ((err = seastar_cmd_async(ssp, cmd, &tag)) == -EBUSY) {
+		if (time_after(jiffies, deadline))
+			return -ETIMEDOUT;
+		schedule_timeout_uninterruptible(1);
+	}
 
-	return result;
+	return seastar_cmd_wait(ssp, tag, result, SEASTAR_CMD_TIMEOUT);
 }
 
 
 /**
- * Sends a datagram transmit command to the SeaStar.
+ * Stops the command poll timer.  Outstanding waiters are left to time out.
  */
-void seastar_ip_tx_cmd(struct ss_priv *ssp, uint16_t nid, uint16_t length,
-		       uint64_t address, uint16_t pending_index)
+void seastar_cmd_cleanup(struct ss_priv *ssp)
+{
+	del_timer_sync(&ssp->cmd_timer);
+}
+
+
+/**
+ * Sends a datagram transmit command to the SeaStar.  Returns -EBUSY if
+ * the command queue is full; callers check seastar_cmdq_free() first.
+ */
+int seastar_ip_tx_cmd(struct ss_priv *ssp, uint16_t nid, uint16_t length,
+		      uint64_t address, uint16_t pending_index)
 {
 	struct command_ip_tx tx_cmd = {
 		.op		= COMMAND_IP_TX,
@@ -118,7 +327,7 @@ void seastar_ip_tx_cmd(struct ss_priv *ssp, uint16_t nid, uint16_t length,
 		.pending_index	= pending_index,
 	};
 
-	seastar_cmd(ssp, (struct command *) &tx_cmd, 0);
+	return seastar_cmd_post(ssp, (struct command *) &tx_cmd);
 }
 
 
@@ -144,19 +353,25 @@ int seastar_hw_init(struct ss_priv *ssp)
 	uint32_t lower_pending;
 	uint32_t lower_eqcb;
 	uint32_t result;
+	int i, err;
 	struct command_init init_cmd;
 	struct command_init_eqcb eqcb_cmd;
 	struct command_mark_alive alive_cmd;
 
+	/* Set up tracking for asynchronous control commands */
+	for (i = 0; i < SEASTAR_CMD_SLOTS; i++)
+		init_completion(&ssp->cmd_slots[i].done);
+	setup_timer(&ssp->cmd_timer, seastar_cmd_timer, (unsigned long)ssp);
+
 	/* Read our NID from SeaStar and write it to the NIC control block */
-	niccb->local_nid = *tx_source;
+	ssp->hw.niccb->local_nid = *ssp->hw.tx_source;
 
 	printk(KERN_INFO "%s: nid %d (0x%x) version %x built %x\n",
 		__func__,
-		niccb->local_nid,
-		niccb->local_nid,
-		niccb->version,
-		niccb->build_time
+		ssp->hw.niccb->local_nid,
+		ssp->hw.niccb->local_nid,
+		ssp->hw.niccb->version,
+		ssp->hw.niccb->build_time
 	);
 
 	/* Allocate the PPC memory */
@@ -167,11 +382,11 @@ int seastar_hw_init(struct ss_priv *ssp)
 	lower_memory = num_eq * FW_EQCB_SIZE;
 
 	/* Initialize the HTB map so that the Seastar can see our memory.
-	 * Since we are only doing upper pendings, we just use the
-	 * upper_pending_phys instead of the host_phys area. */
-	seastar_map_host_region(ssp, ssp);
+	 * Everything the firmware reaches through the window lives in the
+	 * arena, which is naturally aligned and so never straddles it. */
+	seastar_map_host_region(ssp, ssp->arena.base);
 
-	ssp->mailbox			= &seastar_mailbox[0];
+	ssp->mailbox			= ssp->hw.mailbox;
 	ssp->mailbox_cached_read	= ssp->mailbox->commandq_read;
 	ssp->mailbox_cached_write	= ssp->mailbox->commandq_write;
 
@@ -184,7 +399,7 @@ int seastar_hw_init(struct ss_priv *ssp)
 	init_cmd.num_pendings		= NUM_PENDINGS;
 	init_cmd.pending_tx_limit	= NUM_TX_PENDINGS;
 	init_cmd.pending_table_addr	= lower_pending;
-	init_cmd.up_pending_table_addr	= virt_to_fw(ssp, ssp->pending_table);
+	init_cmd.up_pending_table_addr	= virt_to_fw(ssp, ssp->fw_pending_table);
 	init_cmd.up_pending_table_ht_addr = 0;
 
 	init_cmd.num_memds		= 0;
@@ -199,9 +414,14 @@ int seastar_hw_init(struct ss_priv *ssp)
 	init_cmd.result_block_addr	= 0;
 	init_cmd.smb_table_addr		= 0;
 
-	result = seastar_cmd(ssp, (struct command *) &init_cmd, 1);
+	err = seastar_cmd_sync(ssp, (struct command *) &init_cmd, &result);
+	if (err) {
+		dev_err(ssp->dev,
+			"init command timed out, err=%d.\n", err);
+		return err;
+	}
 	if (result != 0) {
-		dev_err(&ssp->pdev->dev,
+		dev_err(ssp->dev,
 			"init command failed, result=%d.\n", result);
 		return -1;
 	}
@@ -211,9 +431,14 @@ int seastar_hw_init(struct ss_priv *ssp)
 	eqcb_cmd.base			= virt_to_fw(ssp, ssp->eq);
 	eqcb_cmd.count			= NUM_EQ_ENTRIES;
 
-	result = seastar_cmd(ssp, (struct command *) &eqcb_cmd, 1);
+	err = seastar_cmd_sync(ssp, (struct command *) &eqcb_cmd, &result);
+	if (err) {
+		dev_err(ssp->dev,
+			"init_eqcb command timed out, err=%d.\n", err);
+		return err;
+	}
 	if (result != 1) {
-		dev_err(&ssp->pdev->dev,
+		dev_err(ssp->dev,
 			"init_eqcb command failed, result=%d.\n", result);
 		return -1;
 	}
@@ -221,9 +446,14 @@ int seastar_hw_init(struct ss_priv *ssp)
 	alive_cmd.op			= COMMAND_MARK_ALIVE;
 	alive_cmd.index			= 1;
 
-	result = seastar_cmd(ssp, (struct command *) &alive_cmd, 1);
+	err = seastar_cmd_sync(ssp, (struct command *) &alive_cmd, &result);
+	if (err) {
+		dev_err(ssp->dev,
+			"mark_alive command timed out, err=%d.\n", err);
+		return err;
+	}
 	if (result != 0) {
-		dev_err(&ssp->pdev->dev,
+		dev_err(ssp->dev,
 			"mark_alive command failed, result=%d\n", result);
 		return -1;
 	}
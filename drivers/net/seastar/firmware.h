@@ -300,7 +300,7 @@ struct mailbox {
 struct ss_priv;
 
 
-extern void
+extern int
 seastar_ip_tx_cmd(
 	struct ss_priv		*ssp,
 	uint16_t		nid,
@@ -310,6 +310,47 @@ seastar_ip_tx_cmd(
 );
 
 
+extern unsigned int
+seastar_cmdq_free_cached(
+	struct ss_priv		*ssp
+);
+
+
+extern unsigned int
+seastar_cmdq_free(
+	struct ss_priv		*ssp
+);
+
+
+extern int
+seastar_cmd_async(
+	struct ss_priv		*ssp,
+	const struct command	*cmd,
+	unsigned int		*tag
+);
+
+
+extern int
+seastar_cmd_wait(
+	struct ss_priv		*ssp,
+	unsigned int		tag,
+	uint32_t		*result,
+	unsigned long		timeout
+);
+
+
+extern void
+seastar_cmd_poll(
+	struct ss_priv		*ssp
+);
+
+
+extern void
+seastar_cmd_cleanup(
+	struct ss_priv		*ssp
+);
+
+
 void
 seastar_setup_htb_bi(
 	uint32_t		idr
@@ -31,10 +31,20 @@
 #include <linux/pci.h>
 #include <linux/if_arp.h>
 #include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/pkt_sched.h>
 #include <linux/htirq.h>
 #include <linux/io.h>
 #include <linux/uaccess.h>
+#include <linux/filter.h>
+#include <linux/if_seastar.h>
+#include <linux/net_tstamp.h>
+#include <linux/hash.h>
 #include <net/arp.h>
+#include <net/checksum.h>
+#include <net/dsfield.h>
+#include <net/ip.h>
 #include "firmware.h"
 #include "seastar.h"
 
@@ -48,23 +58,159 @@ MODULE_VERSION(SEASTAR_VERSION_STR);
 MODULE_LICENSE("GPL");
 
 
-static struct pending *alloc_tx_pending(struct ss_priv *ssp)
+/**
+ * Free backlog entries a lane needs before its stopped transmit queue
+ * is woken.  Waking on every completion makes the queue thrash between
+ * started and stopped under load.
+ */
+static unsigned int tx_wake_thresh = NUM_TX_PENDINGS / 4;
+module_param(tx_wake_thresh, uint, 0644);
+MODULE_PARM_DESC(tx_wake_thresh,
+		 "Free backlog entries required to wake a stopped queue");
+
+
+/**
+ * Datagrams a lane may hold in the per-NID queues before its netdev
+ * queue is stopped and further traffic waits in the qdisc.
+ */
+static unsigned int tx_backlog = NUM_TX_PENDINGS;
+module_param(tx_backlog, uint, 0644);
+MODULE_PARM_DESC(tx_backlog, "Datagrams queued per lane in the driver");
+
+
+/**
+ * Most TX pendings a single destination NID may hold.  A NID that is
+ * slow to complete cannot tie up the pendings every other NID needs.
+ */
+static unsigned int tx_nid_pendings = NUM_TX_PENDINGS / 4;
+module_param(tx_nid_pendings, uint, 0644);
+MODULE_PARM_DESC(tx_nid_pendings, "Most TX pendings one destination may hold");
+
+
+/**
+ * Datagrams queued for a single destination NID before new ones for it
+ * are dropped.  Held to a quarter of tx_backlog, so that a few NIDs that
+ * are not draining cannot fill the lane and stop it for everyone.
+ */
+static unsigned int tx_nid_qlen = NUM_TX_PENDINGS / 8;
+module_param(tx_nid_qlen, uint, 0644);
+MODULE_PARM_DESC(tx_nid_qlen, "Datagrams queued per destination before dropping");
+
+
+/**
+ * Bytes each destination NID may send per deficit round robin turn.
+ */
+static unsigned int tx_drr_quantum = SEASTAR_MTU;
+module_param(tx_drr_quantum, uint, 0644);
+MODULE_PARM_DESC(tx_drr_quantum, "Bytes per destination per round robin turn");
+
+
+/**
+ * Received datagrams shorter than this many bytes are copied into a
+ * right-sized skb, and the full-sized receive buffer stays in the ring.
+ */
+static unsigned int rx_copybreak = 256;
+module_param(rx_copybreak, uint, 0644);
+MODULE_PARM_DESC(rx_copybreak, "Copy received datagrams smaller than this");
+
+
+/**
+ * Refill the receive ring once fewer than this many buffers are posted.
+ */
+static unsigned int rx_refill_low = NUM_SKBS / 2;
+module_param(rx_refill_low, uint, 0644);
+MODULE_PARM_DESC(rx_refill_low, "Posted RX buffers that trigger a refill");
+
+
+/**
+ * TX pendings held back for the latency lane.  The bulk lane may use all
+ * the others, and also leaves this many command queue entries free.
+ */
+static unsigned int tx_latency_reserve = 8;
+module_param(tx_latency_reserve, uint, 0644);
+MODULE_PARM_DESC(tx_latency_reserve,
+		 "TX pendings and command queue entries reserved for latency traffic");
+
+
+/**
+ * Back the host window arena with a huge page.
+ */
+static int arena_hugepage = 1;
+module_param(arena_hugepage, int, 0444);
+MODULE_PARM_DESC(arena_hugepage, "Back the SeaStar host arena with a huge page if one is free");
+
+
+/**
+ * Reclaim transmit completions from ss_tx() instead of waiting for the
+ * interrupt handler to get to them.  ss_tx() only drains the event queue
+ * once fewer than a quarter of the TX pendings are free; until then the
+ * reclaim timer is left to pick completions up.
+ */
+static int tx_lazy_reclaim;
+module_param(tx_lazy_reclaim, int, 0644);
+MODULE_PARM_DESC(tx_lazy_reclaim, "Reclaim TX completions from the transmit path");
+
+
+/**
+ * With lazy reclaim, longest time in milliseconds before outstanding
+ * completions are looked for again.
+ */
+static unsigned int tx_reclaim_ms = 10;
+module_param(tx_reclaim_ms, uint, 0644);
+MODULE_PARM_DESC(tx_reclaim_ms, "Lazy TX reclaim safety timer period (ms)");
+
+
+/**
+ * Bounds, in bytes, for the dynamic TX in-flight limit.
+ */
+static unsigned int tx_limit_min = 2 * SEASTAR_MTU;
+module_param(tx_limit_min, uint, 0644);
+MODULE_PARM_DESC(tx_limit_min, "Minimum bytes in flight to the SeaStar");
+
+static unsigned int tx_limit_max = NUM_TX_PENDINGS * SEASTAR_MTU;
+module_param(tx_limit_max, uint, 0644);
+MODULE_PARM_DESC(tx_limit_max, "Maximum bytes in flight to the SeaStar");
+
+
+/**
+ * Send TCP and UDP without computing their checksums, see
+ * SS_TYPE_IP_NOCSUM in <linux/if_seastar.h>.  A receiver that forwards
+ * such a datagram off the fabric computes the checksum then.
+ */
+static int csum_elide;
+module_param(csum_elide, int, 0444);
+MODULE_PARM_DESC(csum_elide, "Elide TCP/UDP checksums on transmit");
+
+
+/**
+ * With checksum elision, checksum and have the receiver verify one in
+ * this many datagrams, zero for none.
+ */
+static unsigned int csum_sample = 1024;
+module_param(csum_sample, uint, 0644);
+MODULE_PARM_DESC(csum_sample, "Verify one in this many elided checksums");
+
+
+SS_BENCH_STATIC struct pending *alloc_tx_pending(struct ss_priv *ssp)
 {
 	struct pending *pending = ssp->tx_pending_free_list;
 	if (!pending)
 		return NULL;
 
 	ssp->tx_pending_free_list = pending->next;
+	ssp->tx_pending_free_count--;
 	pending->next = 0;
 
 	return pending;
 }
 
 
-static void free_tx_pending(struct ss_priv *ssp, struct pending *pending)
+SS_BENCH_STATIC void free_tx_pending(struct ss_priv *ssp,
+				     struct pending *pending)
 {
 	pending->next             = ssp->tx_pending_free_list;
 	ssp->tx_pending_free_list = pending;
+	ssp->tx_pending_free_count++;
 }
 
 
@@ -80,23 +226,157 @@ static struct pending *index_to_pending(struct ss_priv *ssp, unsigned int index)
 }
 
 
-static void refill_skb(struct net_device *netdev, int i)
+static void tx_limit_init(struct tx_limit *txl)
 {
-	struct ss_priv *ssp = netdev_priv(netdev);
-	struct sk_buff *skb;
+	memset(txl, 0, sizeof(*txl));
+	txl->limit        = tx_limit_min;
+	txl->lowest_slack = UINT_MAX;
+	txl->slack_start  = jiffies;
+}
 
-	skb = dev_alloc_skb(netdev->mtu + SKB_PAD);
-	if (!skb) {
-		dev_err(&ssp->pdev->dev, "dev_alloc_skb() failed.\n");
-		return;
+
+/**
+ * Returns non-zero if more bytes may be handed to the SeaStar.  A refusal
+ * means data is being held back by the limit, which tx_limit_completed()
+ * uses to tell starvation from slack.
+ */
+static int tx_limit_admit(struct tx_limit *txl)
+{
+	if (txl->inflight < txl->limit)
+		return 1;
+
+	txl->stopped = 1;
+	return 0;
+}
+
+
+/**
+ * Accounts for bytes handed to the SeaStar.
+ */
+static void tx_limit_queued(struct tx_limit *txl, unsigned int len)
+{
+	txl->inflight += len;
+}
+
+
+/**
+ * Accounts for completed bytes and adjusts the limit.
+ *
+ * If the queue was held back by the limit and everything in flight
+ * completed, the NIC went idle while data was waiting, so the limit
+ * grows by what was drained.  If the limit went partly unused for a
+ * whole hold period, the smallest unused amount seen is given back.
+ */
+static void tx_limit_completed(struct tx_limit *txl, unsigned int len)
+{
+	unsigned int limit = txl->limit;
+	unsigned int slack;
+
+	slack = (txl->inflight < limit) ? limit - txl->inflight : 0;
+	txl->inflight -= min(len, txl->inflight);
+
+	if (txl->stopped && txl->inflight == 0) {
+		/* Starved: grow and restart slack tracking */
+		limit += len;
+		txl->lowest_slack = UINT_MAX;
+		txl->slack_start  = jiffies;
+	} else {
+		if (txl->stopped)
+			slack = 0;
+		txl->lowest_slack = min(txl->lowest_slack, slack);
+
+		if (time_after(jiffies, txl->slack_start + TX_LIMIT_SLACK_HOLD)) {
+			if (txl->lowest_slack != UINT_MAX)
+				limit -= min(txl->lowest_slack, limit);
+			txl->lowest_slack = UINT_MAX;
+			txl->slack_start  = jiffies;
+		}
 	}
 
-	skb->dev = netdev;
-	skb_reserve(skb, SKB_PAD);
+	txl->limit = clamp_t(unsigned int, limit, tx_limit_min,
+			     max(tx_limit_min, tx_limit_max));
+}
+
+
+static void post_skb(struct ss_priv *ssp, int i, struct sk_buff *skb)
+{
+	ssp->skb_table_virt[i] = skb;
+	wmb();
 
 	/* Push it down to the PPC as a quadbyte address */
 	ssp->skb_table_phys[i] = virt_to_phys(skb->data) >> 2;
-	ssp->skb_table_virt[i] = skb;
+}
+
+
+static int refill_skb(struct net_device *netdev, int i, gfp_t gfp)
+{
+	struct ss_priv *ssp = netdev_priv(netdev);
+	struct sk_buff *skb;
+
+	skb = __netdev_alloc_skb(netdev, netdev->mtu + SKB_PAD, gfp);
+	if (!skb)
+		return -ENOMEM;
+
+	skb_reserve(skb, SKB_PAD);
+
+	post_skb(ssp, i, skb);
+	return 0;
+}
+
+
+/**
+ * Refills every empty skb table slot.  Runs from the workqueue so the
+ * allocations can sleep; on failure the work is rescheduled with an
+ * exponentially growing delay instead of leaving the slot empty until
+ * the next RX_EMPTY event.
+ */
+static void ss_rx_refill_work(struct work_struct *work)
+{
+	struct ss_priv *ssp =
+		container_of(work, struct ss_priv, rx_refill_work.work);
+	struct net_device *netdev = ssp->netdev;
+	int i;
+
+	/* The work item may be requeued on another CPU while it runs */
+	mutex_lock(&ssp->rx_refill_mutex);
+
+	for_each_bit(i, ssp->rx_empty, NUM_SKBS) {
+		/* Claim the slot before the firmware can see it again */
+		if (!test_and_clear_bit(i, ssp->rx_empty))
+			continue;
+
+		if (refill_skb(netdev, i, GFP_KERNEL)) {
+			set_bit(i, ssp->rx_empty);
+			ssp->rx_refill_backoff = clamp_t(unsigned long,
+				ssp->rx_refill_backoff * 2, 1,
+				RX_REFILL_MAX_BACKOFF);
+			if (net_ratelimit())
+				dev_err(ssp->dev,
+					"skb allocation failed, retrying in "
+					"%lu jiffies.\n", ssp->rx_refill_backoff);
+			schedule_delayed_work(&ssp->rx_refill_work,
+					      ssp->rx_refill_backoff);
+			goto out;
+		}
+
+		atomic_inc(&ssp->rx_posted);
+	}
+
+	ssp->rx_refill_backoff = 0;
+out:
+	mutex_unlock(&ssp->rx_refill_mutex);
+}
+
+
+/**
+ * Kicks the refill work, unless it is already waiting out a backoff.
+ */
+static void ss_rx_refill(struct net_device *netdev)
+{
+	struct ss_priv *ssp = netdev_priv(netdev);
+
+	if (!ssp->rx_refill_backoff)
+		schedule_delayed_work(&ssp->rx_refill_work, 0);
 }
 
 
@@ -105,45 +385,103 @@ static int ss_open(struct net_device *netdev)
 	struct ss_priv *ssp = netdev_priv(netdev);
 	int i;
 
-	netif_start_queue(netdev);
+	netif_tx_start_all_queues(netdev);
 
 	for (i = 0; i < NUM_SKBS; i++) {
 		ssp->skb_table_phys[i] = 0;
 		ssp->skb_table_virt[i] = 0;
-		refill_skb(netdev, i);
+		set_bit(i, ssp->rx_empty);
+	}
+	atomic_set(&ssp->rx_posted, 0);
+
+	ss_rx_refill_work(&ssp->rx_refill_work.work);
+
+	return 0;
+}
+
+
+/**
+ * Ethertypes carried natively and the SeaStar header type each travels
+ * as, see ETH_P_SEASTAR_RDS in <linux/if_seastar.h>.
+ */
+static const struct {
+	__be16			proto;
+	uint8_t			type;
+} ss_native_types[] = {
+	{ __constant_htons(ETH_P_IP),		SS_TYPE_IP },
+	{ __constant_htons(ETH_P_IP),		SS_TYPE_IP_CSUM },	/* rx only */
+	{ __constant_htons(ETH_P_IP),		SS_TYPE_IP_NOCSUM },	/* rx only */
+	{ __constant_htons(ETH_P_SEASTAR_RDS),	SS_TYPE_RDS },
+	{ __constant_htons(ETH_P_SEASTAR_9P),	SS_TYPE_9P },
+	{ __constant_htons(ETH_P_TIPC),		SS_TYPE_TIPC },
+	{ __constant_htons(ETH_P_AOE),		SS_TYPE_AOE },
+};
+
+
+/**
+ * Returns the SeaStar header type for an ethertype, or -1 if it is not
+ * carried.
+ */
+static int ss_proto_to_type(__be16 proto)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ss_native_types); i++) {
+		if (ss_native_types[i].proto == proto)
+			return ss_native_types[i].type;
+	}
+
+	return -1;
+}
+
+
+/**
+ * Returns the ethertype for a SeaStar header type, or zero if the type
+ * is not one of the native protocols.
+ */
+static __be16 ss_type_to_proto(uint8_t hdr_type)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ss_native_types); i++) {
+		if (SS_HDR_TYPE(ss_native_types[i].type) == hdr_type)
+			return ss_native_types[i].proto;
 	}
 
 	return 0;
 }
 
 
-static int eth2ss(struct ss_priv *ssp, struct sk_buff *skb)
+SS_BENCH_STATIC int eth2ss(struct ss_priv *ssp, struct sk_buff *skb)
 {
 	struct ethhdr *ethhdr;
 	struct sshdr *sshdr;
 	uint8_t source_lo_mac, dest_lo_mac;
 	uint32_t qb_len;
+	int type;
 
 	/* Read the "low" bytes of the source and destination MAC addresses */
 	ethhdr = (struct ethhdr *)skb->data;
 	source_lo_mac = ethhdr->h_source[5];
 	dest_lo_mac   = ethhdr->h_dest[5];
 
-	/* Drop anything not IPv4 */
-	if (ethhdr->h_proto != ntohs(ETH_P_IP)) {
-		dev_err(&ssp->pdev->dev, "squashing non-IPv4 packet.");
+	/* Drop anything not carried natively */
+	type = ss_proto_to_type(ethhdr->h_proto);
+	if (type < 0) {
+		dev_err(ssp->dev, "squashing packet of unsupported type %04x.",
+			ntohs(ethhdr->h_proto));
 		return -1;
 	}
 
 	/* Squash broadcast packets, SeaStar doesn't support broadcast */
 	if (dest_lo_mac == 0xFF) {
-		dev_err(&ssp->pdev->dev, "squashing broadcast packet.");
+		dev_err(ssp->dev, "squashing broadcast packet.");
 		return -1;
 	}
 
 	/* We only support 4 bits of virtual hosts per physical node */
 	if ((source_lo_mac & ~0xF) || (dest_lo_mac & ~0xF)) {
-		dev_err(&ssp->pdev->dev, "lo_mac out of range.");
+		dev_err(ssp->dev, "lo_mac out of range.");
 		return -1;
 	}
 
@@ -158,30 +496,35 @@ static int eth2ss(struct ss_priv *ssp, struct sk_buff *skb)
 	/* Build the SeaStar header */
 	sshdr->length   = qb_len;
 	sshdr->lo_macs  = (source_lo_mac << 4) | dest_lo_mac;
-	sshdr->hdr_type = (2 << 5); /* Datagram 2, type 0 == IP */
+	sshdr->hdr_type = SS_HDR_TYPE(type);
 
 	return 0;
 }
 
 
-static int ss2eth(struct sk_buff *skb)
+SS_BENCH_STATIC int ss2eth(struct sk_buff *skb)
 {
 	struct sshdr *sshdr;
 	struct ethhdr *ethhdr;
 	uint8_t source_lo_mac, dest_lo_mac;
+	__be16 proto;
 
 	/* Read the "low" bytes of the source and destination MAC addresses */
 	sshdr = (struct sshdr *)skb->data;
 	source_lo_mac = (sshdr->lo_macs >> 4);
 	dest_lo_mac    = sshdr->lo_macs & 0xF;
 
+	proto = ss_type_to_proto(sshdr->hdr_type);
+	if (!proto)
+		return -1;
+
 	/* Make room for the rest of the ethernet header and zero it */
 	ethhdr = (struct ethhdr *)
 	     skb_push(skb, (unsigned int)(ETH_HLEN - sizeof(struct sshdr)));
 	memset(ethhdr, 0x00, ETH_HLEN);
 
 	/* h_proto and h_dest[] are available.  Just 0xff h_source[2-5] */
-	ethhdr->h_proto = htons(ETH_P_IP);
+	ethhdr->h_proto = proto;
 
 	/* We're assuming the source MAC is the same as the local
 	 * host's MAC in order to support loopback in promiscous mode */
@@ -194,118 +537,822 @@ static int ss2eth(struct sk_buff *skb)
 }
 
 
-static int ss_tx(struct sk_buff *skb, struct net_device *netdev)
+/**
+ * Returns the offset of the checksum field in the transport header for
+ * IPv4 protocols whose checksum may be elided, else zero.
+ */
+static unsigned int ss_csum_offset(uint8_t protocol)
 {
-	unsigned long flags;
-	struct ss_priv *ssp = netdev_priv(netdev);
-	struct ethhdr *eh = (struct ethhdr *)skb->data;
-	struct sshdr *sshdr;
-	uint32_t dest_nid = ntohl(*(uint32_t *)eh->h_dest);
-	struct pending *pending = NULL;
-	void *msg;
+	switch (protocol) {
+	case IPPROTO_TCP:
+		return offsetof(struct tcphdr, check);
+	case IPPROTO_UDP:
+		return offsetof(struct udphdr, check);
+	}
 
-	spin_lock_irqsave(&ssp->lock, flags);
+	return 0;
+}
 
-	if (netif_queue_stopped(netdev)) {
-		spin_unlock_irqrestore(&ssp->lock, flags);
-		return NETDEV_TX_BUSY;
+
+/**
+ * Returns non-zero if the checksum a CHECKSUM_PARTIAL frame still needs
+ * is the TCP or UDP one of a whole IPv4 datagram, which the receiver
+ * knows how to find again.
+ */
+static int ss_tx_csum_elidable(struct sk_buff *skb)
+{
+	const struct iphdr *iph = ip_hdr(skb);
+	unsigned int off;
+
+	if (skb->protocol != htons(ETH_P_IP) ||
+	    (iph->frag_off & htons(IP_MF | IP_OFFSET)))
+		return 0;
+
+	off = ss_csum_offset(iph->protocol);
+
+	return off && skb->csum_offset == off &&
+	       skb->csum_start - skb_headroom(skb) ==
+	       skb_network_offset(skb) + iph->ihl * 4;
+}
+
+
+/**
+ * Settles a transmitted frame's checksum under checksum elision.  Returns
+ * the SeaStar header type an IPv4 frame goes as: SS_TYPE_IP_NOCSUM if
+ * the checksum was left out, SS_TYPE_IP_CSUM if it was computed as a
+ * sample, or SS_TYPE_IP.  Returns a negative errno on failure.
+ */
+static int ss_tx_csum(struct ss_priv *ssp, struct sk_buff *skb)
+{
+	int err;
+
+	if (skb->ip_summed != CHECKSUM_PARTIAL)
+		return SS_TYPE_IP;
+
+	/* Anything else the receiver could not complete is done here */
+	if (!ss_tx_csum_elidable(skb)) {
+		err = skb_checksum_help(skb);
+		return err ? err : SS_TYPE_IP;
 	}
 
-	/* Convert the SKB from an ethernet frame to a seastar frame */
-	if (eth2ss(ssp, skb)) {
-		netdev->stats.tx_errors++;
-		goto drop;
+	if (!csum_sample || ++ssp->tx_csum_count < csum_sample)
+		return SS_TYPE_IP_NOCSUM;
+	ssp->tx_csum_count = 0;
+
+	err = skb_checksum_help(skb);
+	return err ? err : SS_TYPE_IP_CSUM;
+}
+
+
+/**
+ * Returns the header length of the IPv4 datagram at skb->data, or zero
+ * if the header does not fit the skb.
+ */
+static unsigned int ss_rx_ihl(const struct sk_buff *skb)
+{
+	const struct iphdr *iph = (const struct iphdr *)skb->data;
+	unsigned int ihl, len;
+
+	if (skb->len < sizeof(*iph))
+		return 0;
+
+	ihl = iph->ihl * 4;
+	len = ntohs(iph->tot_len);
+	if (ihl < sizeof(*iph) || len < ihl || len > skb->len)
+		return 0;
+
+	return ihl;
+}
+
+
+/**
+ * Marks the elided checksum of a datagram, with skb->data at the IP
+ * header, as still to be computed.  Local delivery trusts it like a
+ * verified one; a forwarding output device computes it.  Returns zero if
+ * the datagram is not one the sender could have elided.
+ */
+static int ss_rx_csum_partial(struct sk_buff *skb)
+{
+	const struct iphdr *iph = (const struct iphdr *)skb->data;
+	unsigned int ihl, off;
+
+	ihl = ss_rx_ihl(skb);
+	if (!ihl || (iph->frag_off & htons(IP_MF | IP_OFFSET)))
+		return 0;
+
+	off = ss_csum_offset(iph->protocol);
+	if (!off)
+		return 0;
+
+	return skb_partial_csum_set(skb, ihl, off);
+}
+
+
+/**
+ * Verifies the TCP or UDP checksum of a sampled datagram, with skb->data
+ * at the IP header.  Returns zero if it is bad.
+ */
+static int ss_rx_csum_ok(struct sk_buff *skb)
+{
+	const struct iphdr *iph = (const struct iphdr *)skb->data;
+	unsigned int ihl, len;
+	__wsum csum;
+
+	ihl = ss_rx_ihl(skb);
+	if (!ihl)
+		return 0;
+	len = ntohs(iph->tot_len);
+
+	/* Senders only sample whole TCP and UDP datagrams */
+	if (iph->frag_off & htons(IP_MF | IP_OFFSET))
+		return 1;
+	if (!ss_csum_offset(iph->protocol))
+		return 1;
+
+	csum = skb_checksum(skb, ihl, len - ihl, 0);
+	return !csum_tcpudp_magic(iph->saddr, iph->daddr, len - ihl,
+				  iph->protocol, csum);
+}
+
+
+/**
+ * Returns non-zero if skb holds a pre-built datagram, see ETH_P_SEASTAR
+ * in <linux/if_seastar.h>.
+ */
+static inline int ss_is_raw(const struct sk_buff *skb)
+{
+	return skb->protocol == htons(ETH_P_SEASTAR);
+}
+
+
+/**
+ * Start of the SeaStar datagram inside an skb ready for transmit.
+ */
+static inline void *ss_tx_frame(const struct sk_buff *skb)
+{
+	return skb->data + (ss_is_raw(skb) ? sizeof(__be32) : 0);
+}
+
+
+static inline unsigned int ss_tx_frame_len(const struct sk_buff *skb)
+{
+	return skb->len - (ss_is_raw(skb) ? sizeof(__be32) : 0);
+}
+
+
+/**
+ * Checks a pre-built datagram before it is queued.  It is sent as is,
+ * so it has to be well formed already.
+ */
+static int ss_raw_check(struct ss_priv *ssp, struct sk_buff *skb)
+{
+	struct ss_raw_hdr *raw = (struct ss_raw_hdr *)skb->data;
+	unsigned int len;
+
+	if (skb_is_nonlinear(skb) || skb->len < sizeof(*raw))
+		return -1;
+
+	len = ss_tx_frame_len(skb);
+	if (len > ssp->netdev->mtu + sizeof(struct sshdr) ||
+	    ((raw->length + 1) << 2) != ROUNDUP4(len))
+		return -1;
+
+	if (raw->hdr_type != SS_HDR_TYPE(SS_TYPE_RAW) ||
+	    (raw->lo_macs & 0xF) == 0xF)
+		return -1;
+
+	/* No sending as another interface on this node */
+	if ((raw->lo_macs >> 4) != (ssp->netdev->dev_addr[5] & 0xF))
+		return -1;
+
+	return 0;
+}
+
+
+/**
+ * Flags the skb for a time stamp when the SeaStar reports the send
+ * complete, if one was asked for.
+ */
+static void ss_tx_tstamp(struct ss_priv *ssp, struct sk_buff *skb)
+{
+	union skb_shared_tx *shtx = skb_tx(skb);
+
+	if (shtx->hardware && ssp->tx_tstamp)
+		shtx->in_progress = 1;
+}
+
+
+/**
+ * Reports the hardware time stamps of the skbs queued by ss_tx_end():
+ * first the time the SeaStar was handed the datagram, then the time it
+ * reported the send complete, so that time spent queued in the host and
+ * time spent in the NIC can be told apart.  Delivering a stamp takes
+ * socket locks that are not safe in hard interrupt context, so it is
+ * done from here.
+ */
+static void ss_tstamp_tasklet(unsigned long data)
+{
+	struct ss_priv *ssp = (struct ss_priv *)data;
+	struct skb_shared_hwtstamps hwts;
+	struct sk_buff *skb;
+
+	while ((skb = skb_dequeue(&ssp->tstamp_queue)) != NULL) {
+		hwts.hwtstamp  = SS_TX_CB(skb)->submitted;
+		hwts.syststamp = SS_TX_CB(skb)->submitted;
+		skb_tstamp_tx(skb, &hwts);
+
+		hwts.hwtstamp  = SS_TX_CB(skb)->tstamp;
+		hwts.syststamp = SS_TX_CB(skb)->tstamp;
+		skb_tstamp_tx(skb, &hwts);
+		dev_kfree_skb(skb);
 	}
+}
 
-	sshdr = (struct sshdr *)skb->data;
+
+/**
+ * Number of pendings a lane may still take, honouring the latency lane's
+ * reservation.
+ */
+static unsigned int tx_lane_avail(struct ss_priv *ssp, unsigned int lane)
+{
+	unsigned int cap, inuse;
+
+	if (lane == TX_LANE_LATENCY)
+		return ssp->tx_pending_free_count;
+
+	cap   = NUM_NETDEV_TX_PENDINGS -
+		min_t(unsigned int, tx_latency_reserve,
+		      NUM_NETDEV_TX_PENDINGS - 1);
+	inuse = ssp->tx_lane[lane].inuse;
+	if (inuse >= cap)
+		return 0;
+
+	return min(cap - inuse, ssp->tx_pending_free_count);
+}
+
+
+/**
+ * Returns non-zero if a lane may issue another command.  Every lane needs
+ * a free command queue entry, and the bulk lane leaves the last few to
+ * the latency lane.
+ */
+static int tx_lane_admit(struct ss_priv *ssp, unsigned int lane)
+{
+	unsigned int free, reserve = 0;
+
+	if (!tx_lane_avail(ssp, lane))
+		return 0;
+
+	if (lane != TX_LANE_LATENCY)
+		reserve = min(tx_latency_reserve,
+			      (unsigned int)COMMAND_Q_LENGTH - 2);
+
+	/* Only go out to the mailbox when the last look says it is full */
+	free = seastar_cmdq_free_cached(ssp);
+	if (free <= reserve)
+		free = seastar_cmdq_free(ssp);
+
+	return free > reserve;
+}
+
+
+static u16 ss_select_queue(struct net_device *netdev, struct sk_buff *skb)
+{
+	unsigned int prio = skb->priority & TC_PRIO_MAX;
+
+	if (prio == TC_PRIO_INTERACTIVE || prio == TC_PRIO_CONTROL)
+		return TX_LANE_LATENCY;
+
+	/* CS5 and above, which includes EF, go in the latency lane */
+	if (skb->protocol == htons(ETH_P_IP) &&
+	    skb_network_header(skb) + sizeof(struct iphdr) <=
+	    skb_tail_pointer(skb) &&
+	    (ipv4_get_dsfield(ip_hdr(skb)) >> 2) >= 40)
+		return TX_LANE_LATENCY;
+
+	return TX_LANE_BULK;
+}
+
+
+/**
+ * Returns non-zero if a datagram on this lane can be handed to the
+ * SeaStar now.
+ */
+static int tx_can_submit(struct ss_priv *ssp, unsigned int lane)
+{
+	return tx_lane_admit(ssp, lane) &&
+		tx_limit_admit(&ssp->tx_lane[lane].limit);
+}
+
+
+static void ss_nid_queue_free(struct ss_nid_queue *nq)
+{
+	unsigned int lane;
+
+	for (lane = 0; lane < NUM_TX_LANES; lane++)
+		__skb_queue_purge(&nq->queue[lane]);
+	kfree(nq);
+}
+
+
+/**
+ * Finds the queue for a destination NID, creating it on first use.
+ * Other queues in the bucket that have had nothing queued or in flight
+ * for NID_QUEUE_IDLE are freed on the way.
+ */
+static struct ss_nid_queue *ss_nid_queue_get(struct ss_priv *ssp, uint32_t nid)
+{
+	struct hlist_head *head = &ssp->nid_hash[hash_32(nid, NID_HASH_BITS)];
+	struct hlist_node *node, *tmp;
+	struct ss_nid_queue *nq, *found = NULL;
+	unsigned int lane;
+
+	hlist_for_each_entry_safe(nq, node, tmp, head, hash) {
+		if (nq->nid == nid) {
+			found = nq;
+		} else if (list_empty(&nq->active) && !nq->inflight &&
+			   time_after(jiffies, nq->last_used + NID_QUEUE_IDLE)) {
+			hlist_del(&nq->hash);
+			ss_nid_queue_free(nq);
+		}
+	}
+
+	if (found)
+		return found;
+
+	nq = kzalloc(sizeof(*nq), GFP_ATOMIC);
+	if (!nq)
+		return NULL;
+
+	nq->nid       = nid;
+	nq->last_used = jiffies;
+	INIT_LIST_HEAD(&nq->active);
+	for (lane = 0; lane < NUM_TX_LANES; lane++)
+		skb_queue_head_init(&nq->queue[lane]);
+	hlist_add_head(&nq->hash, head);
+
+	return nq;
+}
+
+
+static unsigned int ss_nid_queue_len(struct ss_nid_queue *nq)
+{
+	unsigned int lane, len = 0;
+
+	for (lane = 0; lane < NUM_TX_LANES; lane++)
+		len += skb_queue_len(&nq->queue[lane]);
+
+	return len;
+}
+
+
+/**
+ * Returns the next datagram a NID could send now, latency lane first,
+ * or NULL if neither of its lanes can.
+ */
+static struct sk_buff *ss_nid_queue_peek(struct ss_priv *ssp,
+					 struct ss_nid_queue *nq)
+{
+	unsigned int lane;
+
+	for (lane = 0; lane < NUM_TX_LANES; lane++) {
+		if (!skb_queue_empty(&nq->queue[lane]) &&
+		    tx_can_submit(ssp, lane))
+			return skb_peek(&nq->queue[lane]);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Hands an already converted SeaStar frame to the firmware.  The caller
+ * has checked that a pending and a command queue entry are available.
+ */
+static void ss_tx_submit(struct ss_priv *ssp, struct ss_nid_queue *nq,
+			 struct sk_buff *skb)
+{
+	struct net_device *netdev = ssp->netdev;
+	struct sshdr *sshdr = ss_tx_frame(skb);
+	unsigned int lane = skb_get_queue_mapping(skb);
+	struct pending *pending;
+	void *msg;
 
 	/* Get a tx_pending so that we can track the completion of this SKB */
 	pending = alloc_tx_pending(ssp);
-	if (!pending) {
-		netif_stop_queue(netdev);
-		spin_unlock_irqrestore(&ssp->lock, flags);
-		return NETDEV_TX_BUSY;
-	}
+	pending->lane = lane;
+	pending->nq   = nq;
+	ssp->tx_lane[lane].inuse++;
+	nq->inflight++;
 
 	/* Stash skb away in the pending, will be needed in ss_tx_end() */
 	pending->skb = skb;
+	pending->len = ss_tx_frame_len(skb);
 
 	/* Make sure buffer we pass to SeaStar is quad-byte aligned */
-	if (((unsigned long)skb->data & 0x3) == 0) {
+	if (((unsigned long)sshdr & 0x3) == 0) {
 		pending->bounce = NULL;
-		msg = skb->data;
+		msg = sshdr;
 	} else {
 		/* Need to use bounce buffer to get quad-byte alignment */
-		pending->bounce = kmalloc(skb->len, GFP_KERNEL);
-		if (!pending->bounce) {
-			dev_err(&ssp->pdev->dev, "dev_alloc_skb() failed.\n");
+		pending->bounce = ssp->bounce_slots +
+			pending_to_index(ssp, pending) * TX_BOUNCE_SIZE;
+		memcpy(pending->bounce, sshdr, pending->len);
+		msg = pending->bounce;
+	}
+
+	ss_tx_tstamp(ssp, skb);
+	if (skb_tx(skb)->in_progress)
+		pending->submitted = ktime_get_real();
+
+	/* tx_lane_admit() saw a free command queue entry */
+	WARN_ON_ONCE(seastar_ip_tx_cmd(
+		ssp,
+		nq->nid,
+		sshdr->length,
+		virt_to_phys(msg) >> 2,
+		pending_to_index(ssp, pending)
+	));
+
+	tx_limit_queued(&ssp->tx_lane[lane].limit, pending->len);
+
+	netdev->stats.tx_packets++;
+	netdev->stats.tx_bytes += pending->len;
+}
+
+
+/**
+ * Serves the per-NID queues by deficit round robin until nothing more
+ * can be sent.  A NID holding its share of the pendings is passed over,
+ * so a slow destination only delays its own traffic.
+ */
+static void ss_tx_dispatch(struct ss_priv *ssp)
+{
+	struct ss_nid_queue *nq;
+	struct sk_buff *skb;
+	unsigned int lane, idle = 0;
+	unsigned int cap = clamp_t(unsigned int, tx_nid_pendings,
+				   1, NUM_NETDEV_TX_PENDINGS);
+	int quantum = clamp_t(unsigned int, tx_drr_quantum, 64, SEASTAR_MTU);
+
+	/* Stop once every active NID has been passed over in a row */
+	while (idle < ssp->nid_active_count && ssp->tx_pending_free_count) {
+		nq  = list_first_entry(&ssp->nid_active, struct ss_nid_queue,
+				       active);
+		skb = (nq->inflight < cap) ? ss_nid_queue_peek(ssp, nq) : NULL;
+
+		if (!skb) {
+			list_move_tail(&nq->active, &ssp->nid_active);
+			idle++;
+			continue;
+		}
+
+		if (skb->len > nq->deficit) {
+			nq->deficit += quantum;
+			list_move_tail(&nq->active, &ssp->nid_active);
+			idle = 0;
+			continue;
+		}
+
+		lane = skb_get_queue_mapping(skb);
+		__skb_unlink(skb, &nq->queue[lane]);
+		ssp->tx_lane[lane].backlog--;
+		nq->deficit -= skb->len;
+		idle = 0;
+
+		if (!ss_nid_queue_len(nq)) {
+			nq->deficit = 0;
+			list_del_init(&nq->active);
+			ssp->nid_active_count--;
+		}
+
+		ss_tx_submit(ssp, nq, skb);
+	}
+}
+
+
+static unsigned int tx_backlog_max(void)
+{
+	return max(tx_backlog, 1U);
+}
+
+
+static void ss_tx_reclaim(struct net_device *netdev);
+
+
+SS_BENCH_STATIC int ss_tx(struct sk_buff *skb, struct net_device *netdev)
+{
+	unsigned long flags;
+	struct ss_priv *ssp = netdev_priv(netdev);
+	struct sk_buff *nskb;
+	uint32_t dest_nid;
+	unsigned int lane = skb_get_queue_mapping(skb);
+	struct netdev_queue *txq = netdev_get_tx_queue(netdev, lane);
+	struct tx_lane *txl = &ssp->tx_lane[lane];
+	struct ss_nid_queue *nq;
+	int csum_type, low;
+
+	/* Only ss_tx() stops the queue, and the core holds its xmit lock */
+	if (netif_tx_queue_stopped(txq))
+		return NETDEV_TX_BUSY;
+
+	/* Once per datagram, and before ssp->lock, which may be held in
+	 * hard interrupts */
+	if (skb_tx(skb)->software)
+		skb_tstamp_tx(skb, NULL);
+
+	spin_lock_irqsave(&ssp->lock, flags);
+
+	/* An skb sent repeatedly (pktgen) may still be queued here */
+	if (skb_shared(skb)) {
+		nskb = skb_clone(skb, GFP_ATOMIC);
+		kfree_skb(skb);
+		if (!nskb) {
+			netdev->stats.tx_dropped++;
+			spin_unlock_irqrestore(&ssp->lock, flags);
+			return 0;
+		}
+		skb = nskb;
+	}
+
+	if (ss_is_raw(skb)) {
+		/* Pre-built datagram, sent as is */
+		if (ss_raw_check(ssp, skb)) {
+			netdev->stats.tx_errors++;
 			goto drop;
 		}
-		memcpy(pending->bounce, skb->data, skb->len);
-		msg = pending->bounce;
+		dest_nid = ntohl(((struct ss_raw_hdr *)skb->data)->nid);
+	} else {
+		/* The ethernet header is rewritten in place */
+		if (skb_cow_head(skb, 0)) {
+			netdev->stats.tx_dropped++;
+			goto drop;
+		}
+		dest_nid = ntohl(*(uint32_t *)((struct ethhdr *)skb->data)->h_dest);
+
+		csum_type = ss_tx_csum(ssp, skb);
+		if (csum_type < 0) {
+			netdev->stats.tx_errors++;
+			goto drop;
+		}
+
+		/* Convert the SKB from an ethernet frame to a seastar frame */
+		if (eth2ss(ssp, skb)) {
+			netdev->stats.tx_errors++;
+			goto drop;
+		}
+		if (csum_type != SS_TYPE_IP)
+			((struct sshdr *)skb->data)->hdr_type =
+				SS_HDR_TYPE(csum_type);
+	}
+
+	/* Unaligned frames go through a bounce slot, which must hold them */
+	if (((unsigned long)ss_tx_frame(skb) & 0x3) &&
+	    ss_tx_frame_len(skb) > TX_BOUNCE_SIZE) {
+		dev_err(ssp->dev, "frame too large to bounce.\n");
+		netdev->stats.tx_errors++;
+		goto drop;
+	}
+
+	nq = ss_nid_queue_get(ssp, dest_nid);
+	if (!nq) {
+		netdev->stats.tx_dropped++;
+		goto drop;
+	}
+
+	/* A destination that is not draining only loses its own datagrams */
+	if (ss_nid_queue_len(nq) >=
+	    clamp_t(unsigned int, tx_nid_qlen, 1, max(tx_backlog_max() / 4, 1U))) {
+		netdev->stats.tx_dropped++;
+		goto drop;
+	}
+
+	nq->last_used = jiffies;
+	__skb_queue_tail(&nq->queue[lane], skb);
+	txl->backlog++;
+	if (list_empty(&nq->active)) {
+		list_add_tail(&nq->active, &ssp->nid_active);
+		ssp->nid_active_count++;
+	}
+
+	ss_tx_dispatch(ssp);
+
+	/* Keep the rest of the traffic in the qdisc once the lane is full */
+	if (txl->backlog >= tx_backlog_max())
+		netif_tx_stop_queue(txq);
+
+	low = ssp->tx_pending_free_count < NUM_NETDEV_TX_PENDINGS / 4;
+
+	spin_unlock_irqrestore(&ssp->lock, flags);
+
+	if (tx_lazy_reclaim) {
+		if (low)
+			ss_tx_reclaim(netdev);
+		if (!timer_pending(&ssp->reclaim_timer))
+			mod_timer(&ssp->reclaim_timer,
+				  jiffies + msecs_to_jiffies(tx_reclaim_ms));
+	}
+
+	return 0;
+
+drop:
+	dev_kfree_skb_any(skb);
+	spin_unlock_irqrestore(&ssp->lock, flags);
+	return 0;
+}
+
+
+/**
+ * Drops everything waiting in the per-NID queues and frees them.  Called
+ * once the netdev can no longer transmit.
+ */
+SS_BENCH_STATIC void ss_tx_purge(struct ss_priv *ssp)
+{
+	struct ss_nid_queue *nq;
+	struct hlist_node *node, *tmp;
+	unsigned long flags;
+	unsigned int i;
+
+	del_timer_sync(&ssp->reclaim_timer);
+
+	spin_lock_irqsave(&ssp->lock, flags);
+
+	/* Completions still to come must not touch the queues */
+	for (i = 0; i < NUM_TX_PENDINGS; i++)
+		index_to_pending(ssp, i)->nq = NULL;
+
+	for (i = 0; i < (1 << NID_HASH_BITS); i++) {
+		hlist_for_each_entry_safe(nq, node, tmp, &ssp->nid_hash[i],
+					  hash) {
+			hlist_del(&nq->hash);
+			list_del(&nq->active);
+			ss_nid_queue_free(nq);
+		}
 	}
 
-	seastar_ip_tx_cmd(
-		ssp,
-		dest_nid,
-		sshdr->length,
-		virt_to_phys(msg) >> 2,
-		pending_to_index(ssp, pending)
-	);
-
-	netdev->stats.tx_packets++;
-	netdev->stats.tx_bytes += skb->len;
+	INIT_LIST_HEAD(&ssp->nid_active);
+	ssp->nid_active_count = 0;
+	for (i = 0; i < NUM_TX_LANES; i++)
+		ssp->tx_lane[i].backlog = 0;
 
 	spin_unlock_irqrestore(&ssp->lock, flags);
-	return 0;
+}
 
-drop:
-	dev_kfree_skb_any(skb);
-	if (pending)
-		free_tx_pending(ssp, pending);
-	spin_unlock_irqrestore(&ssp->lock, flags);
-	return 0;
+
+/**
+ * Hands waiting datagrams to the SeaStar and wakes the lanes that have
+ * room again.  Called with ssp->lock held whenever pendings or command
+ * queue entries are freed.
+ */
+void ss_tx_restart(struct ss_priv *ssp)
+{
+	struct netdev_queue *txq;
+	unsigned int lane, wake_thresh;
+
+	ss_tx_dispatch(ssp);
+
+	for (lane = 0; lane < NUM_TX_LANES; lane++) {
+		txq = netdev_get_tx_queue(ssp->netdev, lane);
+
+		/* The latency lane is woken as soon as it has room */
+		wake_thresh = (lane == TX_LANE_LATENCY) ? 1 :
+			clamp_t(unsigned int, tx_wake_thresh, 1, tx_backlog_max());
+
+		if (netif_tx_queue_stopped(txq) &&
+		    ssp->tx_lane[lane].backlog + wake_thresh <= tx_backlog_max())
+			netif_tx_wake_queue(txq);
+	}
 }
 
 
-static void ss_tx_end(struct net_device *netdev, unsigned int pending_index)
+static void ss_tx_end(struct net_device *netdev, struct pending *done)
 {
 	unsigned long flags;
 	struct ss_priv *ssp = netdev_priv(netdev);
-	struct pending *pending = index_to_pending(ssp, pending_index);
+	struct pending *pending, *next;
+	struct sk_buff *skb, *free_skbs = NULL;
+	struct tx_lane *txl;
+	unsigned int lane, bytes[NUM_TX_LANES] = { 0 };
+	int tstamps = 0;
 
 	spin_lock_irqsave(&ssp->lock, flags);
 
-	if (pending->skb)
-		dev_kfree_skb_any(pending->skb);
+	for (pending = done; pending; pending = next) {
+		next = pending->next;
+
+		/* Skbs owed a time stamp go to the tasklet, which frees them */
+		if (pending->skb && skb_tx(pending->skb)->in_progress) {
+			SS_TX_CB(pending->skb)->submitted = pending->submitted;
+			SS_TX_CB(pending->skb)->tstamp    = pending->tstamp;
+			skb_queue_tail(&ssp->tstamp_queue, pending->skb);
+			pending->skb = NULL;
+			tstamps = 1;
+		}
+
+		/* Chain the skbs up and free them after dropping the lock */
+		if (pending->skb) {
+			pending->skb->next = free_skbs;
+			free_skbs = pending->skb;
+			pending->skb = NULL;
+		}
+
+		pending->bounce = NULL;
+
+		if (pending->nq) {
+			pending->nq->inflight--;
+			pending->nq->last_used = jiffies;
+			pending->nq = NULL;
+		}
+
+		bytes[pending->lane] += pending->len;
+		ssp->tx_lane[pending->lane].inuse--;
+		free_tx_pending(ssp, pending);
+	}
+
+	for (lane = 0; lane < NUM_TX_LANES; lane++) {
+		txl = &ssp->tx_lane[lane];
 
-	kfree(pending->bounce);
+		if (bytes[lane])
+			tx_limit_completed(&txl->limit, bytes[lane]);
 
-	free_tx_pending(ssp, pending);
+		if (txl->limit.inflight < txl->limit.limit)
+			txl->limit.stopped = 0;
+	}
 
-	if (netif_queue_stopped(netdev))
-		netif_wake_queue(netdev);
+	/* Completions free pendings and per-NID shares for waiting traffic */
+	ss_tx_restart(ssp);
 
 	spin_unlock_irqrestore(&ssp->lock, flags);
+
+	if (tstamps)
+		tasklet_schedule(&ssp->tstamp_tasklet);
+
+	while (free_skbs) {
+		skb = free_skbs;
+		free_skbs = skb->next;
+		skb->next = NULL;
+		dev_kfree_skb_any(skb);
+	}
 }
 
 
 static void ss_rx_skb(struct net_device *netdev, struct sk_buff *skb)
 {
+	struct ss_priv *ssp = netdev_priv(netdev);
 	struct sshdr *sshdr = (struct sshdr *)skb_tail_pointer(skb);
 
 	const uint32_t qb_len = sshdr->length;
 	const uint32_t len    = (qb_len + 1) << 2;
 
 	skb_put(skb, len);
-	ss2eth(skb);
 
-	skb->protocol  = htons(ETH_P_IP);
-	skb->ip_summed = CHECKSUM_UNNECESSARY;
-	skb_set_mac_header(skb, 0);
+	if (ssp->rx_tstamp) {
+		skb_hwtstamps(skb)->hwtstamp  = ssp->event_time;
+		skb_hwtstamps(skb)->syststamp = ssp->event_time;
+	}
+
+	if (sshdr->hdr_type == SS_HDR_TYPE(SS_TYPE_RAW)) {
+		/* Pre-built datagram, passed up from the SeaStar header on */
+		skb->protocol = htons(ETH_P_SEASTAR);
+		skb_reset_mac_header(skb);
+		skb_reset_network_header(skb);
+	} else {
+		const uint8_t hdr_type = sshdr->hdr_type;
+
+		if (ss2eth(skb)) {
+			netdev->stats.rx_errors++;
+			dev_kfree_skb_any(skb);
+			return;
+		}
+
+		skb->protocol  = ((struct ethhdr *)skb->data)->h_proto;
+		if (skb->protocol == htons(ETH_P_IP))
+			skb->ip_summed = CHECKSUM_UNNECESSARY;
+		skb_set_mac_header(skb, 0);
+
+		/* Skip past the ethernet header we just built */
+		skb_pull(skb, ETH_HLEN);
 
-	/* Skip past the ethernet header we just built */
-	skb_pull(skb, ETH_HLEN);
+		/* Elided checksums are computed if the datagram is forwarded */
+		if (hdr_type == SS_HDR_TYPE(SS_TYPE_IP_NOCSUM) &&
+		    !ss_rx_csum_partial(skb)) {
+			netdev->stats.rx_errors++;
+			dev_kfree_skb_any(skb);
+			return;
+		}
+
+		/* A sampled checksum stands for all the elided ones */
+		if (hdr_type == SS_HDR_TYPE(SS_TYPE_IP_CSUM) &&
+		    !ss_rx_csum_ok(skb)) {
+			if (net_ratelimit())
+				dev_warn(ssp->dev, "bad sampled checksum from lo_mac %u.\n",
+					 ((struct ethhdr *)skb_mac_header(skb))->h_source[5]);
+			netdev->stats.rx_errors++;
+			netdev->stats.rx_crc_errors++;
+			dev_kfree_skb_any(skb);
+			return;
+		}
+	}
 
 	netdev->stats.rx_packets++;
 	netdev->stats.rx_bytes += len;
@@ -314,21 +1361,98 @@ static void ss_rx_skb(struct net_device *netdev, struct sk_buff *skb)
 }
 
 
+/**
+ * Early receive filter, see SIOCSSSRXFILTER in <linux/if_seastar.h>.
+ */
+struct ss_rx_filter {
+	unsigned int		len;
+	struct sock_filter	insns[0];
+};
+
+
+/**
+ * Runs the early receive filter over a datagram still sitting in its
+ * receive buffer.  Returns zero if the datagram should be dropped.
+ */
+static int ss_rx_filter(struct ss_priv *ssp, struct sk_buff *skb,
+			unsigned int len)
+{
+	struct ss_rx_filter *filter;
+	unsigned int verdict = 1;
+
+	rcu_read_lock();
+	filter = rcu_dereference(ssp->rx_filter);
+	if (filter) {
+		skb_put(skb, len);
+		verdict = sk_run_filter(skb, filter->insns, filter->len);
+		__skb_trim(skb, 0);
+
+		if (verdict == SS_RXFILTER_DROP)
+			ssp->rx_filter_dropped++;
+		else if (verdict == SS_RXFILTER_COUNT)
+			ssp->rx_filter_counted++;
+		else
+			ssp->rx_filter_passed++;
+	}
+	rcu_read_unlock();
+
+	return verdict != SS_RXFILTER_DROP;
+}
+
+
 static void ss_rx(struct net_device *netdev, unsigned int skb_index)
 {
 	struct ss_priv *ssp = netdev_priv(netdev);
 	struct sk_buff *skb = ssp->skb_table_virt[skb_index];
+	struct sk_buff *copy;
+	uint32_t len;
+
+	len = (((struct sshdr *)skb->data)->length + 1) << 2;
+
+	/* Bypass channel traffic is copied out, the buffer goes straight back */
+	if (((struct sshdr *)skb->data)->hdr_type ==
+	    SS_HDR_TYPE(SS_TYPE_BYPASS)) {
+		ss_bypass_rx(ssp, skb->data, len);
+		post_skb(ssp, skb_index, skb);
+		return;
+	}
+
+	/* Dropped datagrams go straight back to the NIC, untouched */
+	if (ssp->rx_filter && !ss_rx_filter(ssp, skb, len)) {
+		post_skb(ssp, skb_index, skb);
+		return;
+	}
 
+	/* Copy small datagrams and hand the same buffer straight back */
+	if (len < rx_copybreak) {
+		copy = netdev_alloc_skb(netdev, len + SKB_PAD);
+		if (copy) {
+			skb_reserve(copy, SKB_PAD);
+			memcpy(skb_tail_pointer(copy), skb->data, len);
+			post_skb(ssp, skb_index, skb);
+			ss_rx_skb(netdev, copy);
+			return;
+		}
+	}
+
+	/* The slot is empty before the refill work may claim it */
+	ssp->skb_table_phys[skb_index] = 0;
 	ssp->skb_table_virt[skb_index] = 0;
+	smp_mb__before_clear_bit();
+	set_bit(skb_index, ssp->rx_empty);
 	ss_rx_skb(netdev, skb);
 
-	refill_skb(netdev, skb_index);
+	/* Refill in a batch once the ring drains below the low watermark */
+	if (atomic_dec_return(&ssp->rx_posted) <
+	    min_t(int, rx_refill_low, NUM_SKBS))
+		ss_rx_refill(netdev);
 }
 
 
-static int ss_header_create(struct sk_buff *skb, struct net_device *netdev,
-			    unsigned short type, const void *daddr,
-			    const void *saddr, unsigned int length)
+SS_BENCH_STATIC int ss_header_create(struct sk_buff *skb,
+				     struct net_device *netdev,
+				     unsigned short type, const void *daddr,
+				     const void *saddr, unsigned int length)
 {
 	struct ethhdr *eh;
 
@@ -336,9 +1460,10 @@ static int ss_header_create(struct sk_buff *skb, struct net_device *netdev,
 	eh = (struct ethhdr *)skb_push(skb, ETH_HLEN);
 	memset(eh, 0, ETH_HLEN);
 
-	/* Although we can only do IPv4, build other packets correctly for
-	 * now and drop it in the ndo_start_xmit hook.  This way the fact that
-	 * these packets are being generated is not invisible. */
+	/* Although we only carry a few ethertypes, build other packets
+	 * correctly for now and drop them in the ndo_start_xmit hook.  This
+	 * way the fact that these packets are being generated is not
+	 * invisible. */
 	eh->h_proto = htons(type);
 
 	/* Set the source hardware address */
@@ -370,22 +1495,13 @@ static uint32_t next_event(struct ss_priv *ssp)
 }
 
 
-static void ss_rx_refill(struct net_device *netdev)
-{
-	struct ss_priv *ssp = netdev_priv(netdev);
-	int i;
-
-	for (i = 0; i < NUM_SKBS; i++) {
-		if (ssp->skb_table_virt[i] == 0)
-			refill_skb(netdev, i);
-	}
-}
-
-
-static irqreturn_t ss_interrupt(int irq, void *dev)
+/**
+ * Processes everything in the event queue.  Called with eq_lock held.
+ */
+static void ss_drain_events(struct net_device *netdev)
 {
-	struct net_device *netdev = (struct net_device *)dev;
 	struct ss_priv *ssp = netdev_priv(netdev);
+	struct pending *pending, *tx_done = NULL;
 	uint32_t ev;
 	unsigned int type, index;
 
@@ -397,10 +1513,23 @@ static irqreturn_t ss_interrupt(int irq, void *dev)
 		type  = (ev >> 16) & 0xFFFF;
 		index = (ev >>  0) & 0xFFFF;
 
+		/* Time stamps are taken as events are consumed */
+		if (ssp->tx_tstamp || ssp->rx_tstamp)
+			ssp->event_time = ktime_get_real();
+
 		switch (type) {
 
 		case EVENT_TX_END:
-			ss_tx_end(netdev, index);
+			if (index >= SS_BYPASS_FIRST) {
+				ss_bypass_tx_end(ssp, index);
+				break;
+			}
+
+			/* Batch up completions, retired below in one go */
+			pending = index_to_pending(ssp, index);
+			pending->tstamp = ssp->event_time;
+			pending->next = tx_done;
+			tx_done = pending;
 			break;
 
 		case EVENT_RX:
@@ -412,20 +1541,202 @@ static irqreturn_t ss_interrupt(int irq, void *dev)
 			break;
 
 		default:
-			dev_err(&ssp->pdev->dev,
+			dev_err(ssp->dev,
 				"unknown event type (type=%u, index=%u).\n",
 				type, index);
 		}
 	}
 
+	if (tx_done)
+		ss_tx_end(netdev, tx_done);
+
+	/* Pick up any control command results that have arrived */
+	seastar_cmd_poll(ssp);
+}
+
+
+/**
+ * Drains the event queue from the transmit path or the safety timer, so
+ * that completions are retired without waiting for the interrupt.  If
+ * someone else is already draining there is nothing to do.
+ */
+static void ss_tx_reclaim(struct net_device *netdev)
+{
+	struct ss_priv *ssp = netdev_priv(netdev);
+	unsigned long flags;
+
+	if (!spin_trylock_irqsave(&ssp->eq_lock, flags))
+		return;
+
+	ss_drain_events(netdev);
+	spin_unlock_irqrestore(&ssp->eq_lock, flags);
+}
+
+
+static void ss_reclaim_timer(unsigned long data)
+{
+	struct net_device *netdev = (struct net_device *)data;
+	struct ss_priv *ssp = netdev_priv(netdev);
+
+	ss_tx_reclaim(netdev);
+
+	/* Keep looking while transmits are outstanding */
+	if (ssp->tx_pending_free_count < NUM_NETDEV_TX_PENDINGS)
+		mod_timer(&ssp->reclaim_timer,
+			  jiffies + msecs_to_jiffies(tx_reclaim_ms));
+}
+
+
+irqreturn_t ss_interrupt(int irq, void *dev)
+{
+	struct net_device *netdev = (struct net_device *)dev;
+	struct ss_priv *ssp = netdev_priv(netdev);
+	unsigned long flags;
+
+	spin_lock_irqsave(&ssp->eq_lock, flags);
+	ss_drain_events(netdev);
+	spin_unlock_irqrestore(&ssp->eq_lock, flags);
+
 	return IRQ_HANDLED;
 }
 
 
+static int ss_set_rx_filter(struct net_device *netdev, void __user *arg)
+{
+	struct ss_priv *ssp = netdev_priv(netdev);
+	struct ss_rx_filter *filter = NULL, *old;
+	struct ss_rxfilter req;
+	unsigned int fsize;
+	int err;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (copy_from_user(&req, arg, sizeof(req)))
+		return -EFAULT;
+
+	if (req.len) {
+		if (req.len > BPF_MAXINSNS)
+			return -EINVAL;
+
+		fsize  = sizeof(struct sock_filter) * req.len;
+		filter = kmalloc(sizeof(*filter) + fsize, GFP_KERNEL);
+		if (!filter)
+			return -ENOMEM;
+
+		if (copy_from_user(filter->insns,
+				   (void __user *)(unsigned long)req.insns,
+				   fsize)) {
+			kfree(filter);
+			return -EFAULT;
+		}
+		filter->len = req.len;
+
+		err = sk_chk_filter(filter->insns, filter->len);
+		if (err) {
+			kfree(filter);
+			return err;
+		}
+	}
+
+	/* Serialized by the RTNL, which is held across ndo_do_ioctl */
+	old = ssp->rx_filter;
+	rcu_assign_pointer(ssp->rx_filter, filter);
+	ssp->rx_filter_passed  = 0;
+	ssp->rx_filter_dropped = 0;
+	ssp->rx_filter_counted = 0;
+
+	if (old) {
+		synchronize_rcu();
+		kfree(old);
+	}
+
+	return 0;
+}
+
+
+static int ss_get_rx_filter(struct net_device *netdev, void __user *arg)
+{
+	struct ss_priv *ssp = netdev_priv(netdev);
+	struct ss_rxfilter req;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	memset(&req, 0, sizeof(req));
+	req.len      = ssp->rx_filter ? ssp->rx_filter->len : 0;
+	req.passed   = ssp->rx_filter_passed;
+	req.dropped  = ssp->rx_filter_dropped;
+	req.counted  = ssp->rx_filter_counted;
+
+	if (copy_to_user(arg, &req, sizeof(req)))
+		return -EFAULT;
+
+	return 0;
+}
+
+
+/**
+ * Configures time stamping.  Stamps are taken by the driver from the
+ * host clock as the SeaStar is handed a datagram and as its events are
+ * consumed, so they are reported both as raw and as system time, and
+ * every received datagram can be stamped.
+ */
+static int ss_hwtstamp_ioctl(struct net_device *netdev, void __user *arg)
+{
+	struct ss_priv *ssp = netdev_priv(netdev);
+	struct hwtstamp_config config;
+
+	if (copy_from_user(&config, arg, sizeof(config)))
+		return -EFAULT;
+
+	/* Reserved for future extensions */
+	if (config.flags)
+		return -EINVAL;
+
+	switch (config.tx_type) {
+	case HWTSTAMP_TX_OFF:
+	case HWTSTAMP_TX_ON:
+		break;
+	default:
+		return -ERANGE;
+	}
+
+	if (config.rx_filter != HWTSTAMP_FILTER_NONE)
+		config.rx_filter = HWTSTAMP_FILTER_ALL;
+
+	ssp->tx_tstamp = (config.tx_type == HWTSTAMP_TX_ON);
+	ssp->rx_tstamp = (config.rx_filter == HWTSTAMP_FILTER_ALL);
+
+	return copy_to_user(arg, &config, sizeof(config)) ? -EFAULT : 0;
+}
+
+
+static int ss_ioctl(struct net_device *netdev, struct ifreq *ifr, int cmd)
+{
+	switch (cmd) {
+
+	case SIOCSHWTSTAMP:
+		return ss_hwtstamp_ioctl(netdev, ifr->ifr_data);
+
+	case SIOCSSSRXFILTER:
+		return ss_set_rx_filter(netdev, ifr->ifr_data);
+
+	case SIOCGSSRXFILTER:
+		return ss_get_rx_filter(netdev, ifr->ifr_data);
+
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+
 static const struct net_device_ops ss_netdev_ops = {
 	.ndo_open		= ss_open,
 	.ndo_start_xmit		= ss_tx,
+	.ndo_select_queue	= ss_select_queue,
 	.ndo_set_mac_address	= eth_mac_addr,
+	.ndo_do_ioctl		= ss_ioctl,
 };
 
 
@@ -441,76 +1752,232 @@ static void ss_ht_irq_update(struct pci_dev *dev, int irq,
 }
 
 
-static int __devinit ss_probe(struct pci_dev *pdev,
-			      const struct pci_device_id *id)
+/**
+ * Carves the event queue, the firmware's upper pending table and the TX
+ * bounce slots out of one arena.  The SeaStar interrupt is always steered
+ * to APIC ID 0 (see seastar_setup_htb_bi()), so the arena is placed on
+ * the boot CPU's node.
+ */
+static int ss_alloc_host_memory(struct ss_priv *ssp)
+{
+	unsigned long size;
+	int err;
+
+	size = ALIGN(NUM_EQ_ENTRIES * sizeof(uint32_t), L1_CACHE_BYTES)
+	     + ALIGN(NUM_PENDINGS * FW_PENDING_SIZE, L1_CACHE_BYTES)
+	     + NUM_TX_PENDINGS * TX_BOUNCE_SIZE;
+
+	err = ss_arena_init(&ssp->arena, size, cpu_to_node(0),
+			    arena_hugepage);
+	if (err)
+		return err;
+
+	ssp->eq = ss_arena_alloc(&ssp->arena,
+			NUM_EQ_ENTRIES * sizeof(uint32_t), L1_CACHE_BYTES);
+	ssp->fw_pending_table = ss_arena_alloc(&ssp->arena,
+			NUM_PENDINGS * FW_PENDING_SIZE, L1_CACHE_BYTES);
+	ssp->bounce_slots = ss_arena_alloc(&ssp->arena,
+			NUM_TX_PENDINGS * TX_BOUNCE_SIZE, L1_CACHE_BYTES);
+
+	dev_info(ssp->dev, "%lu KB host arena on node %d\n",
+		 ssp->arena.size >> 10, ssp->arena.node);
+
+	return 0;
+}
+
+
+/**
+ * Allocates and initializes a SeaStar netdev whose hardware structures
+ * are described by hw, along with its host arena, so the event queue
+ * exists before the interrupt is hooked up.  The caller then calls
+ * ss_register(), and frees the netdev with ss_free_netdev().
+ */
+struct net_device *ss_alloc_netdev(struct device *dev, const struct ss_hw *hw)
 {
 	struct net_device *netdev;
 	struct ss_priv *ssp;
-	int i, irq, err = 0;
-
-	err = pci_enable_device(pdev);
-	if (err != 0) {
-		dev_err(&pdev->dev, "Could not enable PCI device.\n");
-		return -ENODEV;
-	}
+	int i;
 
-	netdev = alloc_etherdev(sizeof(*ssp));
-	if (netdev == NULL) {
-		dev_err(&pdev->dev, "Could not allocate ethernet device.\n");
-		return -ENOMEM;
-	}
+	netdev = alloc_etherdev_mq(sizeof(*ssp), NUM_TX_LANES);
+	if (netdev == NULL)
+		return NULL;
 
-	SET_NETDEV_DEV(netdev, &pdev->dev);
+	SET_NETDEV_DEV(netdev, dev);
 
-	strcpy(netdev->name, "ss");
+	strcpy(netdev->name, "ss%d");
 	netdev->netdev_ops	= &ss_netdev_ops;
 	netdev->header_ops	= &ss_header_ops;
 	netdev->mtu		= 16000;
 	netdev->flags		= IFF_NOARP;
+	netdev->priv_flags	|= IFF_SEASTAR;
+	if (csum_elide)
+		netdev->features |= NETIF_F_IP_CSUM;
 
 	/* Setup private state */
 	ssp = netdev_priv(netdev);
 	memset(ssp, 0, sizeof(*ssp));
 
 	spin_lock_init(&ssp->lock);
-	ssp->skb_table_phys	= seastar_skb;
+	spin_lock_init(&ssp->eq_lock);
+	setup_timer(&ssp->reclaim_timer, ss_reclaim_timer, (unsigned long)netdev);
+	ssp->hw			= *hw;
+	ssp->skb_table_phys	= hw->skb_table;
 	ssp->eq_read		= 0;
-	ssp->pdev		= pdev;
-
-	/* Build the TX pending free list */
+	ssp->dev		= dev;
+	ssp->netdev		= netdev;
+	INIT_DELAYED_WORK(&ssp->rx_refill_work, ss_rx_refill_work);
+	mutex_init(&ssp->rx_refill_mutex);
+	INIT_LIST_HEAD(&ssp->nid_active);
+	skb_queue_head_init(&ssp->tstamp_queue);
+	tasklet_init(&ssp->tstamp_tasklet, ss_tstamp_tasklet,
+		     (unsigned long)ssp);
+
+	for (i = 0; i < NUM_TX_LANES; i++)
+		tx_limit_init(&ssp->tx_lane[i].limit);
+
+	/* Build the TX pending free list, less the bypass channel's slice */
 	ssp->tx_pending_free_list = 0;
-	for (i = 0; i < NUM_TX_PENDINGS; i++)
+	for (i = 0; i < NUM_NETDEV_TX_PENDINGS; i++)
 		free_tx_pending(ssp, index_to_pending(ssp, i));
 
-	irq = __ht_create_irq(pdev, 0, ss_ht_irq_update);
-	if (irq < 0) {
-		dev_err(&pdev->dev, "__ht_create_irq() failed, err=%d.\n", err);
-		goto err_out;
+	if (ss_alloc_host_memory(ssp)) {
+		dev_err(dev, "ss_alloc_host_memory() failed.\n");
+		free_netdev(netdev);
+		return NULL;
 	}
 
-	err = request_irq(irq, ss_interrupt, IRQF_NOBALANCING,
-			  "seastar", netdev);
+	return netdev;
+}
+
+
+/**
+ * Undoes ss_alloc_netdev().  The interrupt must be gone by now.
+ */
+void ss_free_netdev(struct net_device *netdev)
+{
+	struct ss_priv *ssp = netdev_priv(netdev);
+
+	tasklet_kill(&ssp->tstamp_tasklet);
+	skb_queue_purge(&ssp->tstamp_queue);
+	ss_arena_free(&ssp->arena);
+	free_netdev(netdev);
+}
+
+
+/**
+ * Brings up the firmware and registers the netdev with the stack.
+ */
+int ss_register(struct net_device *netdev)
+{
+	struct ss_priv *ssp = netdev_priv(netdev);
+	int err;
+
+	err = seastar_hw_init(ssp);
 	if (err != 0) {
-		dev_err(&pdev->dev, "request_irq() failed, err=%d.\n", err);
+		dev_err(ssp->dev, "seastar_hw_init() failed, err=%d.\n", err);
 		goto err_out;
 	}
 
-	err = seastar_hw_init(netdev_priv(netdev));
+	/* Default the MAC address to our NID, lo_mac 0 */
+	if (is_zero_ether_addr(netdev->dev_addr))
+		*(__be32 *)netdev->dev_addr = htonl(ssp->hw.niccb->local_nid);
+
+	err = register_netdev(netdev);
 	if (err != 0) {
-		dev_err(&pdev->dev, "seastar_hw_init() failed, err=%d.\n", err);
+		dev_err(ssp->dev, "register_netdev() failed, err=%d.\n", err);
 		goto err_out;
 	}
 
-	err = register_netdev(netdev);
+	err = ss_bypass_register(ssp);
 	if (err != 0) {
-		dev_err(&pdev->dev, "register_netdev() failed, err=%d.\n", err);
+		dev_err(ssp->dev, "ss_bypass_register() failed, err=%d.\n",
+			err);
+		unregister_netdev(netdev);
 		goto err_out;
 	}
 
 	return 0;
 
 err_out:
-	free_netdev(netdev);
+	seastar_cmd_cleanup(ssp);
+	return err;
+}
+
+
+/**
+ * Undoes ss_register().  The caller frees the netdev.
+ */
+void ss_unregister(struct net_device *netdev)
+{
+	struct ss_priv *ssp = netdev_priv(netdev);
+
+	ss_bypass_unregister(ssp);
+	unregister_netdev(netdev);
+	ss_tx_purge(ssp);
+	cancel_delayed_work_sync(&ssp->rx_refill_work);
+	synchronize_rcu();
+	kfree(ssp->rx_filter);
+	seastar_cmd_cleanup(ssp);
+}
+
+
+static int __devinit ss_probe(struct pci_dev *pdev,
+			      const struct pci_device_id *id)
+{
+	struct net_device *netdev;
+	struct ss_hw hw = {
+		.mailbox	= seastar_mailbox,
+		.skb_table	= seastar_skb,
+		.niccb		= niccb,
+		.htb_map	= htb_map,
+		.tx_source	= tx_source,
+	};
+	int irq, err = 0;
+
+	err = pci_enable_device(pdev);
+	if (err != 0) {
+		dev_err(&pdev->dev, "Could not enable PCI device.\n");
+		return -ENODEV;
+	}
+
+	netdev = ss_alloc_netdev(&pdev->dev, &hw);
+	if (netdev == NULL) {
+		dev_err(&pdev->dev, "Could not allocate ethernet device.\n");
+		err = -ENOMEM;
+		goto err_disable;
+	}
+
+	irq = __ht_create_irq(pdev, 0, ss_ht_irq_update);
+	if (irq < 0) {
+		err = irq;
+		dev_err(&pdev->dev, "__ht_create_irq() failed, err=%d.\n", err);
+		goto err_free;
+	}
+	netdev->irq = irq;
+
+	err = request_irq(irq, ss_interrupt, IRQF_NOBALANCING,
+			  "seastar", netdev);
+	if (err != 0) {
+		dev_err(&pdev->dev, "request_irq() failed, err=%d.\n", err);
+		goto err_destroy_irq;
+	}
+
+	err = ss_register(netdev);
+	if (err != 0)
+		goto err_free_irq;
+
+	pci_set_drvdata(pdev, netdev);
+
+	return 0;
+
+err_free_irq:
+	free_irq(irq, netdev);
+err_destroy_irq:
+	ht_destroy_irq(irq);
+err_free:
+	ss_free_netdev(netdev);
+err_disable:
+	pci_disable_device(pdev);
 	return err;
 }
 
@@ -519,8 +1986,10 @@ static void __devexit ss_remove(struct pci_dev *pdev)
 {
 	struct net_device *netdev = pci_get_drvdata(pdev);
 
-	unregister_netdev(netdev);
-	free_netdev(netdev);
+	ss_unregister(netdev);
+	free_irq(netdev->irq, netdev);
+	ht_destroy_irq(netdev->irq);
+	ss_free_netdev(netdev);
 	pci_disable_device(pdev);
 }
 
@@ -545,15 +2014,35 @@ static struct pci_driver ss_driver = {
 
 static __init int ss_init_module(void)
 {
+	int err;
+
 	printk(KERN_INFO "%s: module loaded (version %s)\n",
 	       ss_driver.name, SEASTAR_VERSION_STR);
 
-	return pci_register_driver(&ss_driver);
+	err = pci_register_driver(&ss_driver);
+	if (err)
+		return err;
+
+	err = seastar_emu_init();
+	if (err) {
+		pci_unregister_driver(&ss_driver);
+		return err;
+	}
+
+	err = seastar_bench_init();
+	if (err) {
+		seastar_emu_exit();
+		pci_unregister_driver(&ss_driver);
+	}
+
+	return err;
 }
 
 
 static __exit void ss_cleanup_module(void)
 {
+	seastar_bench_exit();
+	seastar_emu_exit();
 	pci_unregister_driver(&ss_driver);
 }
 
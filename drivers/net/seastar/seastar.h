@@ -49,18 +49,116 @@
 #define NUM_PENDINGS		(NUM_TX_PENDINGS + NUM_RX_PENDINGS)
 
 
+/**
+ * TX pendings at the top of the range are set aside for the kernel bypass
+ * channel; the netdev uses the rest.
+ */
+#ifdef CONFIG_SEASTAR_BYPASS
+#define SS_BYPASS_PENDINGS	16
+#else
+#define SS_BYPASS_PENDINGS	0
+#endif
+#define SS_BYPASS_FIRST		(NUM_TX_PENDINGS - SS_BYPASS_PENDINGS)
+#define NUM_NETDEV_TX_PENDINGS	SS_BYPASS_FIRST
+
+
 /**
  * Number of entries in the SeaStar -> Host event queue.
  */
 #define NUM_EQ_ENTRIES		1024
 
 
+/**
+ * Size of each per-pending transmit bounce slot.  Must hold the largest
+ * frame the netdev can send (netdev->mtu plus the link header).
+ */
+#define TX_BOUNCE_SIZE		16384
+
+
 /**
  * When allocating an SKB, allocate this many bytes extra.
  */
 #define SKB_PAD			(16 - sizeof(struct sshdr))
 
 
+/**
+ * Number of control commands that may be awaiting a result at once.
+ */
+#define SEASTAR_CMD_SLOTS	8
+
+
+/**
+ * How often, in jiffies, to poll the result queue while a control command
+ * is outstanding, and how long to wait for a result before giving up.
+ */
+#define SEASTAR_CMD_POLL_INTERVAL	1
+#define SEASTAR_CMD_TIMEOUT		(5 * HZ)
+
+
+/**
+ * Control command slot.
+ * Tracks one outstanding control command until its result arrives.
+ * Slots are indexed by the command's tag modulo SEASTAR_CMD_SLOTS.
+ */
+struct seastar_cmd_slot {
+	struct completion	done;
+	uint32_t		result;
+	int			busy;
+	int			abandoned;
+};
+
+
+/**
+ * Longest delay, in jiffies, between retries of a failed RX refill.
+ */
+#define RX_REFILL_MAX_BACKOFF	HZ
+
+
+/**
+ * Transmit lanes, one netdev TX queue each.  The latency lane has a small
+ * reserved budget of pendings and is never held up by bulk traffic.
+ */
+#define TX_LANE_LATENCY		0
+#define TX_LANE_BULK		1
+#define NUM_TX_LANES		2
+
+
+/**
+ * How long, in jiffies, the TX byte limit must have been unused before
+ * the unused portion is given back.
+ */
+#define TX_LIMIT_SLACK_HOLD	HZ
+
+
+/**
+ * Number of buckets, as a power of two, in the per-NID queue hash.
+ */
+#define NID_HASH_BITS		8
+
+
+/**
+ * How long, in jiffies, a per-NID queue must have been idle before it is
+ * freed.
+ */
+#define NID_QUEUE_IDLE		(10 * HZ)
+
+
+/**
+ * Per-destination transmit queue.  Datagrams wait here until their NID
+ * is below its share of the TX pendings and its turn comes round in the
+ * deficit round robin.
+ */
+struct ss_nid_queue {
+	struct hlist_node	hash;
+	struct list_head	active;
+	uint32_t		nid;
+	unsigned int		inflight;
+	int			deficit;
+	unsigned long		last_used;
+	struct sk_buff_head	queue[NUM_TX_LANES];
+};
+
+
 /**
  * Pending structure.
  * One of these is used to track each in progress transmit.
@@ -69,6 +167,79 @@ struct pending {
 	struct sk_buff		*skb;
 	struct pending		*next;
 	void			*bounce;
+	unsigned int		len;
+	unsigned int		lane;
+	struct ss_nid_queue	*nq;
+	ktime_t			submitted;
+	ktime_t			tstamp;
+};
+
+
+/**
+ * Driver private skb->cb of a sent skb waiting for its submission and
+ * completion time stamps to be reported.
+ */
+struct ss_tx_cb {
+	ktime_t			submitted;
+	ktime_t			tstamp;
+};
+
+#define SS_TX_CB(skb)		((struct ss_tx_cb *)(skb)->cb)
+
+
+/**
+ * Dynamic limit on the number of bytes handed to the SeaStar for
+ * transmit but not yet completed.  Keeps just enough data inside the
+ * NIC to keep the link busy; the rest waits in the qdisc.
+ */
+struct tx_limit {
+	unsigned int		limit;
+	unsigned int		inflight;
+	unsigned int		lowest_slack;
+	unsigned long		slack_start;
+	int			stopped;
+};
+
+
+/**
+ * Per-lane transmit state.
+ */
+struct tx_lane {
+	unsigned int		inuse;
+	unsigned int		backlog;
+	struct tx_limit		limit;
+};
+
+
+/**
+ * Arena of physically contiguous host memory that the SeaStar can see
+ * through its host window.  Everything the firmware addresses through
+ * the window is carved out of it at probe time.
+ */
+struct ss_arena {
+	void			*base;
+	unsigned long		size;
+	unsigned long		used;
+	unsigned int		order;
+	int			node;
+};
+
+
+/**
+ * Where the SeaStar's host-visible structures live.  For real hardware
+ * these point into the SeaStar memory mapped at SEASTAR_VIRT_BASE; a
+ * software backend points them at host memory instead.
+ */
+struct ss_hw {
+	struct mailbox		*mailbox;
+	volatile uint64_t	*skb_table;
+	volatile struct niccb	*niccb;
+	volatile uint32_t	*htb_map;
+	volatile uint16_t	*tx_source;
+
+	/* Called after commands are posted, NULL if the firmware polls */
+	void			(*kick)(struct ss_priv *ssp);
+	void			*priv;
 };
 
 
@@ -78,23 +249,234 @@ struct pending {
 struct ss_priv {
 	spinlock_t		lock;
 
+	struct ss_hw		hw;
 	unsigned long		host_region_phys;
 
 	volatile uint64_t	*skb_table_phys;
 	struct sk_buff		*skb_table_virt[NUM_SKBS];
+	DECLARE_BITMAP(rx_empty, NUM_SKBS);
+	atomic_t		rx_posted;
+	struct delayed_work	rx_refill_work;
+	struct mutex		rx_refill_mutex;
+	unsigned long		rx_refill_backoff;
+
+	struct ss_rx_filter	*rx_filter;
+	struct ss_bypass_port	*bypass_port;
+	uint64_t		rx_filter_passed;
+	uint64_t		rx_filter_dropped;
+	uint64_t		rx_filter_counted;
+
+	unsigned int		tx_csum_count;
+
+	int			tx_tstamp;
+	int			rx_tstamp;
+	ktime_t			event_time;
+	struct sk_buff_head	tstamp_queue;
+	struct tasklet_struct	tstamp_tasklet;
+
+	struct ss_arena		arena;
 
 	struct pending		pending_table[NUM_PENDINGS];
+	void			*fw_pending_table;
+	void			*bounce_slots;
 	struct pending		*tx_pending_free_list;
+	unsigned int		tx_pending_free_count;
+	struct tx_lane		tx_lane[NUM_TX_LANES];
+	struct hlist_head	nid_hash[1 << NID_HASH_BITS];
+	struct list_head	nid_active;
+	unsigned int		nid_active_count;
 
-	uint32_t		eq[NUM_EQ_ENTRIES];
+	uint32_t		*eq;
 	unsigned int		eq_read;
+	spinlock_t		eq_lock;
+	struct timer_list	reclaim_timer;
 
 	struct mailbox		*mailbox;
 	unsigned int		mailbox_cached_read;
 	unsigned int		mailbox_cached_write;
 
-	struct pci_dev		*pdev;
+	struct seastar_cmd_slot	cmd_slots[SEASTAR_CMD_SLOTS];
+	unsigned int		cmd_next_tag;
+	unsigned int		cmd_done_tag;
+	struct timer_list	cmd_timer;
+
+	struct device		*dev;
+	struct net_device	*netdev;
 };
 
 
+extern void
+ss_tx_restart(
+	struct ss_priv		*ssp
+);
+
+
+extern struct net_device *
+ss_alloc_netdev(
+	struct device		*dev,
+	const struct ss_hw	*hw
+);
+
+
+extern void
+ss_free_netdev(
+	struct net_device	*netdev
+);
+
+
+extern int
+ss_register(
+	struct net_device	*netdev
+);
+
+
+extern void
+ss_unregister(
+	struct net_device	*netdev
+);
+
+
+extern irqreturn_t
+ss_interrupt(
+	int			irq,
+	void			*dev
+);
+
+
+extern int
+ss_arena_init(
+	struct ss_arena		*arena,
+	unsigned long		size,
+	int			node,
+	int			huge
+);
+
+
+extern void *
+ss_arena_alloc(
+	struct ss_arena		*arena,
+	unsigned long		size,
+	unsigned long		align
+);
+
+
+extern void
+ss_arena_free(
+	struct ss_arena		*arena
+);
+
+
+#ifdef CONFIG_SEASTAR_BYPASS
+extern int
+ss_bypass_register(
+	struct ss_priv		*ssp
+);
+
+extern void
+ss_bypass_unregister(
+	struct ss_priv		*ssp
+);
+
+extern void
+ss_bypass_tx_end(
+	struct ss_priv		*ssp,
+	unsigned int		index
+);
+
+extern void
+ss_bypass_rx(
+	struct ss_priv		*ssp,
+	const void		*data,
+	unsigned int		len
+);
+#else
+static inline int ss_bypass_register(struct ss_priv *ssp) { return 0; }
+static inline void ss_bypass_unregister(struct ss_priv *ssp) { }
+static inline void ss_bypass_tx_end(struct ss_priv *ssp, unsigned int index) { }
+static inline void ss_bypass_rx(struct ss_priv *ssp, const void *data,
+				unsigned int len) { }
+#endif
+
+
+#ifdef CONFIG_SEASTAR_EMU
+extern int
+seastar_emu_init(void);
+
+extern void
+seastar_emu_exit(void);
+#else
+static inline int seastar_emu_init(void) { return 0; }
+static inline void seastar_emu_exit(void) { }
+#endif
+
+
+/**
+ * Fast path helpers private to main.c, except to the microbenchmarks.
+ */
+#ifdef CONFIG_SEASTAR_BENCH
+#define SS_BENCH_STATIC
+
+extern struct pending *
+alloc_tx_pending(
+	struct ss_priv		*ssp
+);
+
+
+extern void
+free_tx_pending(
+	struct ss_priv		*ssp,
+	struct pending		*pending
+);
+
+
+extern int
+eth2ss(
+	struct ss_priv		*ssp,
+	struct sk_buff		*skb
+);
+
+
+extern int
+ss2eth(
+	struct sk_buff		*skb
+);
+
+
+extern int
+ss_header_create(
+	struct sk_buff		*skb,
+	struct net_device	*netdev,
+	unsigned short		type,
+	const void		*daddr,
+	const void		*saddr,
+	unsigned int		length
+);
+
+
+extern int
+ss_tx(
+	struct sk_buff		*skb,
+	struct net_device	*netdev
+);
+
+
+extern void
+ss_tx_purge(
+	struct ss_priv		*ssp
+);
+
+
+extern int
+seastar_bench_init(void);
+
+extern void
+seastar_bench_exit(void);
+#else
+#define SS_BENCH_STATIC		static
+
+static inline int seastar_bench_init(void) { return 0; }
+static inline void seastar_bench_exit(void) { }
+#endif
+
+
 #endif
@@ -607,6 +607,7 @@ static int nfs_create_rpc_client(struct nfs_client *clp,
 		.program	= &nfs_program,
 		.version	= clp->rpc_ops->version,
 		.authflavor	= flavor,
+		.nconnect	= clp->cl_nconnect,
 	};
 
 	if (discrtry)
@@ -750,6 +751,9 @@ static int nfs_init_client(struct nfs_client *clp,
 		return 0;
 	}
 
+	/* Spread calls over several transports (v2/v3 only) */
+	clp->cl_nconnect = data->nconnect;
+
 	/*
 	 * Create a client RPC handle for doing FSSTAT with UNIX auth only
 	 * - RFC 2623, sec 2.3.2
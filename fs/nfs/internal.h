@@ -70,6 +70,7 @@ struct nfs_parsed_mount_data {
 	char			*client_address;
 	unsigned int		version;
 	unsigned int		minorversion;
+	unsigned int		nconnect;
 	char			*fscache_uniq;
 
 	struct {
@@ -324,6 +324,26 @@ nfs3_xdr_accessargs(struct rpc_rqst *req, __be32 *p, struct nfs3_accessargs *arg
 	return 0;
 }
 
+/*
+ * Tell the transport how long the header of a READ reply is, so that
+ * it can realign the page data while the reply is still arriving.
+ * Returns a negative value if the reply carries no data.
+ */
+static int
+nfs3_xdr_readres_hdrlen(struct rpc_rqst *req, __be32 *p, __be32 *end)
+{
+	__be32 *start = p;
+
+	if (end - p < 2 || *p++ != htonl(NFS_OK))
+		return -1;
+	if (*p++ != xdr_zero)
+		p += NFS3_fattr_sz;
+	p += 3;
+	if (p > end)
+		return -1;
+	return (p - start) << 2;
+}
+
 /*
  * Arguments to a READ call. Since we read data directly into the page
  * cache, we also set up the reply iovec here so that iov[1] points
@@ -346,6 +366,9 @@ nfs3_xdr_readargs(struct rpc_rqst *req, __be32 *p, struct nfs_readargs *args)
 	xdr_inline_pages(&req->rq_rcv_buf, replen,
 			 args->pages, args->pgbase, count);
 	req->rq_rcv_buf.flags |= XDRBUF_READ;
+	/* Integrity and privacy wrap the reply body, so only plain flavors */
+	if (auth->au_flavor == RPC_AUTH_UNIX || auth->au_flavor == RPC_AUTH_NULL)
+		req->rq_rcv_hdrlen = nfs3_xdr_readres_hdrlen;
 	return 0;
 }
 
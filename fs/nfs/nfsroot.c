@@ -6,6 +6,8 @@
  *     (2) Handle RPC negotiation with the system which replied to RARP or
  *         was reported as a boot server by BOOTP or manually.
  *     (3) The actual mounting is done later, when init() is running.
+ *         The RPC negotiation of (2) is started as soon as (1) is done
+ *         and overlaps the rest of the boot.
  *
  *
  *	Changes:
@@ -73,6 +75,7 @@
 #include <linux/time.h>
 #include <linux/fs.h>
 #include <linux/init.h>
+#include <linux/async.h>
 #include <linux/sunrpc/clnt.h>
 #include <linux/sunrpc/xprtsock.h>
 #include <linux/nfs.h>
@@ -112,6 +115,11 @@ static struct nfs_mount_data nfs_data __initdata = { 0, };/* NFS mount info */
 static int nfs_port __initdata = 0;		/* Port to connect to for NFS */
 static int mount_port __initdata = 0;		/* Mount daemon port number */
 
+/* Early start of the mount protocol exchange */
+static async_cookie_t nfs_root_cookie __initdata;
+static int nfs_root_started __initdata = 0;
+static int nfs_root_status __initdata = 0;
+
 
 /***************************************************************************
 
@@ -518,15 +526,51 @@ static int __init root_nfs_get_handle(void)
 }
 
 /*
- *  Get the NFS port numbers and file handle, and return the prepared 'data'
- *  argument for mount() if everything went OK. Return NULL otherwise.
+ *  Get the NFS port numbers and file handle.
  */
-void * __init nfs_root_data(void)
+static int __init root_nfs_setup(void)
 {
 	if (root_nfs_init() < 0
 	 || root_nfs_ports() < 0
 	 || root_nfs_get_handle() < 0)
-		return NULL;
+		return -1;
 	set_sockaddr((struct sockaddr_in *) &nfs_data.addr, servaddr, htons(nfs_port));
+	return 0;
+}
+
+static void __init root_nfs_setup_async(void *data, async_cookie_t cookie)
+{
+	nfs_root_status = root_nfs_setup();
+}
+
+/*
+ *  The exchange with the server only needs the IP configuration, which
+ *  ip_auto_config() has finished by now.  When nfsroot= was given, run it
+ *  alongside the rest of the boot instead of after it; init waits for all
+ *  async work before freeing init memory.
+ */
+static int __init root_nfs_start(void)
+{
+	/* root= is only looked at after the initcalls, ROOT_DEV is no guide */
+	if (!nfs_root_name[0])
+		return 0;
+	nfs_root_cookie = async_schedule(root_nfs_setup_async, NULL);
+	nfs_root_started = 1;
+	return 0;
+}
+late_initcall_sync(root_nfs_start);
+
+/*
+ *  Return the prepared 'data' argument for mount() if everything went OK.
+ *  Return NULL otherwise.
+ */
+void * __init nfs_root_data(void)
+{
+	if (nfs_root_started)
+		async_synchronize_cookie(nfs_root_cookie + 1);
+	else
+		nfs_root_status = root_nfs_setup();
+	if (nfs_root_status < 0)
+		return NULL;
 	return (void*)&nfs_data;
 }
@@ -93,6 +93,7 @@ enum {
 	Opt_mountvers,
 	Opt_nfsvers,
 	Opt_minorversion,
+	Opt_nconnect,
 
 	/* Mount options that take string arguments */
 	Opt_sec, Opt_proto, Opt_mountproto, Opt_mounthost,
@@ -160,6 +161,7 @@ static const match_table_t nfs_mount_option_tokens = {
 	{ Opt_nfsvers, "nfsvers=%s" },
 	{ Opt_nfsvers, "vers=%s" },
 	{ Opt_minorversion, "minorversion=%s" },
+	{ Opt_nconnect, "nconnect=%s" },
 
 	{ Opt_sec, "sec=%s" },
 	{ Opt_proto, "proto=%s" },
@@ -588,6 +590,8 @@ static void nfs_show_mount_options(struct seq_file *m, struct nfs_server *nfss,
 
 	seq_printf(m, ",timeo=%lu", 10U * nfss->client->cl_timeout->to_initval / HZ);
 	seq_printf(m, ",retrans=%u", nfss->client->cl_timeout->to_retries);
+	if (clp->cl_nconnect > 1)
+		seq_printf(m, ",nconnect=%u", clp->cl_nconnect);
 	seq_printf(m, ",sec=%s", nfs_pseudoflavour_to_name(nfss->client->cl_auth->au_flavor));
 
 	if (version != 4)
@@ -1127,6 +1131,16 @@ static int nfs_parse_mount_options(char *raw,
 				goto out_invalid_value;
 			mnt->namlen = option;
 			break;
+		case Opt_nconnect:
+			string = match_strdup(args);
+			if (string == NULL)
+				goto out_nomem;
+			rc = strict_strtoul(string, 10, &option);
+			kfree(string);
+			if (rc != 0 || option < 1 || option > RPC_MAX_NCONNECT)
+				goto out_invalid_value;
+			mnt->nconnect = option;
+			break;
 		case Opt_mountport:
 			string = match_strdup(args);
 			if (string == NULL)
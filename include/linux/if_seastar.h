@@ -0,0 +1,192 @@
+/*
+ *  Cray SeaStar native interface definitions.
+ *  Copyright (C) 2009 Cray Inc. and Sandia National Laboratories
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#ifndef _LINUX_IF_SEASTAR_H
+#define _LINUX_IF_SEASTAR_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#include <linux/sockios.h>
+
+/*
+ * Private ioctls on SeaStar interfaces, passed a pointer in ifr_data.
+ */
+#define SIOCSSSRXFILTER		(SIOCDEVPRIVATE + 0)	/* set RX filter */
+#define SIOCGSSRXFILTER		(SIOCDEVPRIVATE + 1)	/* get counters */
+
+/*
+ * Early receive filter.
+ *
+ * A classic BPF program run against each received datagram before any
+ * skb processing, with the data starting at the 4 byte SeaStar header
+ * and the IP header following it.  The program's return value is the
+ * verdict: SS_RXFILTER_DROP discards the datagram and returns its buffer
+ * to the NIC, SS_RXFILTER_COUNT counts it and passes it up, and any other
+ * value passes it up.  Setting a filter with len 0 detaches it.
+ *
+ * insns is the address of len struct sock_filter instructions, cast to
+ * __u64 so that 32 and 64 bit callers share one layout.
+ */
+#define SS_RXFILTER_DROP	0
+#define SS_RXFILTER_COUNT	1
+
+struct ss_rxfilter {
+	__u64			insns;		/* SIOCSSSRXFILTER */
+	__u32			len;
+	__u32			pad;
+	__u64			passed;		/* SIOCGSSRXFILTER */
+	__u64			dropped;
+	__u64			counted;
+};
+
+/*
+ * Pre-built SeaStar datagrams.
+ *
+ * An skb of protocol ETH_P_SEASTAR handed to a SeaStar interface starts
+ * with a struct ss_raw_hdr.  The driver takes the destination NID from it
+ * and sends the rest, the datagram proper, without modifying the skb, so
+ * the same skb may be transmitted any number of times.  length must be
+ * the datagram's size in quad bytes, less one.
+ *
+ * Received datagrams of type SS_TYPE_RAW are passed up as ETH_P_SEASTAR
+ * with the data starting at length; the NID is not known on receive.
+ */
+#define ETH_P_SEASTAR		0x88B5	/* local experimental ethertype 1 */
+
+#define SS_HDR_TYPE(type)	((2 << 5) | (type))	/* datagram */
+#define SS_TYPE_IP		0
+#define SS_TYPE_RAW		1
+#define SS_TYPE_BYPASS		2
+#define SS_TYPE_RDS		3
+#define SS_TYPE_9P		4
+#define SS_TYPE_TIPC		5
+#define SS_TYPE_AOE		6
+#define SS_TYPE_IP_CSUM		7
+#define SS_TYPE_IP_NOCSUM	8
+
+struct ss_raw_hdr {
+	__be32			nid;		/* transmit only */
+	__u16			length;
+	__u8			lo_macs;	/* source << 4 | destination */
+	__u8			hdr_type;
+};
+
+/*
+ * Native protocols.
+ *
+ * Frames of these ethertypes are carried with the 4 byte SeaStar header
+ * in place of the ethernet header, like IPv4, each as its own SeaStar
+ * header type, and are passed up with the ethertype they were sent with.
+ * The destination NID and lo_mac come from the destination MAC address.
+ */
+#define ETH_P_SEASTAR_RDS	0x88B6	/* local experimental ethertype 2 */
+#define ETH_P_SEASTAR_9P	0x00FE	/* pseudo type, never on an ethernet */
+/* ETH_P_TIPC is carried as SS_TYPE_TIPC, ETH_P_AOE as SS_TYPE_AOE */
+
+/*
+ * Checksum elision.
+ *
+ * The fabric delivers datagrams intact, so a SeaStar interface may send
+ * whole IPv4 TCP and UDP datagrams without computing their checksums, as
+ * SS_TYPE_IP_NOCSUM.  The receiver passes them up as ETH_P_IP with the
+ * checksum marked as not yet computed, so local delivery skips it and a
+ * node forwarding the datagram off the fabric fills it in.  One in
+ * csum_sample such datagrams is checksummed anyway and sent as
+ * SS_TYPE_IP_CSUM, which the receiver verifies before passing it up;
+ * mismatches are counted as rx_crc_errors and dropped.
+ */
+
+/*
+ * Kernel bypass datagram channel, /dev/<ifname>-bypass.
+ *
+ * The device is bound with SSBYPASS_BIND to a virtual host (lo_mac) and a
+ * range of destination NIDs, and mmap()ed whole: a struct ss_bypass_ring
+ * followed by the TX buffer area and the RX slots, at the offsets given by
+ * SSBYPASS_INFO.  All ring indices are free running and taken modulo the
+ * ring size.
+ *
+ * To send, fill a struct ss_bypass_tx_desc pointing into the TX buffer
+ * area and advance tx_head.  The driver picks the descriptor up after its
+ * poll timer, a send completing or SSBYPASS_KICK, copies the payload out,
+ * checks the destination and sends it as a datagram of type
+ * SS_TYPE_BYPASS from the bound lo_mac.  Each descriptor completes with
+ * one struct ss_bypass_cqe carrying its cookie.
+ *
+ * Datagrams of type SS_TYPE_BYPASS to the bound lo_mac are copied into
+ * the next RX slot and described in rx[]; rx_dropped counts those that
+ * found no free slot.  poll() reports POLLIN while completions or
+ * received datagrams are waiting.
+ */
+#define SS_BYPASS_TX_ENTRIES	256
+#define SS_BYPASS_CQ_ENTRIES	256
+#define SS_BYPASS_RX_ENTRIES	64
+
+struct ss_bypass_tx_desc {
+	__u32			nid;		/* destination */
+	__u32			offset;		/* into the TX buffer area */
+	__u16			len;
+	__u8			lo_mac;		/* destination virtual host */
+	__u8			pad;
+	__u32			cookie;		/* returned in the completion */
+};
+
+struct ss_bypass_cqe {
+	__u32			cookie;
+	__s32			status;		/* 0 or -errno */
+};
+
+struct ss_bypass_rx_desc {
+	__u32			offset;		/* into the mapping */
+	__u16			len;
+	__u8			lo_mac;		/* source virtual host */
+	__u8			pad;
+};
+
+struct ss_bypass_ring {
+	__u32			tx_head;	/* written by user space */
+	__u32			tx_tail;	/* written by the driver */
+	__u32			cq_head;	/* written by the driver */
+	__u32			cq_tail;	/* written by user space */
+	__u32			rx_head;	/* written by the driver */
+	__u32			rx_tail;	/* written by user space */
+	__u32			rx_dropped;
+	__u32			pad;
+	struct ss_bypass_tx_desc tx[SS_BYPASS_TX_ENTRIES];
+	struct ss_bypass_cqe	cq[SS_BYPASS_CQ_ENTRIES];
+	struct ss_bypass_rx_desc rx[SS_BYPASS_RX_ENTRIES];
+};
+
+struct ss_bypass_bind {
+	__u8			lo_mac;		/* our virtual host, 1-14 */
+	__u8			pad[3];
+	__u32			nid_min;	/* allowed destinations */
+	__u32			nid_max;
+};
+
+struct ss_bypass_info {
+	__u32			map_size;
+	__u32			tx_buf_offset;
+	__u32			tx_buf_size;
+	__u32			rx_buf_offset;
+	__u32			rx_slot_size;
+	__u32			max_len;	/* largest payload */
+	__u32			nid;		/* ours */
+};
+
+#define SSBYPASS_BIND		_IOW(0xB5, 0, struct ss_bypass_bind)
+#define SSBYPASS_INFO		_IOR(0xB5, 1, struct ss_bypass_info)
+#define SSBYPASS_KICK		_IO(0xB5, 2)
+
+#endif /* _LINUX_IF_SEASTAR_H */
@@ -27,6 +27,7 @@
 #define NBD_SET_SIZE_BLOCKS	_IO( 0xab, 7 )
 #define NBD_DISCONNECT  _IO( 0xab, 8 )
 #define NBD_SET_TIMEOUT _IO( 0xab, 9 )
+#define NBD_SET_CONNS	_IO( 0xab, 10 )
 
 enum {
 	NBD_CMD_READ = 0,
@@ -46,23 +47,38 @@ enum {
 #define NBD_READ_ONLY 0x0001
 #define NBD_WRITE_NOCHK 0x0002
 
+#define NBD_MAX_CONNS	8
+
 struct request;
+struct task_struct;
+struct nbd_device;
+
+/* One of the connections requests are striped across */
+struct nbd_sock {
+	struct nbd_device *lo;
+	struct socket * sock;
+	struct file * file;
+	struct request *active_req;	/* Request being sent */
+	struct mutex tx_lock;
+	struct task_struct *send_thread;
+	struct task_struct *recv_thread;
+};
 
 struct nbd_device {
 	int flags;
 	int harderror;		/* Code of hard error			*/
-	struct socket * sock;
-	struct file * file; 	/* If == NULL, device is not ready, yet	*/
+	struct nbd_sock socks[NBD_MAX_CONNS];
+	int nconns;		/* Connections wanted, NBD_SET_CONNS	*/
+	int nsocks;		/* If == 0, device is not ready, yet	*/
 	int magic;
 
 	spinlock_t queue_lock;
 	struct list_head queue_head;	/* Requests waiting result */
-	struct request *active_req;
 	wait_queue_head_t active_wq;
 	struct list_head waiting_queue;	/* Requests to be sent */
 	wait_queue_head_t waiting_wq;
 
-	struct mutex tx_lock;
+	struct mutex tx_lock;	/* Serializes ioctls */
 	struct gendisk *disk;
 	int blksize;
 	u64 bytesize;
@@ -6,10 +6,11 @@
 /*
  * To change the maximum rsize and wsize supported by the NFS client, adjust
  * NFS_MAX_FILE_IO_SIZE.  64KB is a typical maximum, but some servers can
- * support a megabyte or more.  The default is left at 4096 bytes, which is
- * reasonable for NFS over UDP.
+ * support several megabytes, which pays off on high bandwidth fabrics.
+ * The server's FSINFO limits still apply.  The default is left at 4096
+ * bytes, which is reasonable for NFS over UDP.
  */
-#define NFS_MAX_FILE_IO_SIZE	(1048576U)
+#define NFS_MAX_FILE_IO_SIZE	(4U * 1048576U)
 #define NFS_DEF_FILE_IO_SIZE	(4096U)
 #define NFS_MIN_FILE_IO_SIZE	(1024U)
 
@@ -26,6 +26,11 @@
 
 struct rpc_inode;
 
+/*
+ * Most transports a client may spread its calls over (nconnect)
+ */
+#define RPC_MAX_NCONNECT	16
+
 /*
  * The high-level client handle
  */
@@ -35,6 +40,10 @@ struct rpc_clnt {
 	struct list_head	cl_tasks;	/* List of tasks */
 	spinlock_t		cl_lock;	/* spinlock */
 	struct rpc_xprt *	cl_xprt;	/* transport */
+	struct rpc_xprt *	cl_xprts[RPC_MAX_NCONNECT - 1];
+						/* more transports */
+	unsigned int		cl_nxprts;	/* entries in cl_xprts */
+	atomic_t		cl_xprt_next;	/* next transport to use */
 	struct rpc_procinfo *	cl_procinfo;	/* procedure info */
 	u32			cl_prog,	/* RPC program number */
 				cl_vers,	/* RPC version number */
@@ -115,6 +124,7 @@ struct rpc_create_args {
 	unsigned long		flags;
 	char			*client_name;
 	struct svc_xprt		*bc_xprt;	/* NFSv4.1 backchannel */
+	unsigned int		nconnect;	/* transports to open */
 };
 
 /* Values for "flags" field */
@@ -131,6 +141,7 @@ struct rpc_clnt	*rpc_bind_new_program(struct rpc_clnt *,
 struct rpc_clnt *rpc_clone_client(struct rpc_clnt *);
 void		rpc_shutdown_client(struct rpc_clnt *);
 void		rpc_release_client(struct rpc_clnt *);
+struct rpc_xprt	*rpc_clnt_next_xprt(struct rpc_clnt *);
 
 int		rpcb_register(u32, u32, int, unsigned short);
 int		rpcb_v4_register(const u32 program, const u32 version,
@@ -22,6 +22,7 @@
 #define RPC_MIN_SLOT_TABLE	(2U)
 #define RPC_DEF_SLOT_TABLE	(16U)
 #define RPC_MAX_SLOT_TABLE	(128U)
+#define RPC_MAX_SLOT_TABLE_LIMIT	(65536U)
 
 /*
  * This describes a timeout strategy
@@ -81,6 +82,13 @@ struct rpc_rqst {
 	struct xdr_buf		rq_private_buf;		/* The receive buffer
 							 * used in the softirq.
 							 */
+	int			(*rq_rcv_hdrlen)(struct rpc_rqst *,
+						 __be32 *, __be32 *);
+						/* Optional: length of the reply
+						   header in front of the page
+						   data, for early realignment */
+	unsigned int		rq_rcv_trimmed;	/* Bytes moved from head to
+						   pages by the transport */
 	unsigned long		rq_majortimeo;	/* major timeout alarm */
 	unsigned long		rq_timeout;	/* Current timeout value */
 	unsigned int		rq_retries;	/* # of retries */
@@ -165,7 +173,9 @@ struct rpc_xprt {
 	struct rpc_wait_queue	backlog;	/* waiting for slot */
 	struct list_head	free;		/* free slots */
 	struct rpc_rqst *	slot;		/* slot table storage */
-	unsigned int		max_reqs;	/* total slots */
+	unsigned int		max_reqs;	/* preallocated slots */
+	unsigned int		num_reqs;	/* slots currently allocated */
+	unsigned int		limit_reqs;	/* growth limit for num_reqs */
 	unsigned long		state;		/* transport state */
 	unsigned char		shutdown   : 1,	/* being shut down */
 				resvport   : 1; /* use a reserved port */
@@ -315,9 +325,12 @@ void			xprt_conditional_disconnect(struct rpc_xprt *xprt, unsigned int cookie);
 #define XPRT_CLOSING		(6)
 #define XPRT_CONNECTION_ABORT	(7)
 #define XPRT_CONNECTION_CLOSE	(8)
+#define XPRT_CONGESTED		(9)
 
 static inline void xprt_set_connected(struct rpc_xprt *xprt)
 {
+	/* A new connection starts with an empty send buffer */
+	clear_bit(XPRT_CONGESTED, &xprt->state);
 	set_bit(XPRT_CONNECTED, &xprt->state);
 }
 
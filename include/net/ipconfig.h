@@ -22,4 +22,5 @@ extern u8 root_server_path[];	/* Path to mount as root */
 #define IC_PROTO	0xFF	/* Protocols mask: */
 #define IC_BOOTP	0x01	/*   BOOTP (or DHCP, see below) */
 #define IC_RARP		0x02	/*   RARP */
+#define IC_NID		0x04	/*   SeaStar NID, no exchange */
 #define IC_USE_DHCP    0x100	/* If on, use DHCP instead of BOOTP */
@@ -48,6 +48,7 @@
  */
 
 #define TIPC_MEDIA_TYPE_ETH	1
+#define TIPC_MEDIA_TYPE_SEASTAR	2
 
 /* 
  * Destination address structure used by TIPC bearers when sending messages
@@ -61,6 +62,7 @@ struct tipc_media_addr {
 	__be32  type;			/* bearer type (network byte order) */
 	union {
 		__u8   eth_addr[6];	/* 48 bit Ethernet addr (byte array) */ 
+					/* also SeaStar NID and lo_mac */
 #if 0
 		/* Prototypes for other possible bearer types */
 
@@ -133,6 +135,14 @@ int tipc_disable_bearer(const char *name);
 int  tipc_eth_media_start(void);
 void tipc_eth_media_stop(void);
 
+#ifdef CONFIG_TIPC_SEASTAR
+int  tipc_ss_media_start(void);
+void tipc_ss_media_stop(void);
+#else
+static inline int tipc_ss_media_start(void) { return 0; }
+static inline void tipc_ss_media_stop(void) { }
+#endif
+
 #endif
 
 #endif
@@ -0,0 +1,675 @@
+/*
+ * linux/net/9p/trans_seastar.c
+ *
+ * 9P transport over native Cray SeaStar datagrams
+ *
+ *  Copyright (C) 2009 Cray Inc. and Sandia National Laboratories
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to:
+ *  Free Software Foundation
+ *  51 Franklin Street, Fifth Floor
+ *  Boston, MA  02111-1301  USA
+ *
+ */
+
+/*
+ * Each T-message is sent as one SeaStar datagram of header type
+ * SS_TYPE_9P to the server's NID, preceded by a struct p9_ss_hdr giving
+ * the address to reply to and the client's channel number.  The server
+ * answers each with one datagram carrying the R-message and the channel
+ * number it was given.  Replies are matched to their request by channel
+ * and tag and copied from the receive buffer straight into the request's
+ * reply buffer.
+ *
+ * There is no fragmentation: msize is bounded by the interface MTU, and
+ * by default is raised to it.  Mount with the server's NID as the device
+ * name:
+ *
+ *	mount -t 9p -o trans=seastar[,ssdev=<ifname>][,lomac=<n>] <nid> <dir>
+ *
+ * Datagrams may be dropped on the way, so a request still unanswered
+ * after timeo milliseconds is sent again with the same tag, and then
+ * every timeo milliseconds until its reply arrives, it is flushed, or
+ * the channel is closed.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/netdevice.h>
+#include <linux/if_arp.h>
+#include <linux/if_ether.h>
+#include <linux/if_seastar.h>
+#include <linux/skbuff.h>
+#include <linux/rculist.h>
+#include <linux/parser.h>
+#include <linux/delay.h>
+#include <linux/timer.h>
+#include <asm/unaligned.h>
+#include <net/9p/9p.h>
+#include <net/9p/client.h>
+#include <net/9p/transport.h>
+
+#define P9_SS_MAXSIZE	(64 * 1024)
+#define P9_SS_XMIT_MAX_DELAY	64U	/* ms */
+#define P9_SS_TIMEO	5000	/* ms */
+
+/**
+ * struct p9_ss_hdr - precedes each 9P message on the wire
+ * @nid: NID of the sender
+ * @chan: client channel number, echoed by the server
+ * @lo_mac: virtual host of the sender
+ * @pad: zero
+ *
+ */
+
+struct p9_ss_hdr {
+	__be32 nid;
+	__be16 chan;
+	u8 lo_mac;
+	u8 pad;
+} __attribute__((packed));
+
+/**
+ * struct p9_ss_chan - per-mount transport information
+ * @list: entry in p9_ss_chans
+ * @client: client instance
+ * @dev: SeaStar interface the channel is bound to
+ * @ha: hardware address of the server
+ * @id: channel number
+ * @lock: protects @fresh, @aged and the status of requests on them
+ * @fresh: requests sent since the last tick of @timer
+ * @aged: requests unanswered for at least one tick, resent on the next
+ * @timer: retransmission timer
+ * @timeo: retransmission interval in jiffies, or 0 for none
+ *
+ * A request is on @fresh or @aged, linked by its req_list, exactly when
+ * its aux points at the channel.
+ */
+
+struct p9_ss_chan {
+	struct list_head list;
+	struct p9_client *client;
+	struct net_device *dev;
+	u8 ha[ETH_ALEN];
+	u16 id;
+
+	spinlock_t lock;
+	struct list_head fresh;
+	struct list_head aged;
+	struct timer_list timer;
+	unsigned long timeo;
+};
+
+/* channels, read under RCU from the receive handler */
+static LIST_HEAD(p9_ss_chans);
+static DEFINE_SPINLOCK(p9_ss_chans_lock);
+static u16 p9_ss_next_id;
+
+/**
+ * struct p9_ss_opts - per-mount options
+ * @ssdev: name of the SeaStar interface to use
+ * @lo_mac: virtual host of the server
+ * @msize: msize asked for at mount time, or 0
+ * @timeo: retransmission interval in milliseconds, or 0 for none
+ *
+ */
+
+struct p9_ss_opts {
+	char ssdev[IFNAMSIZ];
+	int lo_mac;
+	int msize;
+	int timeo;
+};
+
+/*
+ * Option Parsing (code inspired by NFS code)
+ */
+
+enum {
+	/* Options that take integer arguments */
+	Opt_lomac, Opt_msize, Opt_timeo,
+	/* Options that take string arguments */
+	Opt_ssdev,
+	Opt_err,
+};
+
+static const match_table_t tokens = {
+	{Opt_lomac, "lomac=%u"},
+	{Opt_msize, "msize=%u"},
+	{Opt_timeo, "timeo=%u"},
+	{Opt_ssdev, "ssdev=%s"},
+	{Opt_err, NULL},
+};
+
+/**
+ * parse_opts - parse mount options into p9_ss_opts structure
+ * @params: options string passed from mount
+ * @opts: SeaStar transport-specific structure to parse options into
+ *
+ * Returns 0 upon success, -ERRNO upon failure
+ */
+
+static int parse_opts(char *params, struct p9_ss_opts *opts)
+{
+	char *p;
+	substring_t args[MAX_OPT_ARGS];
+	int option;
+	char *options;
+	int r;
+
+	opts->ssdev[0] = '\0';
+	opts->lo_mac = -1;
+	opts->msize = 0;
+	opts->timeo = P9_SS_TIMEO;
+
+	if (!params)
+		return 0;
+
+	options = kstrdup(params, GFP_KERNEL);
+	if (!options) {
+		P9_DPRINTK(P9_DEBUG_ERROR,
+				"failed to allocate copy of option string\n");
+		return -ENOMEM;
+	}
+
+	while ((p = strsep(&options, ",")) != NULL) {
+		int token;
+		if (!*p)
+			continue;
+		token = match_token(p, tokens, args);
+		switch (token) {
+		case Opt_lomac:
+		case Opt_msize:
+		case Opt_timeo:
+			r = match_int(&args[0], &option);
+			if (r < 0) {
+				P9_DPRINTK(P9_DEBUG_ERROR,
+				 "integer field, but no integer?\n");
+				continue;
+			}
+			if (token == Opt_msize)
+				opts->msize = option;
+			else if (token == Opt_timeo)
+				opts->timeo = option;
+			else
+				opts->lo_mac = option;
+			break;
+		case Opt_ssdev:
+			match_strlcpy(opts->ssdev, &args[0],
+							sizeof(opts->ssdev));
+			break;
+		default:
+			continue;
+		}
+	}
+	kfree(options);
+	return 0;
+}
+
+/**
+ * p9_ss_find_dev - find the interface to mount over
+ * @name: interface name, or empty for the first SeaStar interface up
+ *
+ * Returns the device with a reference held, or NULL.
+ */
+
+static struct net_device *p9_ss_find_dev(const char *name)
+{
+	struct net_device *dev;
+
+	if (*name) {
+		dev = dev_get_by_name(&init_net, name);
+		if (dev && !(dev->priv_flags & IFF_SEASTAR)) {
+			dev_put(dev);
+			dev = NULL;
+		}
+		return dev;
+	}
+
+	read_lock(&dev_base_lock);
+	for_each_netdev(&init_net, dev) {
+		if ((dev->priv_flags & IFF_SEASTAR) && (dev->flags & IFF_UP)) {
+			dev_hold(dev);
+			read_unlock(&dev_base_lock);
+			return dev;
+		}
+	}
+	read_unlock(&dev_base_lock);
+
+	return NULL;
+}
+
+/**
+ * p9_ss_lookup - find the channel a reply is for
+ * @dev: interface the reply arrived on
+ * @id: channel number from the reply
+ *
+ * Called under rcu_read_lock().
+ */
+
+static struct p9_ss_chan *p9_ss_lookup(struct net_device *dev, u16 id)
+{
+	struct p9_ss_chan *chan;
+
+	list_for_each_entry_rcu(chan, &p9_ss_chans, list) {
+		if (chan->id == id && chan->dev == dev)
+			return chan;
+	}
+
+	return NULL;
+}
+
+/**
+ * p9_ss_untrack - stop retransmitting a request
+ * @req: request, which may not be tracked
+ *
+ * Called with the channel's lock held.
+ */
+
+static void p9_ss_untrack(struct p9_req_t *req)
+{
+	if (req->aux) {
+		list_del(&req->req_list);
+		req->aux = NULL;
+	}
+}
+
+/**
+ * p9_ss_forget - stop retransmitting a request from process context
+ * @chan: channel the request was issued on
+ * @req: request
+ *
+ */
+
+static void p9_ss_forget(struct p9_ss_chan *chan, struct p9_req_t *req)
+{
+	spin_lock_bh(&chan->lock);
+	p9_ss_untrack(req);
+	spin_unlock_bh(&chan->lock);
+}
+
+/**
+ * p9_ss_build - build the datagram carrying a request
+ * @chan: channel to send it on
+ * @req: request
+ * @gfp: allocation flags
+ *
+ * Returns the datagram, ready for dev_queue_xmit(), or an ERR_PTR.
+ */
+
+static struct sk_buff *p9_ss_build(struct p9_ss_chan *chan,
+				   struct p9_req_t *req, gfp_t gfp)
+{
+	struct net_device *dev = chan->dev;
+	struct p9_ss_hdr *hdr;
+	struct sk_buff *skb;
+	int hlen = LL_RESERVED_SPACE(dev);
+
+	skb = alloc_skb(hlen + sizeof(*hdr) + req->tc->size, gfp);
+	if (!skb)
+		return ERR_PTR(-ENOMEM);
+	skb_reserve(skb, hlen);
+	skb_reset_network_header(skb);
+	skb->dev = dev;
+	skb->protocol = htons(ETH_P_SEASTAR_9P);
+
+	hdr = (struct p9_ss_hdr *)skb_put(skb, sizeof(*hdr));
+	hdr->nid = *(__be32 *)dev->dev_addr;
+	hdr->chan = htons(chan->id);
+	hdr->lo_mac = dev->dev_addr[5];
+	hdr->pad = 0;
+	memcpy(skb_put(skb, req->tc->size), req->tc->sdata, req->tc->size);
+
+	if (dev_hard_header(skb, dev, ETH_P_SEASTAR_9P, chan->ha,
+						NULL, skb->len) < 0) {
+		kfree_skb(skb);
+		return ERR_PTR(-EIO);
+	}
+
+	return skb;
+}
+
+/**
+ * p9_ss_timeout - retransmission timer
+ * @data: channel
+ *
+ * Resends every request that has gone a whole tick without a reply, and
+ * ages the ones sent since the last tick.  A request the client gave up
+ * on without flushing it, because the channel failed, is dropped; its
+ * tag is not reused while the client is disconnected.
+ */
+
+static void p9_ss_timeout(unsigned long data)
+{
+	struct p9_ss_chan *chan = (struct p9_ss_chan *)data;
+	struct p9_req_t *req, *tmp;
+	struct sk_buff_head resend;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&resend);
+
+	spin_lock(&chan->lock);
+	list_for_each_entry_safe(req, tmp, &chan->aged, req_list) {
+		if (req->status != REQ_STATUS_SENT) {
+			p9_ss_untrack(req);
+			continue;
+		}
+		P9_DPRINTK(P9_DEBUG_TRANS, "resending tag %d\n", req->tc->tag);
+		skb = p9_ss_build(chan, req, GFP_ATOMIC);
+		if (!IS_ERR(skb))
+			__skb_queue_tail(&resend, skb);
+	}
+	list_splice_tail_init(&chan->fresh, &chan->aged);
+	if (!list_empty(&chan->aged))
+		mod_timer(&chan->timer, jiffies + chan->timeo);
+	spin_unlock(&chan->lock);
+
+	/* not under the lock: a failed send is simply retried next tick */
+	while ((skb = __skb_dequeue(&resend)) != NULL)
+		dev_queue_xmit(skb);
+}
+
+/**
+ * p9_ss_rcv - receive a reply datagram
+ * @skb: the datagram, starting at its struct p9_ss_hdr
+ * @dev: interface it arrived on
+ * @pt: our packet type
+ * @orig_dev: unused
+ *
+ * The R-message is copied into the reply buffer of the request with its
+ * tag, if that request is still waiting for one, and the client woken.
+ */
+
+static int p9_ss_rcv(struct sk_buff *skb, struct net_device *dev,
+		     struct packet_type *pt, struct net_device *orig_dev)
+{
+	struct p9_ss_hdr *hdr;
+	struct p9_ss_chan *chan;
+	struct p9_client *client;
+	struct p9_req_t *req = NULL;
+	u32 size;
+	u16 tag;
+
+	if (!pskb_may_pull(skb, sizeof(*hdr) + 7))
+		goto drop;
+
+	hdr = (struct p9_ss_hdr *)skb->data;
+	size = get_unaligned_le32(skb->data + sizeof(*hdr));
+	tag = get_unaligned_le16(skb->data + sizeof(*hdr) + 5);
+
+	rcu_read_lock();
+	chan = p9_ss_lookup(dev, ntohs(hdr->chan));
+	if (!chan)
+		goto unlock;
+	client = chan->client;
+
+	/* the datagram may have been padded out to a whole quad */
+	if (size < 7 || size > client->msize || size > skb->len - sizeof(*hdr))
+		goto unlock;
+
+	/* like virtio, this runs in softirq context without client->lock */
+	if ((u16)(tag + 1) < client->max_tag) {
+		req = p9_tag_lookup(client, tag);
+		spin_lock(&chan->lock);
+		if (req->status == REQ_STATUS_SENT ||
+		    req->status == REQ_STATUS_FLSH) {
+			skb_copy_bits(skb, sizeof(*hdr), req->rc->sdata, size);
+			req->rc->size = size;
+			req->status = REQ_STATUS_RCVD;
+			p9_ss_untrack(req);
+		} else
+			req = NULL;
+		spin_unlock(&chan->lock);
+	}
+
+	if (req)
+		p9_client_cb(client, req);
+	else
+		P9_DPRINTK(P9_DEBUG_TRANS, "no request for tag %d\n", tag);
+unlock:
+	rcu_read_unlock();
+drop:
+	kfree_skb(skb);
+	return NET_RX_SUCCESS;
+}
+
+static struct packet_type p9_ss_packet_type __read_mostly = {
+	.type = __constant_htons(ETH_P_SEASTAR_9P),
+	.func = p9_ss_rcv,
+};
+
+/**
+ * p9_ss_request - issue a request
+ * @client: client instance issuing the request
+ * @req: request to be issued
+ *
+ */
+
+static int p9_ss_request(struct p9_client *client, struct p9_req_t *req)
+{
+	struct p9_ss_chan *chan = client->trans;
+	struct net_device *dev = chan->dev;
+	struct sk_buff *skb;
+	unsigned int delay = 1;
+	int err;
+
+	P9_DPRINTK(P9_DEBUG_TRANS, "9p debug: seastar request\n");
+
+	spin_lock_bh(&chan->lock);
+	req->status = REQ_STATUS_SENT;
+	if (chan->timeo) {
+		p9_ss_untrack(req);
+		req->aux = chan;
+		list_add_tail(&req->req_list, &chan->fresh);
+		if (!timer_pending(&chan->timer))
+			mod_timer(&chan->timer, jiffies + chan->timeo);
+	}
+	spin_unlock_bh(&chan->lock);
+
+	do {
+		skb = p9_ss_build(chan, req, GFP_NOFS);
+		if (IS_ERR(skb)) {
+			err = PTR_ERR(skb);
+			goto fail;
+		}
+
+		err = net_xmit_eval(dev_queue_xmit(skb));
+		if (!err)
+			return 0;
+
+		/*
+		 * Leaving this to the retransmission timer would cost a
+		 * whole timeo, and there may be none.  A full transmit
+		 * queue is not worth disconnecting over either: back off
+		 * until it drains, the interface goes down or we are
+		 * interrupted, which the client does not treat as a
+		 * transport failure.
+		 */
+		if (!netif_running(dev))
+			break;
+		if (msleep_interruptible(delay))
+			break;
+		delay = min(delay * 2, P9_SS_XMIT_MAX_DELAY);
+	} while (!signal_pending(current));
+
+	if (signal_pending(current))
+		err = -ERESTARTSYS;
+	else
+		err = -EIO;
+fail:
+	p9_ss_forget(chan, req);
+	P9_DPRINTK(P9_DEBUG_ERROR, "transmit failed: %d\n", err);
+	return err;
+}
+
+/**
+ * p9_ss_cancel - cancel a request
+ * @client: client instance
+ * @req: request to cancel
+ *
+ * A request is sent as soon as it is issued, so always have the client
+ * flush it.  It is not resent from now on: the client may reuse its tag
+ * as soon as the Tflush is answered.
+ */
+
+static int p9_ss_cancel(struct p9_client *client, struct p9_req_t *req)
+{
+	p9_ss_forget(client->trans, req);
+	return 1;
+}
+
+/**
+ * p9_ss_create - set up a channel to a server
+ * @client: client instance
+ * @devname: NID of the server
+ * @args: mount options
+ *
+ * msize is set to the largest message one datagram can carry, unless a
+ * smaller one was asked for; the server may lower it further in
+ * Tversion.
+ */
+
+static int p9_ss_create(struct p9_client *client, const char *devname,
+							char *args)
+{
+	struct p9_ss_opts opts;
+	struct p9_ss_chan *chan, *c;
+	struct net_device *dev;
+	unsigned long nid;
+	char *end;
+	int maxsize;
+	int err;
+
+	err = parse_opts(args, &opts);
+	if (err < 0)
+		return err;
+
+	nid = simple_strtoul(devname, &end, 0);
+	if (end == devname || *end) {
+		P9_EPRINTK(KERN_ERR, "p9_ss_create: bad server NID %s\n",
+								devname);
+		return -EINVAL;
+	}
+	if (opts.lo_mac > 0xE) {
+		P9_EPRINTK(KERN_ERR, "p9_ss_create: bad lomac %d\n",
+								opts.lo_mac);
+		return -EINVAL;
+	}
+
+	dev = p9_ss_find_dev(opts.ssdev);
+	if (!dev) {
+		P9_EPRINTK(KERN_ERR, "p9_ss_create: no SeaStar interface\n");
+		return -ENODEV;
+	}
+
+	chan = kzalloc(sizeof(*chan), GFP_KERNEL);
+	if (!chan) {
+		dev_put(dev);
+		return -ENOMEM;
+	}
+
+	chan->client = client;
+	chan->dev = dev;
+	spin_lock_init(&chan->lock);
+	INIT_LIST_HEAD(&chan->fresh);
+	INIT_LIST_HEAD(&chan->aged);
+	setup_timer(&chan->timer, p9_ss_timeout, (unsigned long)chan);
+	chan->timeo = msecs_to_jiffies(opts.timeo);
+	memcpy(chan->ha, dev->dev_addr, ETH_ALEN);
+	*(__be32 *)chan->ha = htonl(nid);
+	if (opts.lo_mac >= 0)
+		chan->ha[5] = opts.lo_mac;
+
+	maxsize = dev->mtu - sizeof(struct p9_ss_hdr);
+	if (!opts.msize || opts.msize > maxsize)
+		client->msize = maxsize;
+	else
+		client->msize = opts.msize;
+
+	/* pick a channel number not in use on this interface */
+	spin_lock(&p9_ss_chans_lock);
+again:
+	chan->id = p9_ss_next_id++;
+	list_for_each_entry(c, &p9_ss_chans, list) {
+		if (c->id == chan->id && c->dev == dev)
+			goto again;
+	}
+	list_add_tail_rcu(&chan->list, &p9_ss_chans);
+	spin_unlock(&p9_ss_chans_lock);
+
+	client->trans = chan;
+	client->status = Connected;
+
+	P9_DPRINTK(P9_DEBUG_TRANS,
+		"channel %u to nid %lu on %s msize %d timeo %d\n",
+		chan->id, nid, dev->name, client->msize, opts.timeo);
+	return 0;
+}
+
+/**
+ * p9_ss_close - tear down a channel
+ * @client: client instance
+ *
+ */
+
+static void p9_ss_close(struct p9_client *client)
+{
+	struct p9_ss_chan *chan = client->trans;
+
+	if (!chan)
+		return;
+
+	client->status = Disconnected;
+
+	spin_lock(&p9_ss_chans_lock);
+	list_del_rcu(&chan->list);
+	spin_unlock(&p9_ss_chans_lock);
+
+	synchronize_net();
+	del_timer_sync(&chan->timer);
+
+	dev_put(chan->dev);
+	kfree(chan);
+	client->trans = NULL;
+}
+
+static struct p9_trans_module p9_ss_trans = {
+	.name = "seastar",
+	.create = p9_ss_create,
+	.close = p9_ss_close,
+	.request = p9_ss_request,
+	.cancel = p9_ss_cancel,
+	.maxsize = P9_SS_MAXSIZE,
+	.def = 0,
+	.owner = THIS_MODULE,
+};
+
+static int __init p9_ss_init(void)
+{
+	dev_add_pack(&p9_ss_packet_type);
+	v9fs_register_trans(&p9_ss_trans);
+	return 0;
+}
+
+static void __exit p9_ss_cleanup(void)
+{
+	v9fs_unregister_trans(&p9_ss_trans);
+	dev_remove_pack(&p9_ss_packet_type);
+}
+
+module_init(p9_ss_init);
+module_exit(p9_ss_cleanup);
+
+MODULE_DESCRIPTION("SeaStar 9p Transport");
+MODULE_LICENSE("GPL");
@@ -153,6 +153,7 @@
 #include <linux/wait.h>
 #include <linux/etherdevice.h>
 #include <linux/kthread.h>
+#include <linux/if_seastar.h>
 #include <net/net_namespace.h>
 #include <net/checksum.h>
 #include <net/ipv6.h>
@@ -190,6 +191,13 @@
 #define F_IPSEC_ON    (1<<12)	/* ipsec on for flows */
 #define F_QUEUE_MAP_RND (1<<13)	/* queue map Random */
 #define F_QUEUE_MAP_CPU (1<<14)	/* queue map mirrors smp_processor_id() */
+#define F_SEASTAR     (1<<15)	/* Native SeaStar datagrams */
+
+/* SeaStar destination NID patterns */
+#define SS_PAT_SEQ     0	/* walk nid_min..nid_max */
+#define SS_PAT_RND     1	/* random in nid_min..nid_max */
+#define SS_PAT_ALL2ALL 2	/* walk the range from our own NID, skip it */
+#define SS_PAT_INCAST  3	/* everyone sends to nid_min */
 
 /* Thread control flag bits */
 #define T_TERMINATE   (1<<0)
@@ -206,6 +214,7 @@
 #define PKTGEN_MAGIC 0xbe9be955
 #define PG_PROC_DIR "pktgen"
 #define PGCTRL	    "pgctrl"
+#define PGRX	    "pgrx"
 static struct proc_dir_entry *pg_proc_dir;
 
 #define MAX_CFLOWS  65536
@@ -372,6 +381,14 @@ struct pktgen_dev {
 	u16 queue_map_min;
 	u16 queue_map_max;
 
+	/* SeaStar native mode */
+	__u32 ss_nid_min;	/* inclusive */
+	__u32 ss_nid_max;	/* inclusive */
+	__u32 ss_cur_nid;
+	__u32 ss_self_nid;
+	__u8  ss_lo_mac;	/* destination virtual host */
+	__u8  ss_pattern;
+
 #ifdef CONFIG_XFRM
 	__u8	ipsmode;		/* IPSEC mode (config) */
 	__u8	ipsproto;		/* IPSEC type (config) */
@@ -386,6 +403,38 @@ struct pktgen_hdr {
 	__be32 tv_usec;
 };
 
+/* Payload of native SeaStar datagrams, after the SeaStar header */
+struct pktgen_ss_hdr {
+	__be32 pgh_magic;
+	__be32 seq_num;
+	__be32 src_nid;
+	__be32 pad;
+	__be64 tstamp;		/* ns, wall clock */
+};
+
+/* SeaStar header as received, the NID is only there on transmit */
+#define PG_SS_HLEN (sizeof(struct ss_raw_hdr) - sizeof(__be32))
+
+/* Receive side checking of native SeaStar datagrams */
+#define PG_SS_RX_SRCS 256
+
+struct pktgen_ss_rx {
+	spinlock_t lock;
+	__u64 pkts;
+	__u64 bytes;
+	__u64 bad;		/* not ours, or truncated */
+	__u64 reordered;	/* seq_num not above the last from that NID */
+	__s64 lat_min;		/* ns */
+	__s64 lat_max;
+	__s64 lat_sum;
+	__u32 src_nid[PG_SS_RX_SRCS];
+	__u32 src_seq[PG_SS_RX_SRCS];
+};
+
+static struct pktgen_ss_rx pg_ss_rx = {
+	.lock = __SPIN_LOCK_UNLOCKED(pg_ss_rx.lock),
+};
+
 struct pktgen_thread {
 	spinlock_t if_lock;		/* for list of devices */
 	struct list_head if_list;	/* All device here */
@@ -514,6 +563,96 @@ static const struct file_operations pktgen_fops = {
 	.release = single_release,
 };
 
+static void pgrx_reset(void)
+{
+	spin_lock_bh(&pg_ss_rx.lock);
+	pg_ss_rx.pkts = 0;
+	pg_ss_rx.bytes = 0;
+	pg_ss_rx.bad = 0;
+	pg_ss_rx.reordered = 0;
+	pg_ss_rx.lat_min = LLONG_MAX;
+	pg_ss_rx.lat_max = LLONG_MIN;
+	pg_ss_rx.lat_sum = 0;
+	memset(pg_ss_rx.src_nid, 0, sizeof(pg_ss_rx.src_nid));
+	memset(pg_ss_rx.src_seq, 0, sizeof(pg_ss_rx.src_seq));
+	spin_unlock_bh(&pg_ss_rx.lock);
+}
+
+static int pgrx_show(struct seq_file *seq, void *v)
+{
+	u64 pkts, bytes, bad, reordered;
+	s64 lat_min = 0, lat_max = 0, lat_sum, avg = 0;
+
+	spin_lock_bh(&pg_ss_rx.lock);
+	pkts = pg_ss_rx.pkts;
+	bytes = pg_ss_rx.bytes;
+	bad = pg_ss_rx.bad;
+	reordered = pg_ss_rx.reordered;
+	lat_sum = pg_ss_rx.lat_sum;
+	if (pkts) {
+		lat_min = pg_ss_rx.lat_min;
+		lat_max = pg_ss_rx.lat_max;
+	}
+	spin_unlock_bh(&pg_ss_rx.lock);
+
+	if (pkts) {
+		if (lat_sum < 0)
+			avg = -(s64)div64_u64(-lat_sum, pkts);
+		else
+			avg = div64_u64(lat_sum, pkts);
+	}
+
+	seq_printf(seq,
+		   "SeaStar RX:\n     pkts: %llu  bytes: %llu  bad: %llu  "
+		   "reordered: %llu\n",
+		   (unsigned long long)pkts, (unsigned long long)bytes,
+		   (unsigned long long)bad, (unsigned long long)reordered);
+	seq_printf(seq,
+		   "     latency min: %lldns  avg: %lldns  max: %lldns\n",
+		   (long long)lat_min, (long long)avg, (long long)lat_max);
+	return 0;
+}
+
+static ssize_t pgrx_write(struct file *file, const char __user *buf,
+			  size_t count, loff_t *ppos)
+{
+	char data[16];
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (count == 0)
+		return -EINVAL;
+
+	if (count > sizeof(data))
+		count = sizeof(data);
+
+	if (copy_from_user(data, buf, count))
+		return -EFAULT;
+	data[count - 1] = 0;	/* Make string */
+
+	if (!strcmp(data, "reset"))
+		pgrx_reset();
+	else
+		printk(KERN_WARNING "pktgen: Unknown command: %s\n", data);
+
+	return count;
+}
+
+static int pgrx_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pgrx_show, PDE(inode)->data);
+}
+
+static const struct file_operations pktgen_rx_fops = {
+	.owner   = THIS_MODULE,
+	.open    = pgrx_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.write   = pgrx_write,
+	.release = single_release,
+};
+
 static int pktgen_if_show(struct seq_file *seq, void *v)
 {
 	const struct pktgen_dev *pkt_dev = seq->private;
@@ -533,6 +672,17 @@ static int pktgen_if_show(struct seq_file *seq, void *v)
 	seq_printf(seq, "     flows: %u flowlen: %u\n", pkt_dev->cflows,
 		   pkt_dev->lflow);
 
+	if (pkt_dev->flags & F_SEASTAR) {
+		static const char *const patterns[] = {
+			"seq", "rnd", "all2all", "incast"
+		};
+
+		seq_printf(seq,
+			   "     ss_nid_min: %u  ss_nid_max: %u  ss_lo_mac: %u  ss_pattern: %s\n",
+			   pkt_dev->ss_nid_min, pkt_dev->ss_nid_max,
+			   pkt_dev->ss_lo_mac, patterns[pkt_dev->ss_pattern]);
+	}
+
 	seq_printf(seq,
 		   "     queue_map_min: %u  queue_map_max: %u\n",
 		   pkt_dev->queue_map_min,
@@ -635,6 +785,9 @@ static int pktgen_if_show(struct seq_file *seq, void *v)
 	if (pkt_dev->flags & F_QUEUE_MAP_CPU)
 		seq_printf(seq,  "QUEUE_MAP_CPU  ");
 
+	if (pkt_dev->flags & F_SEASTAR)
+		seq_printf(seq,  "SEASTAR  ");
+
 	if (pkt_dev->cflows) {
 		if (pkt_dev->flags & F_FLOW_SEQ)
 			seq_printf(seq,  "FLOW_SEQ  "); /*in sequence flows*/
@@ -696,6 +849,9 @@ static int pktgen_if_show(struct seq_file *seq, void *v)
 
 	seq_printf(seq, "     cur_queue_map: %u\n", pkt_dev->cur_queue_map);
 
+	if (pkt_dev->flags & F_SEASTAR)
+		seq_printf(seq, "     cur_nid: %u\n", pkt_dev->ss_cur_nid);
+
 	seq_printf(seq, "     flows: %u\n", pkt_dev->nflows);
 
 	if (pkt_dev->result[0])
@@ -1157,6 +1313,20 @@ static ssize_t pktgen_if_write(struct file *file,
 
 		else if (strcmp(f, "!QUEUE_MAP_CPU") == 0)
 			pkt_dev->flags &= ~F_QUEUE_MAP_CPU;
+
+		else if (strcmp(f, "SEASTAR") == 0) {
+			/* The native header only means anything to a SeaStar */
+			if (!(pkt_dev->odev->priv_flags & IFF_SEASTAR)) {
+				sprintf(pg_result,
+					"ERROR: %s is not a SeaStar interface",
+					pkt_dev->odev->name);
+				return count;
+			}
+			pkt_dev->flags |= F_SEASTAR;
+		}
+
+		else if (strcmp(f, "!SEASTAR") == 0)
+			pkt_dev->flags &= ~F_SEASTAR;
 #ifdef CONFIG_XFRM
 		else if (strcmp(f, "IPSEC") == 0)
 			pkt_dev->flags |= F_IPSEC_ON;
@@ -1170,7 +1340,7 @@ static ssize_t pktgen_if_write(struct file *file,
 				"Flag -:%s:- unknown\nAvailable flags, (prepend ! to un-set flag):\n%s",
 				f,
 				"IPSRC_RND, IPDST_RND, UDPSRC_RND, UDPDST_RND, "
-				"MACSRC_RND, MACDST_RND, TXSIZE_RND, IPV6, MPLS_RND, VID_RND, SVID_RND, FLOW_SEQ, IPSEC\n");
+				"MACSRC_RND, MACDST_RND, TXSIZE_RND, IPV6, MPLS_RND, VID_RND, SVID_RND, FLOW_SEQ, IPSEC, SEASTAR\n");
 			return count;
 		}
 		sprintf(pg_result, "OK: flags=0x%x", pkt_dev->flags);
@@ -1489,6 +1659,70 @@ static ssize_t pktgen_if_write(struct file *file,
 		return count;
 	}
 
+	if (!strcmp(name, "ss_nid_min")) {
+		len = num_arg(&user_buffer[i], 10, &value);
+		if (len < 0)
+			return len;
+
+		i += len;
+		pkt_dev->ss_nid_min = value;
+		sprintf(pg_result, "OK: ss_nid_min=%u", pkt_dev->ss_nid_min);
+		return count;
+	}
+
+	if (!strcmp(name, "ss_nid_max")) {
+		len = num_arg(&user_buffer[i], 10, &value);
+		if (len < 0)
+			return len;
+
+		i += len;
+		pkt_dev->ss_nid_max = value;
+		sprintf(pg_result, "OK: ss_nid_max=%u", pkt_dev->ss_nid_max);
+		return count;
+	}
+
+	if (!strcmp(name, "ss_lo_mac")) {
+		len = num_arg(&user_buffer[i], 2, &value);
+		if (len < 0)
+			return len;
+
+		i += len;
+		if (value < 0xF) {
+			pkt_dev->ss_lo_mac = value;
+			sprintf(pg_result, "OK: ss_lo_mac=%u", pkt_dev->ss_lo_mac);
+		} else {
+			sprintf(pg_result, "ERROR: ss_lo_mac must be 0-14");
+		}
+		return count;
+	}
+
+	if (!strcmp(name, "ss_pattern")) {
+		char f[32];
+		memset(f, 0, 32);
+		len = strn_len(&user_buffer[i], sizeof(f) - 1);
+		if (len < 0)
+			return len;
+
+		if (copy_from_user(f, &user_buffer[i], len))
+			return -EFAULT;
+		i += len;
+		if (strcmp(f, "seq") == 0)
+			pkt_dev->ss_pattern = SS_PAT_SEQ;
+		else if (strcmp(f, "rnd") == 0)
+			pkt_dev->ss_pattern = SS_PAT_RND;
+		else if (strcmp(f, "all2all") == 0)
+			pkt_dev->ss_pattern = SS_PAT_ALL2ALL;
+		else if (strcmp(f, "incast") == 0)
+			pkt_dev->ss_pattern = SS_PAT_INCAST;
+		else {
+			sprintf(pg_result,
+				"ERROR: ss_pattern must be seq, rnd, all2all or incast");
+			return count;
+		}
+		sprintf(pg_result, "OK: ss_pattern=%s", f);
+		return count;
+	}
+
 	if (!strcmp(name, "mpls")) {
 		unsigned n, cnt;
 
@@ -2100,6 +2334,19 @@ static void pktgen_setup_inject(struct pktgen_dev *pkt_dev)
 	pkt_dev->cur_udp_dst = pkt_dev->udp_dst_min;
 	pkt_dev->cur_udp_src = pkt_dev->udp_src_min;
 	pkt_dev->nflows = 0;
+
+	/* A SeaStar MAC carries the NID in its first four bytes */
+	if (pkt_dev->flags & F_SEASTAR) {
+		pkt_dev->ss_self_nid = ntohl(*(__be32 *)pkt_dev->odev->dev_addr);
+		if (pkt_dev->ss_nid_max < pkt_dev->ss_nid_min)
+			pkt_dev->ss_nid_max = pkt_dev->ss_nid_min;
+
+		/* Everyone starting on their own NID spreads all2all out */
+		if (pkt_dev->ss_pattern == SS_PAT_ALL2ALL)
+			pkt_dev->ss_cur_nid = pkt_dev->ss_self_nid;
+		else
+			pkt_dev->ss_cur_nid = pkt_dev->ss_nid_max;
+	}
 }
 
 
@@ -2225,6 +2472,36 @@ static void set_cur_queue_map(struct pktgen_dev *pkt_dev)
 	pkt_dev->cur_queue_map  = pkt_dev->cur_queue_map % pkt_dev->odev->real_num_tx_queues;
 }
 
+/* Pick the next destination NID in SeaStar mode */
+static void mod_cur_nid(struct pktgen_dev *pkt_dev)
+{
+	__u32 min = pkt_dev->ss_nid_min;
+	__u32 max = max(pkt_dev->ss_nid_max, min);
+	__u32 nid = pkt_dev->ss_cur_nid;
+
+	switch (pkt_dev->ss_pattern) {
+	case SS_PAT_INCAST:
+		nid = min;
+		break;
+
+	case SS_PAT_RND:
+		nid = min + random32() % (max - min + 1);
+		break;
+
+	case SS_PAT_ALL2ALL:
+		nid = (nid < min || nid >= max) ? min : nid + 1;
+		if (nid == pkt_dev->ss_self_nid && min != max)
+			nid = (nid >= max) ? min : nid + 1;
+		break;
+
+	default:
+		nid = (nid < min || nid >= max) ? min : nid + 1;
+		break;
+	}
+
+	pkt_dev->ss_cur_nid = nid;
+}
+
 /* Increment/randomize headers according to flags and current values
  * for IP src/dest, UDP src/dst port, MAC-Addr src/dst
  */
@@ -2427,6 +2704,9 @@ static void mod_cur_headers(struct pktgen_dev *pkt_dev)
 		pkt_dev->cur_pkt_size = t;
 	}
 
+	if (pkt_dev->flags & F_SEASTAR)
+		mod_cur_nid(pkt_dev);
+
 	set_cur_queue_map(pkt_dev);
 
 	pkt_dev->flows[flow].count++;
@@ -3060,10 +3340,129 @@ static struct sk_buff *fill_packet_ipv6(struct net_device *odev,
 	return skb;
 }
 
+/*
+ * Native SeaStar datagram, handed to the driver pre-framed so it is sent
+ * without any conversion and can be reused with clone_skb.  cur_pkt_size
+ * is the size of the datagram, SeaStar header included.  Clones carry the
+ * same seq_num and time stamp, so latency is only meaningful with
+ * clone_skb 0.
+ */
+static struct sk_buff *fill_packet_seastar(struct net_device *odev,
+					   struct pktgen_dev *pkt_dev)
+{
+	struct sk_buff *skb;
+	struct ss_raw_hdr *raw;
+	struct pktgen_ss_hdr *pgh;
+	struct timespec ts;
+	int datalen;
+
+	mod_cur_headers(pkt_dev);
+
+	datalen = pkt_dev->cur_pkt_size - PG_SS_HLEN;
+	if (datalen < (int)sizeof(struct pktgen_ss_hdr))
+		datalen = sizeof(struct pktgen_ss_hdr);
+	datalen = ALIGN(datalen, 4);
+
+	skb = __netdev_alloc_skb(odev, sizeof(*raw) + datalen, GFP_NOWAIT);
+	if (!skb) {
+		sprintf(pkt_dev->result, "No memory");
+		return NULL;
+	}
+
+	raw = (struct ss_raw_hdr *)skb_put(skb, sizeof(*raw));
+	raw->nid = htonl(pkt_dev->ss_cur_nid);
+	raw->length = ((PG_SS_HLEN + datalen) >> 2) - 1;
+	raw->lo_macs = ((odev->dev_addr[5] & 0xF) << 4) | pkt_dev->ss_lo_mac;
+	raw->hdr_type = SS_HDR_TYPE(SS_TYPE_RAW);
+
+	pgh = (struct pktgen_ss_hdr *)skb_put(skb, datalen);
+	pgh->pgh_magic = htonl(PKTGEN_MAGIC);
+	pgh->seq_num = htonl(pkt_dev->seq_num);
+	pgh->src_nid = htonl(pkt_dev->ss_self_nid);
+	pgh->pad = 0;
+	getnstimeofday(&ts);
+	pgh->tstamp = cpu_to_be64(timespec_to_ns(&ts));
+
+	skb->protocol = htons(ETH_P_SEASTAR);
+	skb_reset_mac_header(skb);
+	skb->dev = odev;
+	skb->pkt_type = PACKET_HOST;
+	skb_set_queue_mapping(skb, pkt_dev->cur_queue_map);
+
+	return skb;
+}
+
+/*
+ * Checks native SeaStar datagrams from pktgen on other nodes.  The
+ * receive time is the driver's time stamp if it takes them, so one way
+ * latency is exact against our own NID and as good as the clock sync
+ * between nodes otherwise.
+ */
+static int pktgen_ss_rcv(struct sk_buff *skb, struct net_device *dev,
+			 struct packet_type *pt, struct net_device *orig_dev)
+{
+	struct pktgen_ss_hdr *pgh;
+	struct timespec ts;
+	s64 now, lat;
+	u32 nid, seq, slot;
+
+	skb = skb_share_check(skb, GFP_ATOMIC);
+	if (!skb)
+		return NET_RX_DROP;
+
+	if (skb_hwtstamps(skb)->syststamp.tv64) {
+		now = ktime_to_ns(skb_hwtstamps(skb)->syststamp);
+	} else {
+		getnstimeofday(&ts);
+		now = timespec_to_ns(&ts);
+	}
+
+	if (!pskb_may_pull(skb, PG_SS_HLEN + sizeof(*pgh)))
+		goto bad;
+
+	pgh = (struct pktgen_ss_hdr *)(skb->data + PG_SS_HLEN);
+	if (pgh->pgh_magic != htonl(PKTGEN_MAGIC))
+		goto bad;
+
+	nid = ntohl(pgh->src_nid);
+	seq = ntohl(pgh->seq_num);
+	lat = now - (s64)be64_to_cpu(pgh->tstamp);
+	slot = nid % PG_SS_RX_SRCS;
+
+	spin_lock(&pg_ss_rx.lock);
+	pg_ss_rx.pkts++;
+	pg_ss_rx.bytes += skb->len;
+	pg_ss_rx.lat_sum += lat;
+	pg_ss_rx.lat_min = min(pg_ss_rx.lat_min, lat);
+	pg_ss_rx.lat_max = max(pg_ss_rx.lat_max, lat);
+	if (pg_ss_rx.src_nid[slot] == nid && seq <= pg_ss_rx.src_seq[slot])
+		pg_ss_rx.reordered++;
+	pg_ss_rx.src_nid[slot] = nid;
+	pg_ss_rx.src_seq[slot] = seq;
+	spin_unlock(&pg_ss_rx.lock);
+
+	kfree_skb(skb);
+	return NET_RX_SUCCESS;
+
+bad:
+	spin_lock(&pg_ss_rx.lock);
+	pg_ss_rx.bad++;
+	spin_unlock(&pg_ss_rx.lock);
+	kfree_skb(skb);
+	return NET_RX_DROP;
+}
+
+static struct packet_type pktgen_ss_packet_type __read_mostly = {
+	.type = cpu_to_be16(ETH_P_SEASTAR),
+	.func = pktgen_ss_rcv,
+};
+
 static struct sk_buff *fill_packet(struct net_device *odev,
 				   struct pktgen_dev *pkt_dev)
 {
-	if (pkt_dev->flags & F_IPV6)
+	if (pkt_dev->flags & F_SEASTAR)
+		return fill_packet_seastar(odev, pkt_dev);
+	else if (pkt_dev->flags & F_IPV6)
 		return fill_packet_ipv6(odev, pkt_dev);
 	else
 		return fill_packet_ipv4(odev, pkt_dev);
@@ -3803,6 +4202,18 @@ static int __init pg_init(void)
 		return -EINVAL;
 	}
 
+	pe = proc_create(PGRX, 0600, pg_proc_dir, &pktgen_rx_fops);
+	if (pe == NULL) {
+		printk(KERN_ERR "pktgen: ERROR: cannot create %s "
+		       "procfs entry.\n", PGRX);
+		remove_proc_entry(PGCTRL, pg_proc_dir);
+		proc_net_remove(&init_net, PG_PROC_DIR);
+		return -EINVAL;
+	}
+
+	pgrx_reset();
+	dev_add_pack(&pktgen_ss_packet_type);
+
 	/* Register us to receive netdevice events */
 	register_netdevice_notifier(&pktgen_notifier_block);
 
@@ -3819,6 +4230,8 @@ static int __init pg_init(void)
 		printk(KERN_ERR "pktgen: ERROR: Initialization failed for "
 		       "all threads\n");
 		unregister_netdevice_notifier(&pktgen_notifier_block);
+		dev_remove_pack(&pktgen_ss_packet_type);
+		remove_proc_entry(PGRX, pg_proc_dir);
 		remove_proc_entry(PGCTRL, pg_proc_dir);
 		proc_net_remove(&init_net, PG_PROC_DIR);
 		return -ENODEV;
@@ -3844,8 +4257,10 @@ static void __exit pg_cleanup(void)
 
 	/* Un-register us from receiving netdevice events */
 	unregister_netdevice_notifier(&pktgen_notifier_block);
+	dev_remove_pack(&pktgen_ss_packet_type);
 
 	/* Clean up proc file system */
+	remove_proc_entry(PGRX, pg_proc_dir);
 	remove_proc_entry(PGCTRL, pg_proc_dir);
 	proc_net_remove(&init_net, PG_PROC_DIR);
 }
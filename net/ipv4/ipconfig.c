@@ -84,6 +84,9 @@
 #if defined(IPCONFIG_BOOTP) || defined(IPCONFIG_RARP)
 #define IPCONFIG_DYNAMIC
 #endif
+#if defined(CONFIG_IP_PNP_SEASTAR)
+#define IPCONFIG_NID
+#endif
 
 /* Define the friendly delay before and after opening net devices */
 #define CONF_PRE_OPEN		500	/* Before opening: 1/2 second */
@@ -100,6 +103,10 @@
 #define CONF_NAMESERVERS_MAX   3       /* Maximum number of nameservers
 					   - '3' from resolv.h */
 
+/* Default SeaStar node network, node addresses are <base> + NID */
+#define CONF_NID_BASE		htonl(0x0a800000)	/* 10.128.0.0 */
+#define CONF_NID_NETMASK	htonl(0xfffc0000)	/* /14 */
+
 #define NONE cpu_to_be32(INADDR_NONE)
 #define ANY cpu_to_be32(INADDR_ANY)
 
@@ -209,7 +216,9 @@ static int __init ic_open_devs(void)
 			continue;
 		if (user_dev_name[0] ? !strcmp(dev->name, user_dev_name) :
 		    (!(dev->flags & IFF_LOOPBACK) &&
-		     (dev->flags & (IFF_POINTOPOINT|IFF_BROADCAST)) &&
+		     ((dev->flags & (IFF_POINTOPOINT|IFF_BROADCAST)) ||
+		      ((ic_proto_enabled & IC_NID) &&
+		       (dev->priv_flags & IFF_SEASTAR))) &&
 		     strncmp(dev->name, "dummy", 5))) {
 			int able = 0;
 			if (dev->mtu >= 364)
@@ -218,6 +227,8 @@ static int __init ic_open_devs(void)
 				printk(KERN_WARNING "DHCP/BOOTP: Ignoring device %s, MTU %d too small", dev->name, dev->mtu);
 			if (!(dev->flags & IFF_NOARP))
 				able |= IC_RARP;
+			if (dev->priv_flags & IFF_SEASTAR)
+				able |= IC_NID;
 			able &= ic_proto_enabled;
 			if (ic_proto_enabled && !able)
 				continue;
@@ -1229,6 +1240,48 @@ static int __init ic_dynamic(void)
 
 #endif /* IPCONFIG_DYNAMIC */
 
+#ifdef IPCONFIG_NID
+
+/*
+ *	SeaStar configuration.  The MAC address of a SeaStar interface
+ *	starts with the node's NID, and node addresses are laid out as
+ *	<base> + NID, so the address is known without asking anyone.  A
+ *	client-ip given on the command line is taken as the base.
+ */
+static int __init ic_nid_config(void)
+{
+	struct ic_device *d;
+	__be32 base;
+	u32 nid;
+
+	for (d = ic_first_dev; d; d = d->next)
+		if (d->able & IC_NID)
+			break;
+	if (!d) {
+		printk(KERN_ERR "IP-Config: No SeaStar device found.\n");
+		return -1;
+	}
+
+	base = (ic_myaddr == NONE) ? CONF_NID_BASE : ic_myaddr;
+	if (ic_netmask == NONE)
+		ic_netmask = CONF_NID_NETMASK;
+	nid = ntohl(*(__be32 *)d->dev->dev_addr);
+	if (nid & ntohl(ic_netmask)) {
+		printk(KERN_ERR "IP-Config: NID %u does not fit netmask %pI4\n",
+		       nid, &ic_netmask);
+		return -1;
+	}
+
+	ic_myaddr = (base & ic_netmask) | htonl(nid);
+	ic_dev = d->dev;
+	ic_proto_used = IC_NID;
+	printk(KERN_INFO "IP-Config: %s is NID %u, my address is %pI4\n",
+	       ic_dev->name, nid, &ic_myaddr);
+	return 0;
+}
+
+#endif /* IPCONFIG_NID */
+
 #ifdef CONFIG_PROC_FS
 
 static int pnp_seq_show(struct seq_file *seq, void *v)
@@ -1237,7 +1290,8 @@ static int pnp_seq_show(struct seq_file *seq, void *v)
 
 	if (ic_proto_used & IC_PROTO)
 		seq_printf(seq, "#PROTO: %s\n",
-			   (ic_proto_used & IC_RARP) ? "RARP"
+			   (ic_proto_used & IC_NID) ? "NID"
+			   : (ic_proto_used & IC_RARP) ? "RARP"
 			   : (ic_proto_used & IC_USE_DHCP) ? "DHCP" : "BOOTP");
 	else
 		seq_puts(seq, "#MANUAL\n");
@@ -1326,13 +1380,24 @@ static int __init ip_auto_config(void)
 #ifdef IPCONFIG_DYNAMIC
  try_try_again:
 #endif
-	/* Give hardware a chance to settle */
-	msleep(CONF_PRE_OPEN);
+	/* Give hardware a chance to settle; SeaStar links need no time */
+	if (!(ic_proto_enabled & IC_NID))
+		msleep(CONF_PRE_OPEN);
 
 	/* Setup all network devices */
 	if (ic_open_devs() < 0)
 		return -1;
 
+#ifdef IPCONFIG_NID
+	if (ic_proto_enabled & IC_NID) {
+		if (ic_nid_config() < 0) {
+			ic_close_devs();
+			return -1;
+		}
+		goto configured;
+	}
+#endif
+
 	/* Give drivers a chance to settle */
 	ssleep(CONF_POST_OPEN);
 
@@ -1395,6 +1460,9 @@ static int __init ip_auto_config(void)
 		ic_dev = ic_first_dev->dev;
 	}
 
+#ifdef IPCONFIG_NID
+ configured:
+#endif
 	addr = root_nfs_parse_addr(root_server_path);
 	if (root_server_addr == NONE)
 		root_server_addr = addr;
@@ -1417,7 +1485,7 @@ static int __init ip_auto_config(void)
 	 * Record which protocol was actually used.
 	 */
 #ifdef IPCONFIG_DYNAMIC
-	ic_proto_used = ic_got_reply | (ic_proto_enabled & IC_USE_DHCP);
+	ic_proto_used |= ic_got_reply | (ic_proto_enabled & IC_USE_DHCP);
 #endif
 
 #ifndef IPCONFIG_SILENT
@@ -1475,6 +1543,12 @@ static int __init ic_proto_name(char *name)
 		return 1;
 	}
 #endif
+#ifdef IPCONFIG_NID
+	else if (!strcmp(name, "nid")) {
+		ic_proto_enabled = IC_NID;
+		return 1;
+	}
+#endif
 #ifdef IPCONFIG_DYNAMIC
 	else if (!strcmp(name, "both")) {
 		ic_proto_enabled &= ~IC_USE_DHCP; /* backward compat :-( */
@@ -313,8 +313,9 @@ struct rds_notifier {
 
 #define RDS_TRANS_IB	0
 #define RDS_TRANS_IWARP	1
-#define RDS_TRANS_TCP	2
-#define RDS_TRANS_COUNT	3
+#define RDS_TRANS_SEASTAR	2
+#define RDS_TRANS_TCP	3
+#define RDS_TRANS_COUNT	4
 
 struct rds_transport {
 	char			t_name[TRANSNAMSIZ];
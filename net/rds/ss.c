@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2009 Cray Inc. and Sandia National Laboratories.
+ * All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include <linux/kernel.h>
+#include <linux/in.h>
+#include <linux/netdevice.h>
+#include <linux/if_seastar.h>
+#include <linux/inetdevice.h>
+#include <net/route.h>
+#include <net/neighbour.h>
+
+#include "rds.h"
+#include "ss.h"
+
+/*
+ * RDS over SeaStar datagrams.
+ *
+ * The SeaStar fabric delivers datagrams reliably and in order between a
+ * pair of nodes, so a connection is no more than the address of its peer:
+ * messages are cut into datagrams of up to the interface MTU and handed to
+ * the SeaStar driver, which sends them with the 4 byte SeaStar header in
+ * place of the ethernet one.  The receiver still acks the messages it has
+ * delivered, since it can drop datagrams it has no memory for, and a
+ * sender that hears no ack for rds_ss_retrans_ms drops the connection so
+ * the core retransmits.
+ */
+
+unsigned int rds_ss_ack_delay_ms = 1;
+module_param(rds_ss_ack_delay_ms, uint, 0644);
+MODULE_PARM_DESC(rds_ss_ack_delay_ms, " Longest delay before acking a message");
+
+unsigned int rds_ss_retrans_ms = 2000;
+module_param(rds_ss_retrans_ms, uint, 0644);
+MODULE_PARM_DESC(rds_ss_retrans_ms, " Time without an ack before resending");
+
+/* Track rds_ss_connection structs so they can be cleaned up */
+static DEFINE_SPINLOCK(rds_ss_conn_lock);
+static LIST_HEAD(rds_ss_conn_list);
+
+static int rds_ss_laddr_check(__be32 addr)
+{
+	struct net_device *dev;
+	int ret = -EADDRNOTAVAIL;
+
+	dev = ip_dev_find(&init_net, addr);
+	if (dev) {
+		if (dev->priv_flags & IFF_SEASTAR)
+			ret = 0;
+		dev_put(dev);
+	}
+
+	return ret;
+}
+
+/*
+ * Looks up the interface and hardware address the connection's datagrams
+ * go to, the same way IP output would.  The result is kept until the
+ * connection is shut down.
+ */
+int rds_ss_resolve(struct rds_connection *conn)
+{
+	struct rds_ss_connection *sc = conn->c_transport_data;
+	struct flowi fl = {
+		.nl_u = { .ip4_u = { .daddr = conn->c_faddr,
+				     .saddr = conn->c_laddr } },
+	};
+	struct rtable *rt;
+	struct neighbour *n;
+	int ret = 0;
+
+	mutex_lock(&sc->s_resolve_lock);
+	if (sc->s_dev)
+		goto out;
+
+	ret = ip_route_output_key(&init_net, &rt, &fl);
+	if (ret)
+		goto out;
+
+	ret = -EHOSTUNREACH;
+	n = rt->u.dst.neighbour;
+	if (n && (rt->u.dst.dev->priv_flags & IFF_SEASTAR)) {
+		read_lock_bh(&n->lock);
+		if (n->nud_state & NUD_VALID) {
+			memcpy(sc->s_ha, n->ha, ETH_ALEN);
+			ret = 0;
+		}
+		read_unlock_bh(&n->lock);
+	}
+
+	if (ret == 0) {
+		dev_hold(rt->u.dst.dev);
+		sc->s_dev = rt->u.dst.dev;
+	}
+	ip_rt_put(rt);
+out:
+	mutex_unlock(&sc->s_resolve_lock);
+	if (ret)
+		rds_ss_stats_inc(s_ss_tx_unreachable);
+	return ret;
+}
+
+static void rds_ss_release(struct rds_ss_connection *sc)
+{
+	mutex_lock(&sc->s_resolve_lock);
+	if (sc->s_dev) {
+		dev_put(sc->s_dev);
+		sc->s_dev = NULL;
+	}
+	mutex_unlock(&sc->s_resolve_lock);
+}
+
+static int rds_ss_conn_alloc(struct rds_connection *conn, gfp_t gfp)
+{
+	struct rds_ss_connection *sc;
+	unsigned long flags;
+
+	sc = kzalloc(sizeof(struct rds_ss_connection), gfp);
+	if (sc == NULL)
+		return -ENOMEM;
+
+	sc->conn = conn;
+	mutex_init(&sc->s_resolve_lock);
+	spin_lock_init(&sc->s_rx_lock);
+	INIT_DELAYED_WORK(&sc->s_ack_w, rds_ss_ack_worker);
+	INIT_DELAYED_WORK(&sc->s_retrans_w, rds_ss_retrans_worker);
+	conn->c_transport_data = sc;
+
+	spin_lock_irqsave(&rds_ss_conn_lock, flags);
+	list_add_tail(&sc->s_ss_node, &rds_ss_conn_list);
+	spin_unlock_irqrestore(&rds_ss_conn_lock, flags);
+
+	rdsdebug("alloced sc %p\n", sc);
+	return 0;
+}
+
+static void rds_ss_conn_free(void *arg)
+{
+	struct rds_ss_connection *sc = arg;
+	unsigned long flags;
+
+	rdsdebug("freeing sc %p\n", sc);
+
+	spin_lock_irqsave(&rds_ss_conn_lock, flags);
+	list_del(&sc->s_ss_node);
+	spin_unlock_irqrestore(&rds_ss_conn_lock, flags);
+
+	/*
+	 * This can be called under rds_conn_lock for a conn that lost a
+	 * creation race, so it can't sleep.  Otherwise it is only called
+	 * from rds_ss_destroy_conns(), after our work has been cancelled.
+	 */
+	if (sc->s_sinc)
+		rds_inc_put(&sc->s_sinc->si_inc);
+	if (sc->s_dev)
+		dev_put(sc->s_dev);
+	kfree(sc);
+}
+
+/* There is nothing to set up on the wire, only the peer to look up */
+static int rds_ss_conn_connect(struct rds_connection *conn)
+{
+	int ret;
+
+	ret = rds_ss_resolve(conn);
+	if (ret)
+		return ret;
+
+	rds_connect_complete(conn);
+	return 0;
+}
+
+static void rds_ss_conn_shutdown(struct rds_connection *conn)
+{
+	struct rds_ss_connection *sc = conn->c_transport_data;
+
+	cancel_delayed_work_sync(&sc->s_retrans_w);
+	cancel_delayed_work_sync(&sc->s_ack_w);
+	rds_ss_recv_reset(conn);
+	rds_ss_release(sc);
+}
+
+/*
+ * Connections hold a reference on their interface, drop those going
+ * through one that is going away.  The references are put by the
+ * shutdown worker, which unregistration waits for.
+ */
+static int rds_ss_dev_event(struct notifier_block *this, unsigned long event,
+			    void *ptr)
+{
+	struct net_device *dev = ptr;
+	struct rds_ss_connection *sc;
+	unsigned long flags;
+
+	if (!(dev->priv_flags & IFF_SEASTAR) ||
+	    (event != NETDEV_DOWN && event != NETDEV_UNREGISTER))
+		return NOTIFY_DONE;
+
+	spin_lock_irqsave(&rds_ss_conn_lock, flags);
+	list_for_each_entry(sc, &rds_ss_conn_list, s_ss_node) {
+		if (sc->s_dev == dev)
+			rds_conn_drop(sc->conn);
+	}
+	spin_unlock_irqrestore(&rds_ss_conn_lock, flags);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block rds_ss_dev_notifier = {
+	.notifier_call	= rds_ss_dev_event,
+};
+
+static void rds_ss_destroy_conns(void)
+{
+	struct rds_ss_connection *sc, *_sc;
+	LIST_HEAD(tmp_list);
+
+	/* avoid calling conn_destroy with irqs off */
+	spin_lock_irq(&rds_ss_conn_lock);
+	list_splice(&rds_ss_conn_list, &tmp_list);
+	INIT_LIST_HEAD(&rds_ss_conn_list);
+	spin_unlock_irq(&rds_ss_conn_lock);
+
+	/* Nothing requeues these once the packet handler is gone */
+	list_for_each_entry(sc, &tmp_list, s_ss_node) {
+		cancel_delayed_work_sync(&sc->s_ack_w);
+		cancel_delayed_work_sync(&sc->s_retrans_w);
+	}
+
+	list_for_each_entry_safe(sc, _sc, &tmp_list, s_ss_node)
+		rds_conn_destroy(sc->conn);
+}
+
+void rds_ss_exit(void)
+{
+	dev_remove_pack(&rds_ss_packet_type);
+	unregister_netdevice_notifier(&rds_ss_dev_notifier);
+	rds_ss_destroy_conns();
+	rds_trans_unregister(&rds_ss_transport);
+	rds_ss_recv_exit();
+}
+module_exit(rds_ss_exit);
+
+struct rds_transport rds_ss_transport = {
+	.laddr_check		= rds_ss_laddr_check,
+	.xmit_cong_map		= rds_ss_xmit_cong_map,
+	.xmit			= rds_ss_xmit,
+	.recv			= rds_ss_recv,
+	.conn_alloc		= rds_ss_conn_alloc,
+	.conn_free		= rds_ss_conn_free,
+	.conn_connect		= rds_ss_conn_connect,
+	.conn_shutdown		= rds_ss_conn_shutdown,
+	.inc_copy_to_user	= rds_ss_inc_copy_to_user,
+	.inc_purge		= rds_ss_inc_purge,
+	.inc_free		= rds_ss_inc_free,
+	.stats_info_copy	= rds_ss_stats_info_copy,
+	.exit			= rds_ss_exit,
+	.t_owner		= THIS_MODULE,
+	.t_name			= "seastar",
+	.t_type			= RDS_TRANS_SEASTAR,
+	.t_prefer_loopback	= 1,
+};
+
+int __init rds_ss_init(void)
+{
+	int ret;
+
+	ret = rds_ss_recv_init();
+	if (ret)
+		goto out;
+
+	ret = rds_trans_register(&rds_ss_transport);
+	if (ret)
+		goto out_recv;
+
+	ret = register_netdevice_notifier(&rds_ss_dev_notifier);
+	if (ret)
+		goto out_register;
+
+	dev_add_pack(&rds_ss_packet_type);
+
+	goto out;
+
+out_register:
+	rds_trans_unregister(&rds_ss_transport);
+out_recv:
+	rds_ss_recv_exit();
+out:
+	return ret;
+}
+module_init(rds_ss_init);
+
+MODULE_AUTHOR("Cray Inc. and Sandia National Laboratories");
+MODULE_DESCRIPTION("RDS: SeaStar transport");
+MODULE_LICENSE("Dual BSD/GPL");
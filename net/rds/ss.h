@@ -0,0 +1,107 @@
+#ifndef _RDS_SS_H
+#define _RDS_SS_H
+
+/*
+ * Every datagram starts with this header, right after the SeaStar one.
+ * The fabric doesn't tell the receiver who sent a datagram, so the
+ * connection's addresses travel in each one.  h_len is the number of
+ * bytes that follow; the SeaStar pads datagrams to quad bytes.
+ *
+ * A DATA datagram carries the next piece of the connection's stream of
+ * rds_header + payload messages.  The first piece of each message has
+ * RDS_SS_FLAG_FIRST set and starts with the rds_header, which lets the
+ * receiver resynchronize after losing a piece.  An ACK carries the
+ * sequence number of the last message the receiver delivered.
+ */
+struct rds_ss_header {
+	__be32	h_saddr;
+	__be32	h_daddr;
+	__be16	h_len;
+	u8	h_type;
+	u8	h_flags;
+	__be64	h_ack;
+} __attribute__((packed));
+
+#define RDS_SS_TYPE_DATA	0
+#define RDS_SS_TYPE_ACK		1
+
+#define RDS_SS_FLAG_FIRST	0x01
+
+struct rds_ss_incoming {
+	struct rds_incoming	si_inc;
+	struct sk_buff_head	si_skb_list;
+};
+
+struct rds_ss_connection {
+	struct list_head	s_ss_node;
+	struct rds_connection	*conn;
+
+	/* Where the connection's datagrams go, set up by rds_ss_resolve() */
+	struct mutex		s_resolve_lock;
+	struct net_device	*s_dev;
+	u8			s_ha[ETH_ALEN];
+
+	/* Reassembly, serialized by s_rx_lock */
+	spinlock_t		s_rx_lock;
+	struct rds_ss_incoming	*s_sinc;
+	size_t			s_data_rem;
+
+	/* Acks owed to the peer */
+	u64			s_ack_seq;
+	unsigned long		s_ack_pending;
+	struct delayed_work	s_ack_w;
+
+	/* Sender side loss detection */
+	unsigned long		s_ack_jiffies;
+	struct delayed_work	s_retrans_w;
+};
+
+struct rds_ss_statistics {
+	uint64_t	s_ss_tx_frags;
+	uint64_t	s_ss_tx_busy;
+	uint64_t	s_ss_tx_unreachable;
+	uint64_t	s_ss_rx_frags;
+	uint64_t	s_ss_rx_resync;
+	uint64_t	s_ss_rx_stray;
+	uint64_t	s_ss_ack_sent;
+	uint64_t	s_ss_ack_received;
+	uint64_t	s_ss_retrans_timeout;
+};
+
+/* ss.c */
+int __init rds_ss_init(void);
+void rds_ss_exit(void);
+int rds_ss_resolve(struct rds_connection *conn);
+extern struct rds_transport rds_ss_transport;
+extern unsigned int rds_ss_ack_delay_ms;
+extern unsigned int rds_ss_retrans_ms;
+
+/* ss_recv.c */
+int __init rds_ss_recv_init(void);
+void rds_ss_recv_exit(void);
+extern struct packet_type rds_ss_packet_type;
+int rds_ss_recv(struct rds_connection *conn);
+void rds_ss_recv_reset(struct rds_connection *conn);
+void rds_ss_ack_worker(struct work_struct *work);
+void rds_ss_inc_purge(struct rds_incoming *inc);
+void rds_ss_inc_free(struct rds_incoming *inc);
+int rds_ss_inc_copy_to_user(struct rds_incoming *inc, struct iovec *iov,
+			    size_t size);
+
+/* ss_send.c */
+struct sk_buff *rds_ss_alloc_skb(struct rds_connection *conn,
+				 unsigned int len, u8 type, gfp_t gfp);
+int rds_ss_send_skb(struct rds_connection *conn, struct sk_buff *skb);
+int rds_ss_xmit(struct rds_connection *conn, struct rds_message *rm,
+		unsigned int hdr_off, unsigned int sg, unsigned int off);
+int rds_ss_xmit_cong_map(struct rds_connection *conn,
+			 struct rds_cong_map *map, unsigned long offset);
+void rds_ss_retrans_worker(struct work_struct *work);
+
+/* ss_stats.c */
+DECLARE_PER_CPU(struct rds_ss_statistics, rds_ss_stats);
+#define rds_ss_stats_inc(member) rds_stats_inc_which(rds_ss_stats, member)
+unsigned int rds_ss_stats_info_copy(struct rds_info_iterator *iter,
+				    unsigned int avail);
+
+#endif
@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2009 Cray Inc. and Sandia National Laboratories.
+ * All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include <linux/kernel.h>
+#include <linux/in.h>
+#include <linux/inetdevice.h>
+#include <linux/netdevice.h>
+#include <linux/pkt_sched.h>
+#include <linux/if_seastar.h>
+#include <asm/unaligned.h>
+
+#include "rds.h"
+#include "ss.h"
+
+static struct kmem_cache *rds_ss_incoming_slab;
+
+void rds_ss_inc_purge(struct rds_incoming *inc)
+{
+	struct rds_ss_incoming *sinc;
+	sinc = container_of(inc, struct rds_ss_incoming, si_inc);
+	rdsdebug("purging sinc %p inc %p\n", sinc, inc);
+	skb_queue_purge(&sinc->si_skb_list);
+}
+
+void rds_ss_inc_free(struct rds_incoming *inc)
+{
+	struct rds_ss_incoming *sinc;
+	sinc = container_of(inc, struct rds_ss_incoming, si_inc);
+	rds_ss_inc_purge(inc);
+	rdsdebug("freeing sinc %p inc %p\n", sinc, inc);
+	kmem_cache_free(rds_ss_incoming_slab, sinc);
+}
+
+int rds_ss_inc_copy_to_user(struct rds_incoming *inc, struct iovec *first_iov,
+			    size_t size)
+{
+	struct rds_ss_incoming *sinc;
+	struct iovec *iov, tmp;
+	struct sk_buff *skb;
+	unsigned long to_copy, skb_off;
+	int ret = 0;
+
+	if (size == 0)
+		goto out;
+
+	sinc = container_of(inc, struct rds_ss_incoming, si_inc);
+	iov = first_iov;
+	tmp = *iov;
+
+	skb_queue_walk(&sinc->si_skb_list, skb) {
+		skb_off = 0;
+		while (skb_off < skb->len) {
+			while (tmp.iov_len == 0) {
+				iov++;
+				tmp = *iov;
+			}
+
+			to_copy = min(tmp.iov_len, size);
+			to_copy = min(to_copy, skb->len - skb_off);
+
+			/* modifies tmp as it copies */
+			if (skb_copy_datagram_iovec(skb, skb_off, &tmp,
+						    to_copy)) {
+				ret = -EFAULT;
+				goto out;
+			}
+
+			size -= to_copy;
+			ret += to_copy;
+			skb_off += to_copy;
+			if (size == 0)
+				goto out;
+		}
+	}
+out:
+	return ret;
+}
+
+/*
+ * The pieces of the peer's congestion bitmap must add up to exactly its
+ * size, see rds_tcp_cong_recv().
+ */
+static void rds_ss_cong_recv(struct rds_connection *conn,
+			     struct rds_ss_incoming *sinc)
+{
+	struct sk_buff *skb;
+	unsigned int to_copy, skb_off;
+	unsigned int map_off;
+	unsigned int map_page;
+	struct rds_cong_map *map;
+
+	/* catch completely corrupt packets */
+	if (be32_to_cpu(sinc->si_inc.i_hdr.h_len) != RDS_CONG_MAP_BYTES)
+		return;
+
+	map_page = 0;
+	map_off = 0;
+	map = conn->c_fcong;
+
+	skb_queue_walk(&sinc->si_skb_list, skb) {
+		skb_off = 0;
+		while (skb_off < skb->len) {
+			to_copy = min_t(unsigned int, PAGE_SIZE - map_off,
+					skb->len - skb_off);
+
+			BUG_ON(map_page >= RDS_CONG_MAP_PAGES);
+
+			skb_copy_bits(skb, skb_off,
+				(void *)map->m_page_addrs[map_page] + map_off,
+				to_copy);
+
+			skb_off += to_copy;
+			map_off += to_copy;
+			if (map_off == PAGE_SIZE) {
+				map_off = 0;
+				map_page++;
+			}
+		}
+	}
+
+	rds_cong_map_updated(map, ~(u64) 0);
+}
+
+/* Tells the peer about the messages delivered so far, now or shortly */
+static void rds_ss_ack_queue(struct rds_connection *conn, int now)
+{
+	struct rds_ss_connection *sc = conn->c_transport_data;
+
+	if (!test_and_set_bit(0, &sc->s_ack_pending))
+		queue_delayed_work(rds_wq, &sc->s_ack_w, now ? 0 :
+				   msecs_to_jiffies(rds_ss_ack_delay_ms));
+}
+
+void rds_ss_ack_worker(struct work_struct *work)
+{
+	struct rds_ss_connection *sc = container_of(work,
+			struct rds_ss_connection, s_ack_w.work);
+	struct rds_connection *conn = sc->conn;
+	struct rds_ss_header *sh;
+	struct sk_buff *skb;
+
+	clear_bit(0, &sc->s_ack_pending);
+	smp_mb__after_clear_bit();
+
+	if (rds_ss_resolve(conn))
+		return;
+
+	skb = rds_ss_alloc_skb(conn, 0, RDS_SS_TYPE_ACK, GFP_KERNEL);
+	if (skb == NULL) {
+		rds_ss_ack_queue(conn, 0);
+		return;
+	}
+
+	/* Acks aren't ordered with data, let them pass it */
+	sh = (struct rds_ss_header *)skb_network_header(skb);
+	put_unaligned_be64(conn->c_next_rx_seq - 1, &sh->h_ack);
+	skb->priority = TC_PRIO_CONTROL;
+
+	if (rds_ss_send_skb(conn, skb) == 0)
+		rds_ss_stats_inc(s_ss_ack_sent);
+}
+
+/*
+ * Datagrams arrive through rds_ss_rcv(), so all the recv worker has left
+ * to do is send an ack that is still owed.
+ */
+int rds_ss_recv(struct rds_connection *conn)
+{
+	struct rds_ss_connection *sc = conn->c_transport_data;
+
+	if (test_bit(0, &sc->s_ack_pending) &&
+	    cancel_delayed_work(&sc->s_ack_w))
+		rds_ss_ack_worker(&sc->s_ack_w.work);
+
+	return 0;
+}
+
+/* Throws away the message being reassembled, if any */
+static void __rds_ss_recv_reset(struct rds_ss_connection *sc)
+{
+	if (sc->s_sinc) {
+		rds_inc_put(&sc->s_sinc->si_inc);
+		sc->s_sinc = NULL;
+	}
+	sc->s_data_rem = 0;
+}
+
+void rds_ss_recv_reset(struct rds_connection *conn)
+{
+	struct rds_ss_connection *sc = conn->c_transport_data;
+
+	spin_lock_bh(&sc->s_rx_lock);
+	__rds_ss_recv_reset(sc);
+	spin_unlock_bh(&sc->s_rx_lock);
+}
+
+/*
+ * Adds one DATA datagram, already stripped of its rds_ss_header, to the
+ * message being reassembled and delivers the message once it is whole.
+ */
+static void rds_ss_data_recv(struct rds_connection *conn,
+			     struct sk_buff *skb, u8 flags)
+{
+	struct rds_ss_connection *sc = conn->c_transport_data;
+	struct rds_ss_incoming *sinc;
+	struct rds_header *hdr;
+
+	spin_lock(&sc->s_rx_lock);
+
+	if (flags & RDS_SS_FLAG_FIRST) {
+		if (sc->s_sinc) {
+			rds_ss_stats_inc(s_ss_rx_resync);
+			__rds_ss_recv_reset(sc);
+		}
+
+		if (!pskb_may_pull(skb, sizeof(struct rds_header)))
+			goto drop;
+
+		sinc = kmem_cache_alloc(rds_ss_incoming_slab, GFP_ATOMIC);
+		if (sinc == NULL)
+			goto drop;
+
+		rds_inc_init(&sinc->si_inc, conn, conn->c_faddr);
+		skb_queue_head_init(&sinc->si_skb_list);
+		skb_copy_bits(skb, 0, &sinc->si_inc.i_hdr,
+			      sizeof(struct rds_header));
+		__skb_pull(skb, sizeof(struct rds_header));
+
+		sc->s_sinc = sinc;
+		sc->s_data_rem = be32_to_cpu(sinc->si_inc.i_hdr.h_len);
+	} else if (sc->s_sinc == NULL) {
+		rds_ss_stats_inc(s_ss_rx_stray);
+		goto drop;
+	}
+
+	sinc = sc->s_sinc;
+	if (skb->len > sc->s_data_rem) {
+		rds_ss_stats_inc(s_ss_rx_resync);
+		__rds_ss_recv_reset(sc);
+		goto drop;
+	}
+
+	if (skb->len) {
+		sc->s_data_rem -= skb->len;
+		skb_queue_tail(&sinc->si_skb_list, skb);
+	} else {
+		kfree_skb(skb);
+	}
+	skb = NULL;
+
+	if (sc->s_data_rem == 0) {
+		sc->s_sinc = NULL;
+		hdr = &sinc->si_inc.i_hdr;
+
+		if (hdr->h_flags == RDS_FLAG_CONG_BITMAP) {
+			rds_ss_cong_recv(conn, sinc);
+		} else {
+			rds_recv_incoming(conn, conn->c_faddr, conn->c_laddr,
+					  &sinc->si_inc, GFP_ATOMIC,
+					  KM_SOFTIRQ0);
+			rds_ss_ack_queue(conn,
+					 hdr->h_flags & RDS_FLAG_ACK_REQUIRED);
+		}
+
+		rds_inc_put(&sinc->si_inc);
+	}
+
+drop:
+	spin_unlock(&sc->s_rx_lock);
+	if (skb)
+		kfree_skb(skb);
+}
+
+/*
+ * A connection is only created for a datagram addressed to one of the
+ * receiving interface's own addresses, from a unicast source.  Anything
+ * else would let a remote node fill the connection hash with addresses
+ * we never bound.
+ */
+static int rds_ss_rcv_addr_ok(struct net_device *dev, __be32 daddr,
+			      __be32 saddr)
+{
+	struct net_device *ldev;
+	int ok;
+
+	if (ipv4_is_zeronet(saddr) || ipv4_is_loopback(saddr) ||
+	    ipv4_is_multicast(saddr) || ipv4_is_lbcast(saddr))
+		return 0;
+
+	ldev = ip_dev_find(&init_net, daddr);
+	if (!ldev)
+		return 0;
+	ok = (ldev == dev);
+	dev_put(ldev);
+
+	return ok;
+}
+
+static int rds_ss_rcv(struct sk_buff *skb, struct net_device *dev,
+		      struct packet_type *pt, struct net_device *orig_dev)
+{
+	struct rds_ss_connection *sc;
+	struct rds_connection *conn;
+	struct rds_ss_header *sh;
+	unsigned int len;
+	u8 flags;
+
+	if (dev_net(dev) != &init_net || !(dev->priv_flags & IFF_SEASTAR))
+		goto drop;
+
+	skb = skb_share_check(skb, GFP_ATOMIC);
+	if (skb == NULL)
+		return NET_RX_DROP;
+
+	if (!pskb_may_pull(skb, sizeof(*sh)))
+		goto drop;
+
+	sh = (struct rds_ss_header *)skb->data;
+	len = ntohs(sh->h_len);
+	if (len > skb->len - sizeof(*sh))
+		goto drop;
+
+	if (!rds_ss_rcv_addr_ok(dev, sh->h_daddr, sh->h_saddr))
+		goto drop;
+
+	conn = rds_conn_create(sh->h_daddr, sh->h_saddr, &rds_ss_transport,
+			       GFP_ATOMIC);
+	if (IS_ERR(conn))
+		goto drop;
+	sc = conn->c_transport_data;
+
+	switch (sh->h_type) {
+
+	case RDS_SS_TYPE_ACK:
+		rds_ss_stats_inc(s_ss_ack_received);
+		sc->s_ack_jiffies = jiffies;
+		rds_send_drop_acked(conn, get_unaligned_be64(&sh->h_ack),
+				    NULL);
+		kfree_skb(skb);
+		return NET_RX_SUCCESS;
+
+	case RDS_SS_TYPE_DATA:
+		rds_ss_stats_inc(s_ss_rx_frags);
+		flags = sh->h_flags;
+
+		/* Strip our header and the SeaStar's quad byte padding */
+		__skb_pull(skb, sizeof(*sh));
+		if (pskb_trim(skb, len))
+			goto drop;
+
+		rds_ss_data_recv(conn, skb, flags);
+		return NET_RX_SUCCESS;
+	}
+
+drop:
+	kfree_skb(skb);
+	return NET_RX_DROP;
+}
+
+struct packet_type rds_ss_packet_type = {
+	.type	= __constant_htons(ETH_P_SEASTAR_RDS),
+	.func	= rds_ss_rcv,
+};
+
+int __init rds_ss_recv_init(void)
+{
+	rds_ss_incoming_slab = kmem_cache_create("rds_ss_incoming",
+					sizeof(struct rds_ss_incoming),
+					0, 0, NULL);
+	if (rds_ss_incoming_slab == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+void rds_ss_recv_exit(void)
+{
+	kmem_cache_destroy(rds_ss_incoming_slab);
+}
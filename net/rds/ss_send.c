@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2009 Cray Inc. and Sandia National Laboratories.
+ * All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include <linux/kernel.h>
+#include <linux/in.h>
+#include <linux/netdevice.h>
+#include <linux/highmem.h>
+#include <linux/pkt_sched.h>
+#include <linux/if_seastar.h>
+
+#include "rds.h"
+#include "ss.h"
+
+/*
+ * Allocates a datagram for the connection with room for len bytes after
+ * its rds_ss_header, which is filled in.  The connection must have been
+ * resolved.
+ */
+struct sk_buff *rds_ss_alloc_skb(struct rds_connection *conn,
+				 unsigned int len, u8 type, gfp_t gfp)
+{
+	struct rds_ss_connection *sc = conn->c_transport_data;
+	struct net_device *dev = sc->s_dev;
+	struct rds_ss_header *sh;
+	struct sk_buff *skb;
+
+	skb = alloc_skb(LL_RESERVED_SPACE(dev) + sizeof(*sh) + len, gfp);
+	if (skb == NULL)
+		return NULL;
+
+	skb_reserve(skb, LL_RESERVED_SPACE(dev));
+	skb_reset_network_header(skb);
+
+	sh = (struct rds_ss_header *)skb_put(skb, sizeof(*sh));
+	sh->h_saddr = conn->c_laddr;
+	sh->h_daddr = conn->c_faddr;
+	sh->h_len = htons(len);
+	sh->h_type = type;
+	sh->h_flags = 0;
+	sh->h_ack = 0;
+
+	skb->dev = dev;
+	skb->protocol = htons(ETH_P_SEASTAR_RDS);
+
+	return skb;
+}
+
+/*
+ * Hands a datagram to the SeaStar driver, which puts the SeaStar header
+ * in place of the ethernet one built here.  Returns -ENOBUFS if it was
+ * dropped on the way.
+ */
+int rds_ss_send_skb(struct rds_connection *conn, struct sk_buff *skb)
+{
+	struct rds_ss_connection *sc = conn->c_transport_data;
+
+	if (dev_hard_header(skb, skb->dev, ETH_P_SEASTAR_RDS, sc->s_ha,
+			    NULL, skb->len) < 0) {
+		kfree_skb(skb);
+		return -EINVAL;
+	}
+
+	if (net_xmit_eval(dev_queue_xmit(skb)))
+		return -ENOBUFS;
+
+	return 0;
+}
+
+/* Largest number of stream bytes a datagram can carry */
+static unsigned int rds_ss_frag_room(struct rds_connection *conn)
+{
+	struct rds_ss_connection *sc = conn->c_transport_data;
+
+	return sc->s_dev->mtu - sizeof(struct rds_ss_header);
+}
+
+/*
+ * Sends one datagram and reports how much of the connection's stream it
+ * carried.  A datagram the device couldn't take is tried again shortly
+ * from the send worker.
+ */
+static int rds_ss_xmit_skb(struct rds_connection *conn, struct sk_buff *skb,
+			   unsigned int len)
+{
+	if (rds_ss_send_skb(conn, skb)) {
+		rds_ss_stats_inc(s_ss_tx_busy);
+		queue_delayed_work(rds_wq, &conn->c_send_w, 1);
+		return 0;
+	}
+
+	rds_ss_stats_inc(s_ss_tx_frags);
+	return len;
+}
+
+/* the core send_sem serializes this with other xmit and shutdown */
+int rds_ss_xmit_cong_map(struct rds_connection *conn,
+			 struct rds_cong_map *map, unsigned long offset)
+{
+	struct rds_header hdr = {
+		.h_flags = RDS_FLAG_CONG_BITMAP,
+	};
+	struct rds_ss_header *sh;
+	struct sk_buff *skb;
+	unsigned int room, len, hlen = 0, map_off, i, to_copy;
+	void *dst;
+	int ret;
+
+	ret = rds_ss_resolve(conn);
+	if (ret) {
+		rds_conn_drop(conn);
+		return ret;
+	}
+
+	/* The header always goes whole, at the front of the first datagram */
+	if (offset == 0) {
+		hdr.h_len = cpu_to_be32(RDS_CONG_MAP_BYTES);
+		hlen = sizeof(struct rds_header);
+		map_off = 0;
+	} else {
+		map_off = offset - sizeof(struct rds_header);
+	}
+
+	room = rds_ss_frag_room(conn);
+	len = hlen + min_t(unsigned int, room - hlen,
+			   RDS_CONG_MAP_BYTES - map_off);
+
+	skb = rds_ss_alloc_skb(conn, len, RDS_SS_TYPE_DATA, GFP_KERNEL);
+	if (skb == NULL)
+		return -ENOMEM;
+
+	sh = (struct rds_ss_header *)skb_network_header(skb);
+	if (hlen) {
+		sh->h_flags = RDS_SS_FLAG_FIRST;
+		memcpy(skb_put(skb, hlen), &hdr, hlen);
+	}
+
+	while (skb->len - sizeof(*sh) < len) {
+		i = map_off / PAGE_SIZE;
+		to_copy = min_t(unsigned int, PAGE_SIZE - map_off % PAGE_SIZE,
+				len - (skb->len - sizeof(*sh)));
+		dst = skb_put(skb, to_copy);
+		memcpy(dst, (void *)map->m_page_addrs[i] + map_off % PAGE_SIZE,
+		       to_copy);
+		map_off += to_copy;
+	}
+
+	return rds_ss_xmit_skb(conn, skb, len);
+}
+
+/*
+ * Sends the next datagram of a message: the header and as much of the
+ * payload as fits in the first one, then MTU sized pieces of payload.
+ *
+ * the core send_sem serializes this with other xmit and shutdown
+ */
+int rds_ss_xmit(struct rds_connection *conn, struct rds_message *rm,
+		unsigned int hdr_off, unsigned int sg, unsigned int off)
+{
+	struct rds_ss_connection *sc = conn->c_transport_data;
+	struct rds_ss_header *sh;
+	struct scatterlist *sge;
+	struct sk_buff *skb;
+	unsigned int room, len, hlen = 0, i, o, to_copy;
+	void *src;
+	int ret;
+
+	ret = rds_ss_resolve(conn);
+	if (ret) {
+		rds_conn_drop(conn);
+		return ret;
+	}
+
+	if (hdr_off == 0) {
+		if (test_bit(RDS_MSG_ACK_REQUIRED, &rm->m_flags))
+			rm->m_inc.i_hdr.h_flags |= RDS_FLAG_ACK_REQUIRED;
+		if (test_bit(RDS_MSG_RETRANSMITTED, &rm->m_flags))
+			rm->m_inc.i_hdr.h_flags |= RDS_FLAG_RETRANSMITTED;
+		hlen = sizeof(struct rds_header);
+
+		/* Start the clock on the first message sent since the last ack */
+		if (!delayed_work_pending(&sc->s_retrans_w)) {
+			sc->s_ack_jiffies = jiffies;
+			queue_delayed_work(rds_wq, &sc->s_retrans_w,
+					   msecs_to_jiffies(rds_ss_retrans_ms));
+		}
+	}
+
+	room = rds_ss_frag_room(conn);
+	len = hlen;
+	for (i = sg, o = off; i < rm->m_nents && len < room; i++, o = 0)
+		len += min(room - len, rm->m_sg[i].length - o);
+
+	skb = rds_ss_alloc_skb(conn, len, RDS_SS_TYPE_DATA, GFP_KERNEL);
+	if (skb == NULL)
+		return -ENOMEM;
+
+	sh = (struct rds_ss_header *)skb_network_header(skb);
+	if (hlen) {
+		sh->h_flags = RDS_SS_FLAG_FIRST;
+		memcpy(skb_put(skb, hlen), &rm->m_inc.i_hdr, hlen);
+	}
+
+	for (i = sg, o = off; skb->len - sizeof(*sh) < len; i++, o = 0) {
+		sge = &rm->m_sg[i];
+		to_copy = min_t(unsigned int, len - (skb->len - sizeof(*sh)),
+				sge->length - o);
+
+		src = kmap_atomic(sg_page(sge), KM_USER0);
+		memcpy(skb_put(skb, to_copy), src + sge->offset + o, to_copy);
+		kunmap_atomic(src, KM_USER0);
+	}
+
+	return rds_ss_xmit_skb(conn, skb, len);
+}
+
+/*
+ * Drops the connection, and with it resends everything unacked, if the
+ * peer hasn't acked anything for rds_ss_retrans_ms while messages are
+ * outstanding.
+ */
+void rds_ss_retrans_worker(struct work_struct *work)
+{
+	struct rds_ss_connection *sc = container_of(work,
+			struct rds_ss_connection, s_retrans_w.work);
+	struct rds_connection *conn = sc->conn;
+	unsigned long timeout = msecs_to_jiffies(rds_ss_retrans_ms);
+	unsigned long flags;
+	int idle;
+
+	spin_lock_irqsave(&conn->c_lock, flags);
+	idle = list_empty(&conn->c_retrans);
+	spin_unlock_irqrestore(&conn->c_lock, flags);
+
+	if (idle)
+		return;
+
+	if (time_before(jiffies, sc->s_ack_jiffies + timeout)) {
+		queue_delayed_work(rds_wq, &sc->s_retrans_w,
+				   sc->s_ack_jiffies + timeout - jiffies);
+		return;
+	}
+
+	rds_ss_stats_inc(s_ss_retrans_timeout);
+	printk(KERN_WARNING "RDS/seastar: no ack from %pI4 in %u ms, "
+	       "reconnecting\n", &conn->c_faddr, rds_ss_retrans_ms);
+	rds_conn_drop(conn);
+}
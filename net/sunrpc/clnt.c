@@ -269,6 +269,48 @@ out_no_rpciod:
 	return ERR_PTR(err);
 }
 
+/*
+ * Open the transports after the first for a client created with
+ * nconnect > 1.  Each is a copy of the first with its own connection,
+ * slot table and XIDs; tasks are spread over them in turn.
+ */
+static int rpc_clnt_add_xprts(struct rpc_clnt *clnt,
+			      struct xprt_create *xprtargs,
+			      unsigned int nconnect)
+{
+	struct rpc_xprt *xprt;
+
+	if (nconnect > RPC_MAX_NCONNECT)
+		nconnect = RPC_MAX_NCONNECT;
+
+	while (clnt->cl_nxprts < nconnect - 1) {
+		xprt = xprt_create_transport(xprtargs);
+		if (IS_ERR(xprt))
+			return PTR_ERR(xprt);
+		xprt->resvport = clnt->cl_xprt->resvport;
+		clnt->cl_xprts[clnt->cl_nxprts++] = xprt;
+	}
+	return 0;
+}
+
+/**
+ * rpc_clnt_next_xprt - pick the transport for a new task
+ * @clnt: client the task belongs to
+ *
+ */
+struct rpc_xprt *rpc_clnt_next_xprt(struct rpc_clnt *clnt)
+{
+	unsigned int i;
+
+	if (clnt->cl_nxprts == 0)
+		return clnt->cl_xprt;
+
+	i = (unsigned int)atomic_inc_return(&clnt->cl_xprt_next) %
+						(clnt->cl_nxprts + 1);
+	return i ? clnt->cl_xprts[i - 1] : clnt->cl_xprt;
+}
+EXPORT_SYMBOL_GPL(rpc_clnt_next_xprt);
+
 /*
  * rpc_create - create an RPC client and transport with one call
  * @args: rpc_clnt create argument structure
@@ -339,6 +381,14 @@ struct rpc_clnt *rpc_create(struct rpc_create_args *args)
 	if (IS_ERR(clnt))
 		return clnt;
 
+	if (args->nconnect > 1) {
+		int err = rpc_clnt_add_xprts(clnt, &xprtargs, args->nconnect);
+		if (err != 0) {
+			rpc_shutdown_client(clnt);
+			return ERR_PTR(err);
+		}
+	}
+
 	if (!(args->flags & RPC_CLNT_CREATE_NOPING)) {
 		int err = rpc_ping(clnt, RPC_TASK_SOFT);
 		if (err != 0) {
@@ -371,6 +421,7 @@ struct rpc_clnt *
 rpc_clone_client(struct rpc_clnt *clnt)
 {
 	struct rpc_clnt *new;
+	unsigned int i;
 	int err = -ENOMEM;
 
 	new = kmemdup(clnt, sizeof(*new), GFP_KERNEL);
@@ -397,6 +448,9 @@ rpc_clone_client(struct rpc_clnt *clnt)
 	if (new->cl_auth)
 		atomic_inc(&new->cl_auth->au_count);
 	xprt_get(clnt->cl_xprt);
+	for (i = 0; i < new->cl_nxprts; i++)
+		xprt_get(new->cl_xprts[i]);
+	atomic_set(&new->cl_xprt_next, 0);
 	kref_get(&clnt->cl_kref);
 	rpc_register_client(new);
 	rpciod_up();
@@ -439,6 +493,7 @@ static void
 rpc_free_client(struct kref *kref)
 {
 	struct rpc_clnt *clnt = container_of(kref, struct rpc_clnt, cl_kref);
+	unsigned int i;
 
 	dprintk("RPC:       destroying %s client for %s\n",
 			clnt->cl_protname, clnt->cl_server);
@@ -458,6 +513,8 @@ out_free:
 	kfree(clnt->cl_principal);
 	clnt->cl_metrics = NULL;
 	xprt_put(clnt->cl_xprt);
+	for (i = 0; i < clnt->cl_nxprts; i++)
+		xprt_put(clnt->cl_xprts[i]);
 	rpciod_down();
 	kfree(clnt);
 }
@@ -756,8 +813,13 @@ EXPORT_SYMBOL_GPL(rpc_max_payload);
  */
 void rpc_force_rebind(struct rpc_clnt *clnt)
 {
-	if (clnt->cl_autobind)
+	unsigned int i;
+
+	if (clnt->cl_autobind) {
 		xprt_clear_bound(clnt->cl_xprt);
+		for (i = 0; i < clnt->cl_nxprts; i++)
+			xprt_clear_bound(clnt->cl_xprts[i]);
+	}
 }
 EXPORT_SYMBOL_GPL(rpc_force_rebind);
 
@@ -1399,6 +1461,9 @@ call_decode(struct rpc_task *task)
 	 */
 	smp_rmb();
 	req->rq_rcv_buf.len = req->rq_private_buf.len;
+	/* The transport may have realigned the reply as it came in */
+	req->rq_rcv_buf.head[0].iov_len = req->rq_private_buf.head[0].iov_len;
+	req->rq_rcv_buf.buflen = req->rq_private_buf.buflen;
 
 	/* Check that the softirq receive buffer is valid */
 	WARN_ON(memcmp(&req->rq_rcv_buf, &req->rq_private_buf,
@@ -430,6 +430,31 @@ xdr_shift_buf(struct xdr_buf *buf, size_t len)
 }
 EXPORT_SYMBOL_GPL(xdr_shift_buf);
 
+/**
+ * xdr_trim_bufhead - shorten head[0] of a partially received buffer
+ * @buf: xdr_buf whose head has been filled but whose pages have not
+ * @len: bytes to remove from buf->head[0]
+ *
+ * Like xdr_shrink_bufhead(), but for use by a transport while a reply
+ * is still arriving: the last @len bytes of the head are moved to the
+ * start of the page array, and nothing already in the pages or tail
+ * needs to be shifted.  The remainder of the reply then lands at its
+ * final position in the pages.
+ */
+void
+xdr_trim_bufhead(struct xdr_buf *buf, size_t len)
+{
+	struct kvec *head = buf->head;
+
+	BUG_ON(len > head->iov_len || len > buf->page_len);
+
+	_copy_to_pages(buf->pages, buf->page_base,
+			(char *)head->iov_base + head->iov_len - len, len);
+	head->iov_len -= len;
+	buf->buflen -= len;
+}
+EXPORT_SYMBOL_GPL(xdr_trim_bufhead);
+
 /**
  * xdr_init_encode - Initialize a struct xdr_stream for sending data.
  * @xdr: pointer to xdr_stream struct
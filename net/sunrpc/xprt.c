@@ -7,8 +7,9 @@
  *  The interface works like this:
  *
  *  -	When a process places a call, it allocates a request slot if
- *	one is available. Otherwise, it sleeps on the backlog queue
- *	(xprt_reserve).
+ *	one is available. Transports with a growth limit add slots on
+ *	demand while their output buffer keeps up. Otherwise, it sleeps
+ *	on the backlog queue (xprt_reserve).
  *  -	Next, the caller puts together the RPC message, stuffs it into
  *	the request struct, and calls xprt_transmit().
  *  -	xprt_transmit sends the message and installs the caller on the
@@ -43,6 +44,7 @@
 #include <linux/interrupt.h>
 #include <linux/workqueue.h>
 #include <linux/net.h>
+#include <linux/slab.h>
 
 #include <linux/sunrpc/clnt.h>
 #include <linux/sunrpc/metrics.h>
@@ -483,6 +485,7 @@ void xprt_wait_for_buffer_space(struct rpc_task *task, rpc_action action)
 	struct rpc_xprt *xprt = req->rq_xprt;
 
 	task->tk_timeout = req->rq_timeout;
+	set_bit(XPRT_CONGESTED, &xprt->state);
 	rpc_sleep_on(&xprt->pending, task, action);
 }
 EXPORT_SYMBOL_GPL(xprt_wait_for_buffer_space);
@@ -498,6 +501,7 @@ void xprt_write_space(struct rpc_xprt *xprt)
 	if (unlikely(xprt->shutdown))
 		return;
 
+	clear_bit(XPRT_CONGESTED, &xprt->state);
 	spin_lock_bh(&xprt->transport_lock);
 	if (xprt->snd_task) {
 		dprintk("RPC:       write space: waking waiting task on "
@@ -614,6 +618,8 @@ void xprt_disconnect_done(struct rpc_xprt *xprt)
 	dprintk("RPC:       disconnected transport %p\n", xprt);
 	spin_lock_bh(&xprt->transport_lock);
 	xprt_clear_connected(xprt);
+	/* Nobody is left waiting for the old socket's buffer space */
+	clear_bit(XPRT_CONGESTED, &xprt->state);
 	xprt_wake_pending_tasks(xprt, -EAGAIN);
 	spin_unlock_bh(&xprt->transport_lock);
 }
@@ -930,24 +936,70 @@ void xprt_transmit(struct rpc_task *task)
 	spin_unlock_bh(&xprt->transport_lock);
 }
 
+static inline int xprt_dynamic_slot(struct rpc_xprt *xprt, struct rpc_rqst *req)
+{
+	return req < xprt->slot || req >= xprt->slot + xprt->max_reqs;
+}
+
+/*
+ * Grow the slot table by one request once the preallocated slots are
+ * all in use, as long as the transport has not reported that its
+ * output buffer is full.  Called under xprt->reserve_lock.
+ */
+static struct rpc_rqst *xprt_dynamic_alloc_slot(struct rpc_xprt *xprt)
+{
+	struct rpc_rqst *req;
+
+	if (xprt->num_reqs >= xprt->limit_reqs ||
+	    test_bit(XPRT_CONGESTED, &xprt->state))
+		return NULL;
+	req = kzalloc(sizeof(*req), GFP_NOWAIT);
+	if (req == NULL)
+		return NULL;
+	INIT_LIST_HEAD(&req->rq_list);
+	xprt->num_reqs++;
+	dprintk("RPC:       transport %p grew to %u slots\n", xprt,
+			xprt->num_reqs);
+	return req;
+}
+
+static void xprt_free_dynamic_slots(struct rpc_xprt *xprt)
+{
+	struct rpc_rqst *req, *n;
+
+	list_for_each_entry_safe(req, n, &xprt->free, rq_list) {
+		if (!xprt_dynamic_slot(xprt, req))
+			continue;
+		list_del(&req->rq_list);
+		kfree(req);
+		xprt->num_reqs--;
+	}
+}
+
 static inline void do_xprt_reserve(struct rpc_task *task)
 {
 	struct rpc_xprt	*xprt = task->tk_xprt;
+	struct rpc_rqst	*req;
 
 	task->tk_status = 0;
 	if (task->tk_rqstp)
 		return;
 	if (!list_empty(&xprt->free)) {
-		struct rpc_rqst	*req = list_entry(xprt->free.next, struct rpc_rqst, rq_list);
+		req = list_entry(xprt->free.next, struct rpc_rqst, rq_list);
 		list_del_init(&req->rq_list);
-		task->tk_rqstp = req;
-		xprt_request_init(task, xprt);
-		return;
+		goto out_init;
 	}
+	req = xprt_dynamic_alloc_slot(xprt);
+	if (req != NULL)
+		goto out_init;
 	dprintk("RPC:       waiting for request slot\n");
 	task->tk_status = -EAGAIN;
 	task->tk_timeout = 0;
 	rpc_sleep_on(&xprt->backlog, task, NULL);
+	return;
+out_init:
+	task->tk_rqstp = req;
+	xprt_request_init(task, xprt);
 }
 
 /**
@@ -987,6 +1039,8 @@ static void xprt_request_init(struct rpc_task *task, struct rpc_xprt *xprt)
 	req->rq_buffer  = NULL;
 	req->rq_xid     = xprt_alloc_xid(xprt);
 	req->rq_release_snd_buf = NULL;
+	req->rq_rcv_hdrlen = NULL;
+	req->rq_rcv_trimmed = 0;
 	xprt_reset_majortimeo(req);
 	dprintk("RPC: %5u reserved req %p xid %08x\n", task->tk_pid,
 			req, ntohl(req->rq_xid));
@@ -1040,8 +1094,15 @@ void xprt_release(struct rpc_task *task)
 	dprintk("RPC: %5u release request %p\n", task->tk_pid, req);
 
 	spin_lock(&xprt->reserve_lock);
-	list_add(&req->rq_list, &xprt->free);
-	rpc_wake_up_next(&xprt->backlog);
+	if (xprt_dynamic_slot(xprt, req) &&
+	    test_bit(XPRT_CONGESTED, &xprt->state)) {
+		/* Shrink back while the transport is backed up */
+		xprt->num_reqs--;
+		kfree(req);
+	} else {
+		list_add(&req->rq_list, &xprt->free);
+		rpc_wake_up_next(&xprt->backlog);
+	}
 	spin_unlock(&xprt->reserve_lock);
 }
 
@@ -1105,6 +1166,9 @@ found:
 	/* initialize free list */
 	for (req = &xprt->slot[xprt->max_reqs-1]; req >= &xprt->slot[0]; req--)
 		list_add(&req->rq_list, &xprt->free);
+	xprt->num_reqs = xprt->max_reqs;
+	if (xprt->limit_reqs < xprt->max_reqs)
+		xprt->limit_reqs = xprt->max_reqs;
 
 	xprt_init_xid(xprt);
 
@@ -1131,6 +1195,7 @@ static void xprt_destroy(struct kref *kref)
 	rpc_destroy_wait_queue(&xprt->sending);
 	rpc_destroy_wait_queue(&xprt->resend);
 	rpc_destroy_wait_queue(&xprt->backlog);
+	xprt_free_dynamic_slots(xprt);
 	/*
 	 * Tear down transport state and free the rpc_xprt
 	 */
@@ -50,6 +50,7 @@
  */
 unsigned int xprt_udp_slot_table_entries = RPC_DEF_SLOT_TABLE;
 unsigned int xprt_tcp_slot_table_entries = RPC_DEF_SLOT_TABLE;
+unsigned int xprt_max_tcp_slot_table_entries = RPC_MAX_SLOT_TABLE_LIMIT;
 
 unsigned int xprt_min_resvport = RPC_DEF_MIN_RESVPORT;
 unsigned int xprt_max_resvport = RPC_DEF_MAX_RESVPORT;
@@ -70,6 +71,7 @@ static unsigned int xs_tcp_fin_timeout __read_mostly = XS_TCP_LINGER_TO;
 
 static unsigned int min_slot_table_size = RPC_MIN_SLOT_TABLE;
 static unsigned int max_slot_table_size = RPC_MAX_SLOT_TABLE;
+static unsigned int max_tcp_slot_table_limit = RPC_MAX_SLOT_TABLE_LIMIT;
 static unsigned int xprt_min_resvport_limit = RPC_MIN_RESVPORT;
 static unsigned int xprt_max_resvport_limit = RPC_MAX_RESVPORT;
 
@@ -102,6 +104,16 @@ static ctl_table xs_tunables_table[] = {
 		.extra1		= &min_slot_table_size,
 		.extra2		= &max_slot_table_size
 	},
+	{
+		.procname	= "tcp_max_slot_table_entries",
+		.data		= &xprt_max_tcp_slot_table_entries,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &min_slot_table_size,
+		.extra2		= &max_tcp_slot_table_limit
+	},
 	{
 		.ctl_name	= CTL_MIN_RESVPORT,
 		.procname	= "min_resvport",
@@ -992,6 +1004,47 @@ static inline void xs_tcp_read_calldir(struct sock_xprt *transport,
 	xs_tcp_check_fraghdr(transport);
 }
 
+/*
+ * The head of a reply has just been received, and the upper layer has
+ * asked to have its page data realigned.  If the reply header turns
+ * out to be shorter than the space reserved for it, move the overrun
+ * into the pages now, while it is only a few bytes, so that the rest
+ * of the payload lands at its final page offset instead of having to
+ * be shifted by xdr_read_pages() after it has all arrived.
+ */
+static void xs_tcp_realign_reply(struct rpc_rqst *req)
+{
+	struct xdr_buf *rcvbuf = &req->rq_private_buf;
+	struct kvec *head = rcvbuf->head;
+	__be32 *p = head->iov_base;
+	__be32 *end = p + (head->iov_len >> 2);
+	unsigned int hdrlen, verflen;
+	int len;
+
+	/* xid, direction, reply_stat, verifier flavor and length */
+	if (end - p < 6 || p[2] != htonl(RPC_MSG_ACCEPTED))
+		return;
+	verflen = ntohl(p[4]);
+	if (verflen > RPC_MAX_AUTH_SIZE)
+		return;
+	p += 5 + XDR_QUADLEN(verflen);
+	if (p >= end || *p++ != rpc_success)
+		return;
+
+	len = req->rq_rcv_hdrlen(req, p, end);
+	if (len < 0)
+		return;
+	hdrlen = (char *)p - (char *)head->iov_base + len;
+	if (hdrlen >= head->iov_len ||
+	    head->iov_len - hdrlen > rcvbuf->page_len)
+		return;
+
+	req->rq_rcv_trimmed = head->iov_len - hdrlen;
+	xdr_trim_bufhead(rcvbuf, req->rq_rcv_trimmed);
+	dprintk("RPC:       XID %08x realigned reply by %u bytes\n",
+			ntohl(req->rq_xid), req->rq_rcv_trimmed);
+}
+
 static inline void xs_tcp_read_common(struct rpc_xprt *xprt,
 				     struct xdr_skb_reader *desc,
 				     struct rpc_rqst *req)
@@ -999,7 +1052,7 @@ static inline void xs_tcp_read_common(struct rpc_xprt *xprt,
 	struct sock_xprt *transport =
 				container_of(xprt, struct sock_xprt, xprt);
 	struct xdr_buf *rcvbuf;
-	size_t len;
+	size_t len, limit;
 	ssize_t r;
 
 	rcvbuf = &req->rq_private_buf;
@@ -1015,13 +1068,26 @@ static inline void xs_tcp_read_common(struct rpc_xprt *xprt,
 			&calldir, sizeof(calldir));
 		transport->tcp_copied += sizeof(calldir);
 		transport->tcp_flags &= ~TCP_RCV_COPY_CALLDIR;
+
+		/* A new reply: undo any realignment done for an earlier one */
+		if (req->rq_rcv_trimmed) {
+			rcvbuf->head[0].iov_len += req->rq_rcv_trimmed;
+			rcvbuf->buflen += req->rq_rcv_trimmed;
+			req->rq_rcv_trimmed = 0;
+		}
 	}
 
 	len = desc->count;
-	if (len > transport->tcp_reclen - transport->tcp_offset) {
+	limit = transport->tcp_reclen - transport->tcp_offset;
+	/* Stop at the end of the head if the reply may need realigning */
+	if (req->rq_rcv_hdrlen != NULL && !req->rq_rcv_trimmed &&
+	    transport->tcp_copied < rcvbuf->head[0].iov_len &&
+	    limit > rcvbuf->head[0].iov_len - transport->tcp_copied)
+		limit = rcvbuf->head[0].iov_len - transport->tcp_copied;
+	if (len > limit) {
 		struct xdr_skb_reader my_desc;
 
-		len = transport->tcp_reclen - transport->tcp_offset;
+		len = limit;
 		memcpy(&my_desc, desc, sizeof(my_desc));
 		my_desc.count = len;
 		r = xdr_partial_copy_from_skb(rcvbuf, transport->tcp_copied,
@@ -1062,6 +1128,10 @@ static inline void xs_tcp_read_common(struct rpc_xprt *xprt,
 			"tcp_reclen = %u\n", xprt, transport->tcp_copied,
 			transport->tcp_offset, transport->tcp_reclen);
 
+	if (req->rq_rcv_hdrlen != NULL && !req->rq_rcv_trimmed &&
+	    transport->tcp_copied == rcvbuf->head[0].iov_len)
+		xs_tcp_realign_reply(req);
+
 	if (transport->tcp_copied == req->rq_private_buf.buflen)
 		transport->tcp_flags &= ~TCP_RCV_COPY_DATA;
 	else if (transport->tcp_offset == transport->tcp_reclen) {
@@ -2415,6 +2485,7 @@ static struct rpc_xprt *xs_setup_tcp(struct xprt_create *args)
 		return xprt;
 	transport = container_of(xprt, struct sock_xprt, xprt);
 
+	xprt->limit_reqs = xprt_max_tcp_slot_table_entries;
 	xprt->prot = IPPROTO_TCP;
 	xprt->tsh_size = sizeof(rpc_fraghdr) / sizeof(u32);
 	xprt->max_payload = RPC_MAX_FRAGMENT_SIZE;
@@ -2656,8 +2727,25 @@ static int param_get_slot_table_size(char *buffer, struct kernel_param *kp)
 #define param_check_slot_table_size(name, p) \
 	__param_check(name, p, unsigned int);
 
+static int param_set_max_slot_table_size(const char *val,
+					 struct kernel_param *kp)
+{
+	return param_set_uint_minmax(val, kp,
+			RPC_MIN_SLOT_TABLE,
+			RPC_MAX_SLOT_TABLE_LIMIT);
+}
+
+static int param_get_max_slot_table_size(char *buffer, struct kernel_param *kp)
+{
+	return param_get_uint(buffer, kp);
+}
+#define param_check_max_slot_table_size(name, p) \
+	__param_check(name, p, unsigned int);
+
 module_param_named(tcp_slot_table_entries, xprt_tcp_slot_table_entries,
 		   slot_table_size, 0644);
+module_param_named(tcp_max_slot_table_entries, xprt_max_tcp_slot_table_entries,
+		   max_slot_table_size, 0644);
 module_param_named(udp_slot_table_entries, xprt_udp_slot_table_entries,
 		   slot_table_size, 0644);
 
@@ -109,6 +109,7 @@ int tipc_get_mode(void)
 
 void tipc_core_stop_net(void)
 {
+	tipc_ss_media_stop();
 	tipc_eth_media_stop();
 	tipc_net_stop();
 }
@@ -122,7 +123,8 @@ int tipc_core_start_net(unsigned long addr)
 	int res;
 
 	if ((res = tipc_net_start(addr)) ||
-	    (res = tipc_eth_media_start())) {
+	    (res = tipc_eth_media_start()) ||
+	    (res = tipc_ss_media_start())) {
 		tipc_core_stop_net();
 	}
 	return res;
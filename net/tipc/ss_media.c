@@ -0,0 +1,425 @@
+/*
+ * net/tipc/ss_media.c: Cray SeaStar bearer support for TIPC
+ *
+ * Copyright (c) 2009, Cray Inc. and Sandia National Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * Alternatively, this software may be distributed under the terms of the
+ * GNU General Public License ("GPL") version 2 as published by the Free
+ * Software Foundation.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <net/tipc/tipc.h>
+#include <net/tipc/tipc_bearer.h>
+#include <net/tipc/tipc_msg.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/moduleparam.h>
+#include <net/net_namespace.h>
+#include "core.h"
+#include "msg.h"
+
+#define MAX_SS_BEARERS		2
+#define SS_LINK_PRIORITY	TIPC_DEF_LINK_PRI
+#define SS_LINK_TOLERANCE	TIPC_DEF_LINK_TOL
+#define SS_LINK_WINDOW		TIPC_DEF_LINK_WIN
+#define SS_MAX_NIDS		65536
+
+/*
+ * SeaStar has no broadcast, so a message sent to the broadcast address is
+ * sent as one datagram per destination, at the sender's own lo_mac.
+ *
+ * Discovery messages walk [seastar_nid_first, seastar_nid_last], at most
+ * seastar_disc_burst NIDs each time, carrying on where the last one
+ * stopped.  Every other broadcast only goes to the peers whose discovery
+ * messages have been heard on the bearer.  An empty range leaves
+ * discovery to peers that are configured with one.
+ */
+
+static unsigned int seastar_nid_first = 1;
+static unsigned int seastar_nid_last;
+static unsigned int seastar_disc_burst = 64;
+module_param(seastar_nid_first, uint, 0644);
+MODULE_PARM_DESC(seastar_nid_first, "First NID sent SeaStar discovery");
+module_param(seastar_nid_last, uint, 0644);
+MODULE_PARM_DESC(seastar_nid_last, "Last NID sent SeaStar discovery");
+module_param(seastar_disc_burst, uint, 0644);
+MODULE_PARM_DESC(seastar_disc_burst, "NIDs sent each SeaStar discovery message");
+
+/**
+ * struct ss_bearer - SeaStar bearer data structure
+ * @bearer: ptr to associated "generic" bearer structure
+ * @dev: ptr to associated SeaStar network device
+ * @tipc_packet_type: used in binding TIPC to SeaStar driver
+ * @disc_next: next NID in the range to send discovery to
+ * @peers: NIDs heard from in discovery, sent all other broadcasts
+ */
+
+struct ss_bearer {
+	struct tipc_bearer *bearer;
+	struct net_device *dev;
+	struct packet_type tipc_packet_type;
+	u32 disc_next;
+	unsigned long peers[BITS_TO_LONGS(SS_MAX_NIDS)];
+};
+
+static struct ss_bearer ss_bearers[MAX_SS_BEARERS];
+static int ss_started = 0;
+static struct notifier_block notifier;
+
+/**
+ * send_one - send a TIPC message to one SeaStar node
+ *
+ * A SeaStar address is an Ethernet-style MAC address holding the node's
+ * NID in its first four bytes and its lo_mac in the last.
+ */
+
+static void send_one(struct sk_buff *buf, struct net_device *dev,
+		     const unchar *dest)
+{
+	skb_reset_network_header(buf);
+	buf->dev = dev;
+	dev_hard_header(buf, dev, ETH_P_TIPC, dest, dev->dev_addr, buf->len);
+	dev_queue_xmit(buf);
+}
+
+/**
+ * send_copy - send a private copy of a TIPC message to one SeaStar node
+ *
+ * The SeaStar header is built in the headroom and differs between
+ * destinations, so each gets its own.  Returns 0 if no copy could be made.
+ */
+
+static int send_copy(struct sk_buff *buf, struct net_device *dev, u32 nid)
+{
+	unchar dest[ETH_ALEN];
+	struct sk_buff *copy;
+
+	if (htonl(nid) == *(__be32 *)dev->dev_addr)
+		return 1;
+	copy = pskb_copy(buf, GFP_ATOMIC);
+	if (!copy)
+		return 0;
+	memcpy(dest, dev->dev_addr, ETH_ALEN);
+	*(__be32 *)dest = htonl(nid);
+	send_one(copy, dev, dest);
+	return 1;
+}
+
+/**
+ * send_bcast - send a TIPC message to the broadcast address
+ *
+ * Discovery goes to the next seastar_disc_burst NIDs of the range, so
+ * each discovery interval costs a bounded number of datagrams however
+ * large the range.  Everything else goes to known peers only.
+ */
+
+static void send_bcast(struct sk_buff *buf, struct ss_bearer *sb_ptr)
+{
+	struct net_device *dev = sb_ptr->dev;
+	u32 first = seastar_nid_first;
+	u32 last = min(seastar_nid_last, (unsigned int)SS_MAX_NIDS - 1);
+	u32 nid, n;
+
+	if (msg_user(buf_msg(buf)) != LINK_CONFIG) {
+		for_each_bit(nid, sb_ptr->peers, SS_MAX_NIDS) {
+			if (!send_copy(buf, dev, nid))
+				break;
+		}
+		return;
+	}
+
+	if (first > last)
+		return;
+
+	nid = sb_ptr->disc_next;
+	for (n = 0; n < seastar_disc_burst && n <= last - first; n++) {
+		if (nid < first || nid > last)
+			nid = first;
+		if (!send_copy(buf, dev, nid))
+			break;
+		nid++;
+	}
+	sb_ptr->disc_next = nid;
+}
+
+/**
+ * send_msg - send a TIPC message out over a SeaStar interface
+ */
+
+static int send_msg(struct sk_buff *buf, struct tipc_bearer *tb_ptr,
+		    struct tipc_media_addr *dest)
+{
+	struct sk_buff *clone;
+	struct net_device *dev;
+
+	dev = ((struct ss_bearer *)(tb_ptr->usr_handle))->dev;
+	if (is_broadcast_ether_addr(dest->dev_addr.eth_addr)) {
+		send_bcast(buf, tb_ptr->usr_handle);
+		return 0;
+	}
+
+	clone = skb_clone(buf, GFP_ATOMIC);
+	if (clone)
+		send_one(clone, dev, dest->dev_addr.eth_addr);
+	return 0;
+}
+
+/**
+ * recv_msg - handle incoming TIPC message from a SeaStar interface
+ *
+ * Routine truncates any padding appended to the message to round it up
+ * to whole quad bytes, and ensures message size matches actual length
+ */
+
+static int recv_msg(struct sk_buff *buf, struct net_device *dev,
+		    struct packet_type *pt, struct net_device *orig_dev)
+{
+	struct ss_bearer *sb_ptr = (struct ss_bearer *)pt->af_packet_priv;
+	struct tipc_media_addr addr;
+	struct tipc_msg *msg;
+	u32 size, nid;
+
+	if (!net_eq(dev_net(dev), &init_net)) {
+		kfree_skb(buf);
+		return 0;
+	}
+
+	if (likely(sb_ptr->bearer)) {
+		msg = (struct tipc_msg *)buf->data;
+		size = msg_size(msg);
+		skb_trim(buf, size);
+		if (likely(buf->len == size)) {
+			/* A peer's discovery tells us where to broadcast */
+			if (msg_user(msg) == LINK_CONFIG && size >= DSC_H_SIZE) {
+				msg_get_media_addr(msg, &addr);
+				nid = ntohl(*(__be32 *)&addr.dev_addr);
+				if (addr.type == htonl(TIPC_MEDIA_TYPE_SEASTAR) &&
+				    nid < SS_MAX_NIDS)
+					set_bit(nid, sb_ptr->peers);
+			}
+			buf->next = NULL;
+			tipc_recv_msg(buf, sb_ptr->bearer);
+			return 0;
+		}
+	}
+	kfree_skb(buf);
+	return 0;
+}
+
+/**
+ * enable_bearer - attach TIPC bearer to a SeaStar interface
+ */
+
+static int enable_bearer(struct tipc_bearer *tb_ptr)
+{
+	struct net_device *dev = NULL;
+	struct net_device *pdev = NULL;
+	struct ss_bearer *sb_ptr = &ss_bearers[0];
+	struct ss_bearer *stop = &ss_bearers[MAX_SS_BEARERS];
+	char *driver_name = strchr((const char *)tb_ptr->name, ':') + 1;
+
+	/* Find SeaStar device with specified name */
+
+	for_each_netdev(&init_net, pdev){
+		if (!strncmp(pdev->name, driver_name, IFNAMSIZ)) {
+			dev = pdev;
+			break;
+		}
+	}
+	if (!dev || !(dev->priv_flags & IFF_SEASTAR))
+		return -ENODEV;
+
+	/* Find SeaStar bearer for device (or create one) */
+
+	for (;(sb_ptr != stop) && sb_ptr->dev && (sb_ptr->dev != dev); sb_ptr++);
+	if (sb_ptr == stop)
+		return -EDQUOT;
+	if (!sb_ptr->dev) {
+		sb_ptr->dev = dev;
+		sb_ptr->tipc_packet_type.type = htons(ETH_P_TIPC);
+		sb_ptr->tipc_packet_type.dev = dev;
+		sb_ptr->tipc_packet_type.func = recv_msg;
+		sb_ptr->tipc_packet_type.af_packet_priv = sb_ptr;
+		INIT_LIST_HEAD(&(sb_ptr->tipc_packet_type.list));
+		dev_hold(dev);
+		dev_add_pack(&sb_ptr->tipc_packet_type);
+	}
+
+	/* Associate TIPC bearer with SeaStar bearer */
+
+	sb_ptr->bearer = tb_ptr;
+	tb_ptr->usr_handle = (void *)sb_ptr;
+	tb_ptr->mtu = dev->mtu;
+	tb_ptr->blocked = 0;
+	tb_ptr->addr.type = htonl(TIPC_MEDIA_TYPE_SEASTAR);
+	memcpy(&tb_ptr->addr.dev_addr, dev->dev_addr, ETH_ALEN);
+
+	if (!seastar_nid_last)
+		warn("Bearer <%s> has no broadcast range, discovery is "
+		     "receive only\n", tb_ptr->name);
+	return 0;
+}
+
+/**
+ * disable_bearer - detach TIPC bearer from a SeaStar interface
+ *
+ * As for Ethernet, dev_remove_pack() is postponed to ss_media_stop().
+ */
+
+static void disable_bearer(struct tipc_bearer *tb_ptr)
+{
+	((struct ss_bearer *)tb_ptr->usr_handle)->bearer = NULL;
+}
+
+/**
+ * recv_notification - handle device updates from OS
+ *
+ * Change the state of the SeaStar bearer (if any) associated with the
+ * specified device.
+ */
+
+static int recv_notification(struct notifier_block *nb, unsigned long evt,
+			     void *dv)
+{
+	struct net_device *dev = (struct net_device *)dv;
+	struct ss_bearer *sb_ptr = &ss_bearers[0];
+	struct ss_bearer *stop = &ss_bearers[MAX_SS_BEARERS];
+
+	if (!net_eq(dev_net(dev), &init_net))
+		return NOTIFY_DONE;
+
+	while ((sb_ptr->dev != dev)) {
+		if (++sb_ptr == stop)
+			return NOTIFY_DONE;	/* couldn't find device */
+	}
+	if (!sb_ptr->bearer)
+		return NOTIFY_DONE;		/* bearer had been disabled */
+
+	sb_ptr->bearer->mtu = dev->mtu;
+
+	switch (evt) {
+	case NETDEV_CHANGE:
+		if (netif_carrier_ok(dev))
+			tipc_continue(sb_ptr->bearer);
+		else
+			tipc_block_bearer(sb_ptr->bearer->name);
+		break;
+	case NETDEV_UP:
+		tipc_continue(sb_ptr->bearer);
+		break;
+	case NETDEV_DOWN:
+		tipc_block_bearer(sb_ptr->bearer->name);
+		break;
+	case NETDEV_CHANGEMTU:
+	case NETDEV_CHANGEADDR:
+		tipc_block_bearer(sb_ptr->bearer->name);
+		tipc_continue(sb_ptr->bearer);
+		break;
+	case NETDEV_UNREGISTER:
+	case NETDEV_CHANGENAME:
+		tipc_disable_bearer(sb_ptr->bearer->name);
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+/**
+ * ss_addr2str - convert SeaStar address to string
+ */
+
+static char *ss_addr2str(struct tipc_media_addr *a, char *str_buf, int str_size)
+{
+	unchar *addr = (unchar *)&a->dev_addr;
+
+	if (str_size < 20)
+		*str_buf = '\0';
+	else
+		sprintf(str_buf, "nid%u:%u", ntohl(*(__be32 *)addr), addr[5]);
+	return str_buf;
+}
+
+/**
+ * tipc_ss_media_start - activate SeaStar bearer support
+ *
+ * Register SeaStar media type with TIPC bearer code.  Also register
+ * with OS for notifications about device state changes.
+ */
+
+int tipc_ss_media_start(void)
+{
+	struct tipc_media_addr bcast_addr;
+	int res;
+
+	if (ss_started)
+		return -EINVAL;
+
+	bcast_addr.type = htonl(TIPC_MEDIA_TYPE_SEASTAR);
+	memset(&bcast_addr.dev_addr, 0xff, ETH_ALEN);
+
+	memset(ss_bearers, 0, sizeof(ss_bearers));
+
+	res = tipc_register_media(TIPC_MEDIA_TYPE_SEASTAR, "seastar",
+				  enable_bearer, disable_bearer, send_msg,
+				  ss_addr2str, &bcast_addr, SS_LINK_PRIORITY,
+				  SS_LINK_TOLERANCE, SS_LINK_WINDOW);
+	if (res)
+		return res;
+
+	notifier.notifier_call = &recv_notification;
+	notifier.priority = 0;
+	res = register_netdevice_notifier(&notifier);
+	if (!res)
+		ss_started = 1;
+	return res;
+}
+
+/**
+ * tipc_ss_media_stop - deactivate SeaStar bearer support
+ */
+
+void tipc_ss_media_stop(void)
+{
+	int i;
+
+	if (!ss_started)
+		return;
+
+	unregister_netdevice_notifier(&notifier);
+	for (i = 0; i < MAX_SS_BEARERS ; i++) {
+		if (ss_bearers[i].bearer) {
+			ss_bearers[i].bearer->blocked = 1;
+			ss_bearers[i].bearer = NULL;
+		}
+		if (ss_bearers[i].dev) {
+			dev_remove_pack(&ss_bearers[i].tipc_packet_type);
+			dev_put(ss_bearers[i].dev);
+		}
+	}
+	memset(&ss_bearers, 0, sizeof(ss_bearers));
+	ss_started = 0;
+}